@@ -61,6 +61,7 @@
 #include <string.h>
 
 #include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
@@ -73,6 +74,12 @@ struct command_info {
     const char *grp_name;
     const char *prepare;
     const char *round_prepare;
+    const char *setup;
+    const char *teardown;
+    const char *service;
+    const char *service_ready;
+    enum cache_state cache_state;
+    const char **cache_files;
 };
 
 enum cmd_multiplex_result {
@@ -85,7 +92,11 @@ enum {
     SUBST_CMD = 0x1,
     SUBST_INPUT = 0x2,
     SUBST_PREPARE = 0x4,
-    SUBST_ROUND_PREPARE = 0x8
+    SUBST_ROUND_PREPARE = 0x8,
+    SUBST_SETUP = 0x10,
+    SUBST_TEARDOWN = 0x20,
+    SUBST_SERVICE = 0x40,
+    SUBST_SERVICE_READY = 0x80
 };
 
 __thread uint64_t g_rng_state;
@@ -98,6 +109,7 @@ bool g_plot_src = false;
 bool g_use_perf = false;
 bool g_progress_bar = false;
 bool g_regr = false;
+bool g_scaling = false;
 bool g_plot_debug = false;
 bool g_save_bin = false;
 bool g_rename_all_used = false;
@@ -115,6 +127,28 @@ enum app_mode g_mode = APP_BENCH;
 struct bench_stop_policy g_warmup_stop = {0.1, 0, 1, 10};
 struct bench_stop_policy g_bench_stop = {5.0, 0, 5, 0};
 struct bench_stop_policy g_round_stop = {0, 0, INT_MAX, 0};
+double g_service_timeout = 10.0;
+bool g_pipe_io = false;
+const char *g_powercap_root = "/sys/class/powercap";
+bool g_flush_llc = false;
+struct perf_event_spec *g_perf_events = NULL;
+bool g_perf_builtin_used[PERF_CNT_BUILTIN_COUNT];
+struct meas_expr *g_meas_exprs = NULL;
+bool g_perf_rotate = false;
+bool g_perf_split = false;
+int g_perf_slots = 4;
+bool g_perf_roi = false;
+double g_rss_interval = 0.0;
+const char *g_alloc_shim = NULL;
+bool g_profile = false;
+int g_profile_runs = 3;
+double g_drain_rate = 0.0;
+const char *g_ready_re = NULL;
+const char *g_ready_connect = NULL;
+double g_ready_timeout = 10.0;
+const char *g_requests = NULL;
+int g_pipeline_depth = 1;
+double g_request_timeout = 10.0;
 // XXX: Mark this as volatile because we rely that this variable is changed
 // atomically when creating and destroying threads. Elements of this array could
 // only be written by a single thread, and reads are synchronized, so the data
@@ -454,6 +488,36 @@ static bool init_run_desc_stdout(struct bench_run_desc *desc)
     return true;
 }
 
+// Map input file to memory so it can be fed to command using vmsplice
+static bool init_run_desc_pipe(struct bench_run_desc *desc)
+{
+    assert(desc->stdin_fd != -1);
+    struct stat st;
+    if (fstat(desc->stdin_fd, &st) == -1) {
+        csperror("fstat");
+        return false;
+    }
+    desc->pipe_io = true;
+    desc->pipe_input_size = st.st_size;
+    if (st.st_size == 0)
+        return true;
+    void *input = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, desc->stdin_fd, 0);
+    if (input == MAP_FAILED) {
+        csperror("mmap");
+        return false;
+    }
+    desc->pipe_input = input;
+    const char *cursor = input;
+    const char *end = cursor + st.st_size;
+    while ((cursor = memchr(cursor, '\n', end - cursor)) != NULL) {
+        ++desc->pipe_record_count;
+        ++cursor;
+    }
+    if (end[-1] != '\n')
+        ++desc->pipe_record_count;
+    return true;
+}
+
 static bool init_run_desc(const struct command_info *cmd, const struct meas *meas,
                           size_t meas_count, struct bench_run_desc *desc)
 {
@@ -466,6 +530,22 @@ static bool init_run_desc(const struct command_info *cmd, const struct meas *mea
         sb_free(argv);
         return false;
     }
+    desc->setup = cmd->setup;
+    desc->teardown = cmd->teardown;
+    desc->service = cmd->service;
+    desc->service_ready = cmd->service_ready;
+    desc->cache_state = cmd->cache_state;
+    for (size_t i = 0; i < sb_len(cmd->cache_files); ++i)
+        sb_push(desc->cache_files, cmd->cache_files[i]);
+    // Input file is always subject to cache control
+    if (cmd->cache_state != CACHE_STATE_NONE && cmd->input.kind == INPUT_POLICY_FILE) {
+        const char *file = cmd->input.file;
+        if (g_inputd)
+            file = csfmt("%s/%s", g_inputd, file);
+        sb_push(desc->cache_files, file);
+    }
+    if (g_pipe_io && !init_run_desc_pipe(desc))
+        return false;
     return true;
 }
 
@@ -486,6 +566,20 @@ static struct command_info *init_raw_command_infos(const struct settings *settin
         cmd.grp_name = cmd_str;
         cmd.prepare = settings->prepare;
         cmd.round_prepare = settings->round_prepare;
+        cmd.setup = settings->setup;
+        cmd.teardown = settings->teardown;
+        cmd.service = settings->service;
+        cmd.service_ready = settings->service_ready;
+        cmd.cache_state = settings->cache_state;
+        cmd.cache_files = settings->cache_files;
+        if (cmd.cache_state == CACHE_STATE_BOTH) {
+            // Cold and warm variants are treated as separate commands
+            cmd.cache_state = CACHE_STATE_COLD;
+            cmd.name = cmd.grp_name = csfmt("%s [cold]", cmd_str);
+            sb_push(cmds, cmd);
+            cmd.cache_state = CACHE_STATE_WARM;
+            cmd.name = cmd.grp_name = csfmt("%s [warm]", cmd_str);
+        }
         sb_push(cmds, cmd);
     }
     return cmds;
@@ -519,6 +613,24 @@ static const char *subst_param_str(const char *src, const char *param_name,
     return csstrdup(buf);
 }
 
+// Set 'flag' in 'opt' if optional string 'src' contains parameter substitution
+static bool get_optional_subst_option(const char *src, const char *param_name, int flag,
+                                      int *opt)
+{
+    if (src == NULL)
+        return true;
+    switch (string_contains_param_subst(src, param_name)) {
+    case CMD_MULTIPLEX_ERROR:
+        return false;
+    case CMD_MULTIPLEX_SUCCESS:
+        *opt |= flag;
+        break;
+    case CMD_MULTIPLEX_NO_GROUPS:
+        break;
+    }
+    return true;
+}
+
 static enum cmd_multiplex_result get_subst_options(const struct command_info *cmd,
                                                    const char *param_name, int *optp)
 {
@@ -588,6 +700,13 @@ static enum cmd_multiplex_result get_subst_options(const struct command_info *cm
         }
     }
 
+    if (!get_optional_subst_option(cmd->setup, param_name, SUBST_SETUP, &opt) ||
+        !get_optional_subst_option(cmd->teardown, param_name, SUBST_TEARDOWN, &opt) ||
+        !get_optional_subst_option(cmd->service, param_name, SUBST_SERVICE, &opt) ||
+        !get_optional_subst_option(cmd->service_ready, param_name, SUBST_SERVICE_READY,
+                                   &opt))
+        return CMD_MULTIPLEX_ERROR;
+
     if (opt == 0)
         return CMD_MULTIPLEX_NO_GROUPS;
     *optp = opt;
@@ -641,6 +760,26 @@ static enum cmd_multiplex_result multiplex_command(const struct command_info *sr
             if (cmd.prepare == NULL)
                 return CMD_MULTIPLEX_ERROR;
         }
+        if (opt & SUBST_SETUP) {
+            cmd.setup = subst_param_str(cmd.setup, param->name, param_value);
+            if (cmd.setup == NULL)
+                return CMD_MULTIPLEX_ERROR;
+        }
+        if (opt & SUBST_TEARDOWN) {
+            cmd.teardown = subst_param_str(cmd.teardown, param->name, param_value);
+            if (cmd.teardown == NULL)
+                return CMD_MULTIPLEX_ERROR;
+        }
+        if (opt & SUBST_SERVICE) {
+            cmd.service = subst_param_str(cmd.service, param->name, param_value);
+            if (cmd.service == NULL)
+                return CMD_MULTIPLEX_ERROR;
+        }
+        if (opt & SUBST_SERVICE_READY) {
+            cmd.service_ready = subst_param_str(cmd.service_ready, param->name, param_value);
+            if (cmd.service_ready == NULL)
+                return CMD_MULTIPLEX_ERROR;
+        }
         sb_push(*multiplexed, cmd);
     }
     return CMD_MULTIPLEX_SUCCESS;
@@ -985,6 +1124,7 @@ static bool init_benches(const struct settings *settings,
         struct bench *bench = data->benches + i;
         bench->meas_count = data->meas_count;
         bench->meas = calloc(bench->meas_count, sizeof(*bench->meas));
+        bench->iters = calloc(bench->meas_count, sizeof(*bench->iters));
     }
     return true;
 }
@@ -1128,7 +1268,8 @@ static bool init_run_info(const struct settings *settings, struct bench_data *da
     bool has_custom_meas = false;
     for (size_t i = 0; i < sb_len(settings->meas); ++i) {
         if (settings->meas[i].kind == MEAS_CUSTOM ||
-            settings->meas[i].kind == MEAS_CUSTOM_RE) {
+            settings->meas[i].kind == MEAS_CUSTOM_RE ||
+            settings->meas[i].kind == MEAS_CUSTOM_RE_ITER) {
             has_custom_meas = true;
             break;
         }
@@ -1154,12 +1295,28 @@ void free_bench_data(struct bench_data *data)
         for (size_t j = 0; j < data->meas_count; ++j)
             sb_free(bench->meas[j]);
         free(bench->meas);
+        if (bench->iters != NULL) {
+            for (size_t j = 0; j < data->meas_count; ++j) {
+                sb_free(bench->iters[j].values);
+                sb_free(bench->iters[j].runs);
+            }
+            free(bench->iters);
+        }
+        free_profile(bench->profile);
+        free_profile(bench->off_cpu);
+        free_hdr_hist(&bench->requests.latency);
+        for (size_t j = 0; j < sb_len(bench->rss_timelines); ++j)
+            sb_free(bench->rss_timelines[j]);
+        sb_free(bench->rss_timelines);
         if (data->run_descs) {
             struct bench_run_desc *desc = data->run_descs + i;
             if (desc->stdout_fd != -1)
                 close(desc->stdout_fd);
             if (desc->stdin_fd != -1)
                 close(desc->stdin_fd);
+            if (desc->pipe_input)
+                munmap((void *)desc->pipe_input, desc->pipe_input_size);
+            sb_free(desc->cache_files);
             sb_free(desc->argv);
         }
     }
@@ -1350,6 +1507,7 @@ static void sigint_handler(int sig)
 {
     if (g_use_perf)
         perf_signal_cleanup();
+    run_signal_cleanup();
 
     // Use default signal handler
     struct sigaction action;
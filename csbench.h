@@ -97,6 +97,17 @@ enum output_kind {
     OUTPUT_POLICY_INHERIT,
 };
 
+// State of caches that is established before each run
+enum cache_state {
+    CACHE_STATE_NONE,
+    // Evict files from page cache and flush CPU caches
+    CACHE_STATE_COLD,
+    // Read files into page cache
+    CACHE_STATE_WARM,
+    // Only used in settings, each command is split into cold and warm variants
+    CACHE_STATE_BOTH
+};
+
 enum units_kind {
     // Time units
     MU_S,
@@ -110,7 +121,10 @@ enum units_kind {
     MU_GB,
 
     MU_CUSTOM,
-    MU_NONE
+    MU_NONE,
+    // Energy and power units
+    MU_J,
+    MU_W
 };
 
 struct units {
@@ -133,7 +147,83 @@ enum meas_kind {
     MEAS_PERF_CYCLES,
     MEAS_PERF_INS,
     MEAS_PERF_BRANCH,
-    MEAS_PERF_BRANCHM
+    MEAS_PERF_BRANCHM,
+    // Throughput in pipe I/O mode, computed from input size and wall clock time
+    MEAS_PIPE_BYTES_RATE,
+    MEAS_PIPE_RECORDS_RATE,
+    // Percentage of pages of cache files resident in page cache before run
+    MEAS_CACHE_RESIDENCY,
+    // Performance counter event from 'g_perf_events'
+    MEAS_PERF_EVENT,
+    // Top-down microarchitecture analysis metric, percentage of pipeline slots
+    MEAS_TMA,
+    // Sums of rusage fields, used instead of equivalent software performance
+    // counter events when perf_event_open is not permitted
+    MEAS_RUSAGE_CPUTIME,
+    MEAS_RUSAGE_FLT,
+    MEAS_RUSAGE_CSW,
+    // Value computed from other measurements of the same run using expression
+    // from 'g_meas_exprs'
+    MEAS_EXPR,
+    // Energy consumed during run according to RAPL counters, and average
+    // package power
+    MEAS_ENERGY_PKG,
+    MEAS_ENERGY_DRAM,
+    MEAS_AVG_POWER,
+    // I/O accounting of process tree from /proc/<pid>/io
+    MEAS_IO_RCHAR,
+    MEAS_IO_WCHAR,
+    MEAS_IO_SYSCR,
+    MEAS_IO_SYSCW,
+    MEAS_IO_READ_BYTES,
+    MEAS_IO_WRITE_BYTES,
+    // Time-weighted mean resident set size of process tree and its integral
+    // over run time, computed from samples taken with --rss-timeline
+    MEAS_RSS_MEAN,
+    MEAS_RSS_SECONDS,
+    // Time spent waiting on a runqueue and number of timeslices from
+    // /proc/<pid>/schedstat of command process
+    MEAS_SCHED_RUN_DELAY,
+    MEAS_SCHED_TIMESLICES,
+    // Time spent off CPU grouped by reason, from scheduler tracepoints
+    MEAS_OFF_CPU_IO,
+    MEAS_OFF_CPU_FUTEX,
+    MEAS_OFF_CPU_SLEEP,
+    MEAS_OFF_CPU_PREEMPT,
+    MEAS_OFF_CPU_OTHER,
+    // Totals reported by allocation shim loaded with LD_PRELOAD
+    MEAS_ALLOCS,
+    MEAS_ALLOC_BYTES,
+    MEAS_PEAK_HEAP,
+    // Value reported by command itself using csbench_probe.h
+    MEAS_PROBE,
+    // Same as MEAS_CUSTOM_RE, but every match in output of run is a separate
+    // iteration sample, and value of run is their mean
+    MEAS_CUSTOM_RE_ITER,
+    // Time from start of command to first byte of its stdout
+    MEAS_TTFB,
+    // Time from start of command until it satisfies --ready-re or --ready-connect
+    MEAS_TIME_TO_READY,
+    // Latency of one request sent to command launched with --requests
+    MEAS_REQ_LATENCY,
+    // Runtime linker statistics reported by glibc with LD_DEBUG=statistics
+    MEAS_LD_STARTUP,
+    MEAS_LD_RELOC_TIME,
+    MEAS_LD_LOAD_TIME,
+    MEAS_LD_RELOCS,
+    MEAS_LD_RELATIVE_RELOCS
+};
+
+// Order matches MEAS_OFF_CPU_* measurements
+enum off_cpu_reason {
+    // Uninterruptible sleep, usually waiting for storage I/O
+    OFF_CPU_IO,
+    OFF_CPU_FUTEX,
+    OFF_CPU_SLEEP,
+    // Task was runnable, but has been preempted
+    OFF_CPU_PREEMPT,
+    OFF_CPU_OTHER,
+    OFF_CPU_REASON_COUNT
 };
 
 struct meas {
@@ -142,12 +232,17 @@ struct meas {
     // If measurement is MEAS_CUSTOM, contains command string to be executed in
     // shell to do custom measurement.
     const char *cmd;
-    // If measurement is MEAS_CUSTOM_RE, contains regular expresion.
+    // If measurement is MEAS_CUSTOM_RE or MEAS_CUSTOM_RE_ITER, contains regular
+    // expresion.
     const char *re;
     struct units units;
     enum meas_kind kind;
     bool is_secondary;
     size_t primary_idx;
+    // If measurement is MEAS_PERF_EVENT, contains index of event in 'g_perf_events'.
+    // If measurement is MEAS_TMA, contains 'enum tma_metric'.
+    // If measurement is MEAS_EXPR, contains index of expression in 'g_meas_exprs'.
+    size_t event_idx;
 };
 
 // Variable which can be substituted in command string.
@@ -212,6 +307,145 @@ struct distr {
     struct outliers outliers;
 };
 
+// Maximum number of events specified with --meas in addition to builtin
+// performance counters
+#define MAX_PERF_EVENTS 64
+
+// Hardware performance counter event, arguments of perf_event_open
+struct perf_event_spec {
+    const char *name;
+    uint32_t type;
+    uint64_t config;
+    // Set by 'u' and 'k' modifiers to count only kernel or user mode
+    bool exclude_user;
+    bool exclude_kernel;
+    // Value is in nanoseconds, which is the case for software clock events
+    bool is_time;
+    // Event is opened in the same group as previous event, so that they are
+    // always scheduled together
+    bool group_with_prev;
+};
+
+enum meas_expr_op_kind {
+    MEAS_EXPR_CONST,
+    MEAS_EXPR_MEAS,
+    MEAS_EXPR_ADD,
+    MEAS_EXPR_SUB,
+    MEAS_EXPR_MUL,
+    MEAS_EXPR_DIV,
+    MEAS_EXPR_NEG
+};
+
+struct meas_expr_op {
+    enum meas_expr_op_kind kind;
+    // If kind is MEAS_EXPR_CONST, contains constant value. If kind is
+    // MEAS_EXPR_MEAS, contains multiplier converting measurement to base units.
+    double value;
+    // If kind is MEAS_EXPR_MEAS, contains index of measurement
+    size_t meas_idx;
+};
+
+#define MEAS_EXPR_MAX_STACK 64
+
+// Arithmetic expression over measurements specified with --meas-expr,
+// compiled to postfix form
+struct meas_expr {
+    const char *str;
+    struct meas_expr_op *ops;
+    // Units of result, seconds or bytes if expression only combines time or
+    // memory measurements
+    struct units units;
+};
+
+// Top-down microarchitecture analysis metrics, level 1 followed by level 2
+enum tma_metric {
+    TMA_FRONTEND_BOUND,
+    TMA_BAD_SPECULATION,
+    TMA_BACKEND_BOUND,
+    TMA_RETIRING,
+    TMA_FETCH_LATENCY,
+    TMA_FETCH_BANDWIDTH,
+    TMA_BRANCH_MISPREDICTS,
+    TMA_MACHINE_CLEARS,
+    TMA_MEMORY_BOUND,
+    TMA_CORE_BOUND,
+    TMA_HEAVY_OPERATIONS,
+    TMA_LIGHT_OPERATIONS,
+    TMA_METRIC_COUNT
+};
+
+#define TMA_LEVEL1_COUNT 4
+
+// Indexes of builtin events in 'struct perf_cnt'
+enum {
+    PERF_CNT_CYCLES,
+    PERF_CNT_INSTRUCTIONS,
+    PERF_CNT_BRANCHES,
+    PERF_CNT_BRANCH_MISSES,
+    // Events from 'g_perf_events' follow builtin ones
+    PERF_CNT_BUILTIN_COUNT
+};
+
+#define MAX_PERF_CNT (PERF_CNT_BUILTIN_COUNT + MAX_PERF_EVENTS)
+
+// Performance counter values collected in a single run
+struct perf_cnt {
+    // Values of builtin events followed by events from 'g_perf_events', scaled
+    // by ratio of time enabled to time running if counters have been multiplexed
+    double values[MAX_PERF_CNT];
+    // With --perf-rotate only one group of events is counted in each run
+    bool counted[MAX_PERF_CNT];
+};
+
+// Resource usage of --service process accumulated over its whole lifetime
+struct service_stats {
+    double utime;
+    double stime;
+    // In bytes
+    double maxrss;
+    bool has_pmc;
+    struct perf_cnt pmc;
+};
+
+// Histogram of nonnegative values with logarithmic buckets split into linear
+// sub-buckets, like HdrHistogram. Values are recorded in nanoseconds with
+// relative error of less than 0.1%, using memory proportional to logarithm of
+// value range instead of number of values.
+struct hdr_hist {
+    uint64_t *counts; // sb
+    uint64_t total;
+};
+
+// Statistics of requests sent to command in --requests mode
+struct request_stats {
+    size_t count;
+    // Time spent sending requests and waiting for responses
+    double time;
+    struct hdr_hist latency;
+};
+
+// Folded call stack as used by flamegraph.pl: name of process followed by
+// frames from root to leaf, separated by ';'
+struct profile_stack {
+    char *stack;
+    // Number of samples with this stack
+    size_t count;
+};
+
+// Resident set size of process tree at given time since start of run
+struct rss_sample {
+    double time;
+    // In bytes
+    double rss;
+};
+
+// Samples of measurement that reports multiple values per run
+struct iter_samples {
+    double *values; // sb
+    // Index of run each value belongs to
+    size_t *runs; // sb
+};
+
 // Runtime information about benchmark. When running, this structure is being
 // filled accordingly with results of execution and, in particular, measurement
 // values. This is later passed down for analysis.
@@ -221,6 +455,23 @@ struct bench {
     int *exit_codes;
     size_t meas_count;
     double **meas; // [meas_count]
+    bool has_service;
+    struct service_stats service;
+    // Collected in --requests mode, not saved in binary format
+    bool has_requests;
+    struct request_stats requests;
+    // Samples collected with --profile, not saved in binary format
+    struct profile_stack *profile; // sb
+    // RSS samples of each run collected with --rss-timeline, not saved in
+    // binary format
+    struct rss_sample **rss_timelines; // [run_count]
+    // Stacks at which command was switched out with counts in microseconds
+    // spent off CPU, collected with off-CPU measurements, not saved in binary
+    // format
+    struct profile_stack *off_cpu; // sb
+    // Iteration samples of MEAS_CUSTOM_RE_ITER measurements, not saved in
+    // binary format
+    struct iter_samples *iters; // [meas_count]
 };
 
 struct bench_data_storage {
@@ -248,6 +499,23 @@ struct bench_analysis {
     const char *name;
 };
 
+struct time_breakdown {
+    double on_cpu;
+    double runqueue;
+    double sleeping;
+};
+
+// Variance of iteration samples split into variance within runs and variance
+// between means of runs, estimated with one-way random effects model
+struct iter_variance {
+    size_t count;
+    size_t run_count;
+    double within_st_dev;
+    double between_st_dev;
+    // Intraclass correlation, fraction of variance that is between runs
+    double icc;
+};
+
 enum big_o {
     O_1,
     O_N,
@@ -278,6 +546,25 @@ struct ols_regress {
     double rms;
 };
 
+// Scalability of group when parameter is degree of parallelism (thread
+// count). Relative capacity is C(N) = N0 * T(N0) / T(N), where N0 is the
+// lowest parameter value, and it is fitted to
+//   Amdahl's law: C(N) = N / (1 + s (N - 1)), s is serial fraction;
+//   Universal Scalability Law: C(N) = N / (1 + a (N - 1) + b N (N - 1)),
+//   a is contention and b is coherency coefficient.
+struct scaling_fit {
+    double *speedup;    // [value_count]
+    double *efficiency; // [value_count]
+    struct est serial;
+    struct est contention;
+    struct est coherency;
+    double amdahl_r2;
+    double usl_r2;
+    // Parameter value with maximal capacity predicted by USL, INFINITY
+    // if coherency is zero, NAN if capacity does not grow at all.
+    double usl_peak;
+};
+
 struct group_analysis {
     size_t grp_idx;
     const struct bench_group *group;
@@ -288,13 +575,10 @@ struct group_analysis {
     // Linear regression can only be performed when values are numbers
     bool values_are_doubles;
     struct ols_regress regress;
-};
-
-struct perf_cnt {
-    uint64_t cycles;
-    uint64_t branches;
-    uint64_t missed_branches;
-    uint64_t instructions;
+    // Scaling analysis is done when --scaling flag is passed and all values
+    // are positive numbers
+    bool has_scaling;
+    struct scaling_fit scaling;
 };
 
 // Point estimate with error. Standard deviation is used as error.
@@ -401,10 +685,27 @@ struct bench_run_desc {
     int stdin_fd;
     // If not -1, pipe stdout to this file
     int stdout_fd;
+    // In pipe I/O mode stdin is fed from memory mapping of input file through a
+    // pipe, and stdout is drained through a pipe
+    bool pipe_io;
+    const char *pipe_input;
+    size_t pipe_input_size;
+    // Number of newline-separated records in input
+    size_t pipe_record_count;
     // Shell command to be executed before each run
     const char *prepare;
     // Shell command to be executed before each round
     const char *round_prepare;
+    // Shell commands to be executed before the first and after the last run
+    const char *setup;
+    const char *teardown;
+    // Shell command launched in background for the lifetime of benchmark and
+    // command checking that it is ready to accept work
+    const char *service;
+    const char *service_ready;
+    // Files which page cache state is controlled before each run
+    enum cache_state cache_state;
+    const char **cache_files;
 };
 
 struct output_anchor {
@@ -434,6 +735,12 @@ struct settings {
     struct rename_entry *rename_list;
     const char *prepare;
     const char *round_prepare;
+    const char *setup;
+    const char *teardown;
+    const char *service;
+    const char *service_ready;
+    enum cache_state cache_state;
+    const char **cache_files;
 };
 
 enum app_mode {
@@ -497,6 +804,8 @@ struct plot_maker {
     bool (*group_bar)(const struct meas_analysis *al, struct plot_maker_ctx *ctx);
     bool (*group_regr)(const struct meas_analysis *al, size_t idx,
                        struct plot_maker_ctx *ctx);
+    bool (*group_scaling)(const struct meas_analysis *al, size_t idx,
+                          struct plot_maker_ctx *ctx);
     bool (*kde_small)(const struct distr *distr, const struct meas *meas,
                       struct plot_maker_ctx *ctx);
     bool (*kde)(const struct distr *distr, const struct meas *meas, const char *name,
@@ -511,6 +820,7 @@ struct plot_maker {
                             struct plot_maker_ctx *ctx);
     bool (*kde_cmp_group)(const struct meas_analysis *al, size_t bench_idx,
                           struct plot_maker_ctx *ctx);
+    bool (*rss_timeline)(const struct meas_analysis *al, struct plot_maker_ctx *ctx);
 };
 
 enum {
@@ -524,6 +834,8 @@ enum {
     MAKE_PLOT_KDE_CMP_ALL_GROUPS = 0x80,
     MAKE_PLOT_KDE_CMP_PER_VAL = 0x100,
     MAKE_PLOT_KDE_CMP_PER_VAL_SMALL = 0x200,
+    MAKE_PLOT_GROUP_SCALING = 0x400,
+    MAKE_PLOT_RSS_TIMELINE = 0x800,
 };
 
 enum parse_time_str_result {
@@ -612,6 +924,9 @@ extern bool g_progress_bar;
 // Use linear regression to estimate slope when doing parameterized
 // benchmark.
 extern bool g_regr;
+// Treat benchmark parameter as thread count and fit Amdahl's law and USL
+// to speedups.
+extern bool g_scaling;
 extern bool g_plot_debug;
 extern bool g_save_bin;
 extern bool g_rename_all_used;
@@ -632,6 +947,46 @@ extern enum app_mode g_mode;
 extern struct bench_stop_policy g_warmup_stop;
 extern struct bench_stop_policy g_bench_stop;
 extern struct bench_stop_policy g_round_stop;
+// Maximum time to wait for --service to become ready
+extern double g_service_timeout;
+extern bool g_pipe_io;
+// Directory containing powercap class devices, used for energy measurements
+extern const char *g_powercap_root;
+// Path to allocation shim library set with --alloc-shim, NULL if it should be
+// searched next to csbench executable
+extern const char *g_alloc_shim;
+extern bool g_flush_llc;
+extern struct perf_event_spec *g_perf_events;
+// Builtin events that are requested, indexed by PERF_CNT_* constants
+extern bool g_perf_builtin_used[PERF_CNT_BUILTIN_COUNT];
+extern bool g_perf_rotate;
+extern struct meas_expr *g_meas_exprs;
+extern bool g_perf_split;
+extern int g_perf_slots;
+// Count performance counters only inside region of interest marked by command
+extern bool g_perf_roi;
+// Interval between RSS samples in seconds, zero if --rss-timeline is not used
+extern double g_rss_interval;
+extern bool g_profile;
+// Number of additional runs of each benchmark executed under profiler
+extern int g_profile_runs;
+extern double g_drain_rate;
+// Command is ready when this regular expression matches line of its stdout or
+// stderr, NULL if not set
+extern const char *g_ready_re;
+// Command is ready when this local TCP port or Unix socket accepts connections,
+// NULL if not set
+extern const char *g_ready_connect;
+// Maximum time to wait for command to become ready
+extern double g_ready_timeout;
+// File with requests that are sent to command launched once per benchmark,
+// NULL if not set
+extern const char *g_requests;
+// Maximum number of requests sent to command before receiving their responses
+extern int g_pipeline_depth;
+// Maximum time to wait for command to make progress in reading requests or
+// writing responses
+extern double g_request_timeout;
 extern struct output_anchor *volatile g_output_anchors;
 extern const char *g_json_export_filename;
 extern const char *g_out_dir;
@@ -671,13 +1026,25 @@ bool load_bench_data_text(const char **file_list, struct bench_data *data,
 
 bool do_analysis_and_make_report(const struct bench_data *data);
 
+// Split mean wall clock time of benchmark into fractions of time spent on
+// CPU, waiting on a runqueue and sleeping. Requires wall, utime, stime and
+// run-delay measurements, returns false if any of them is missing.
+bool get_time_breakdown(const struct analysis *al, size_t bench_idx,
+                        struct time_breakdown *breakdown);
+// Returns false if measurement has no iteration samples
+bool get_iter_variance(const struct bench *bench, size_t meas_idx,
+                       struct iter_variance *variance);
 double ols_approx(const struct ols_regress *regress, double n);
+double amdahl_approx(const struct scaling_fit *fit, double n);
+double usl_approx(const struct scaling_fit *fit, double n);
 
 //
 // csbench_run.c
 //
 
 bool run_benches(struct bench_data *data);
+// Kill background services, called from signal handler
+void run_signal_cleanup(void);
 
 //
 // csbench_report.c
@@ -689,6 +1056,10 @@ size_t ith_bench_idx(size_t i, const struct meas_analysis *al);
 size_t ith_per_val_group_idx(size_t i, size_t val_idx, const struct meas_analysis *al);
 size_t ith_group_by_avg_idx(size_t i, const struct meas_analysis *al);
 size_t ith_group_by_total_idx(size_t i, const struct meas_analysis *al);
+// Index of benchmark differential flame graphs are made against, or SIZE_MAX
+size_t profile_ref_idx(const struct analysis *al);
+bool has_rss_timeline_plot(const struct meas_analysis *al);
+bool has_scaling_analysis(const struct meas_analysis *al);
 
 //
 // csbench_html.c
@@ -700,16 +1071,83 @@ bool make_html_report(const struct analysis *al);
 // csbench_perf.c
 //
 
+// Parse name of performance counter event other than builtin ones. Supports
+// generic hardware and cache events, raw 'rNNNN' encodings and 'type:config'
+// pairs, optionally followed by ':u' or ':k' modifiers, which also apply to
+// builtin events.
+bool parse_perf_event_str(const char *str, struct perf_event_spec *spec);
+// Get measurement that can substitute software event if performance counters
+// are not available. Returns false if there is no such measurement.
+bool perf_event_fallback(const struct perf_event_spec *spec, enum meas_kind *kind);
+bool perf_events_available(void);
 bool init_perf(void);
 void deinit_perf(void);
 void perf_signal_cleanup(void);
-// collect performance counters for process specified by 'pid'.
-// That process is considered blocked on sigwait() when this function is
-// called, to wake up process this function sends it SIGUSR1. This function
-// runs and collects performance counters until process has finished, and
-// consolidates results. Process can still be waited after this function has
-// finished executing.
-bool perf_cnt_collect(pid_t pid, struct perf_cnt *cnt);
+// Prepare performance counters of the calling thread for run 'run_idx', must
+// be called before forking the process that is measured. 'run_idx' selects
+// group of events that is counted when --perf-rotate is used.
+bool perf_cnt_prepare(size_t run_idx);
+// collect performance counters for process specified by 'pid', which has
+// been forked after 'perf_cnt_prepare' call with the same 'run_idx'. On Linux
+// counting starts when the process calls execve, on macOS the process is
+// considered blocked on sigwait() and this function sends it SIGUSR1. This
+// function waits until process has finished and consolidates results.
+// Process can still be waited after this function has finished executing.
+bool perf_cnt_collect(pid_t pid, size_t run_idx, struct perf_cnt *cnt);
+// Get descriptors of counters used for run 'run_idx'. With --perf-roi they are
+// inherited by command, which enables counting with them, see csbench_probe.h.
+// Linux only.
+bool perf_cnt_roi_fds(size_t run_idx, const int **fds, size_t *count);
+// Close performance counters of the calling thread. Must be called before
+// forking long-lived helper processes, which would otherwise inherit
+// counters and add to the counts of measured commands.
+void perf_cnt_release(void);
+// Number of groups events are split into, which is 1 unless --perf-rotate is used
+size_t perf_group_count(void);
+// Add events required for top-down microarchitecture analysis to
+// 'g_perf_events'. Returns number of metrics that can be computed, which is
+// 'TMA_LEVEL1_COUNT' or 'TMA_METRIC_COUNT', or 0 if CPU does not support it.
+size_t perf_tma_init(void);
+const char *tma_metric_name(enum tma_metric metric);
+// Compute top-down metric in percent of pipeline slots from counters of a
+// single run. Returns false if required events have not been counted.
+bool perf_tma_metric(const struct perf_cnt *cnt, enum tma_metric metric, double *value);
+// Start counting performance counters for already running process 'pid' and
+// all threads and processes it creates afterwards. Counting is stopped and
+// results are read with 'perf_cnt_detach', which also frees the tracker.
+struct perf_cnt_tracker *perf_cnt_attach(pid_t pid);
+bool perf_cnt_detach(struct perf_cnt_tracker *tracker, struct perf_cnt *cnt);
+
+//
+// csbench_profile.c
+//
+
+// Open sampling profiler for commands forked by the calling thread, which are
+// sampled after they call execve(2).
+struct profiler *profiler_open(void);
+// Collect samples of process 'pid' and its descendants until it exits.
+// Process can still be waited after this function has finished executing.
+bool profiler_collect(struct profiler *profiler, pid_t pid);
+// Close profiler. If 'profile' is not NULL, folded stacks of all samples
+// collected are merged into it.
+void profiler_close(struct profiler *profiler, struct profile_stack **profile);
+// Load sched:sched_switch tracepoint format and kernel symbols used by
+// off-CPU tracers. Must be called before any tracer is opened.
+bool off_cpu_init(void);
+void off_cpu_deinit(void);
+// Open tracer of time that commands forked by the calling thread spend off
+// CPU. It is used in the same way as sampling profiler, but stacks are
+// collected each time command is switched out.
+struct profiler *off_cpu_profiler_open(void);
+// Get time in seconds spent off CPU for each reason since previous call
+void profiler_off_cpu_times(struct profiler *profiler, double *times);
+void free_profile(struct profile_stack *profile);
+// Write flame graph in SVG format. If 'base' is not NULL, write differential
+// flame graph instead, which has shape of 'profile' and is colored by change
+// in share of samples of each frame compared to 'base'. 'units' names what
+// stack counts are.
+bool write_flamegraph(const struct profile_stack *profile, const struct profile_stack *base,
+                      const char *title, const char *units, FILE *f);
 
 //
 // csbench_plot.c
@@ -727,6 +1165,7 @@ __attribute__((format(printf, 3, 4))) void fprintf_colored(FILE *f, const char *
                                                            const char *fmt, ...);
 __attribute__((format(printf, 1, 2))) void error(const char *fmt, ...);
 void errorv(const char *fmt, va_list args);
+__attribute__((format(printf, 1, 2))) void warning(const char *fmt, ...);
 void csperror(const char *msg);
 void csfmtperror(const char *fmt, ...);
 void csfdperror(int fd, const char *msg);
@@ -739,16 +1178,27 @@ void *sb_grow_impl(void *arr, size_t inc, size_t stride);
 
 double get_time(void);
 
+void hdr_hist_record(struct hdr_hist *hist, double value);
+// Value at quantile 'q' in range [0, 1], which is midpoint of its bucket
+double hdr_hist_quantile(const struct hdr_hist *hist, double q);
+void free_hdr_hist(struct hdr_hist *hist);
+
 bool units_is_time(const struct units *units);
+double units_base_multiplier(const struct units *units);
 const char *units_str(const struct units *units);
 enum parse_time_str_result parse_time_str(const char *str, enum units_kind target_units,
                                           double *value);
 
 void parse_units_str(const char *str, struct units *units);
 bool parse_meas_str(const char *str, enum meas_kind *kind);
+// Compile expression referring to measurements from 'meas' by name
+bool compile_meas_expr(const char *str, const struct meas *meas, size_t meas_count,
+                       struct meas_expr *expr);
+double eval_meas_expr(const struct meas_expr *expr, double *const *meas, size_t run_idx);
 
 int format_time(char *dst, size_t sz, double t);
 int format_memory(char *dst, size_t sz, double t);
+int format_si(char *dst, size_t sz, double t, const char *units);
 void format_meas(char *buf, size_t buf_size, double value, const struct units *units);
 
 const char *outliers_variance_str(double fraction);
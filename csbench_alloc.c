@@ -0,0 +1,279 @@
+// csbench
+// command-line benchmarking tool
+// Ilya Vinogradov 2024
+// https://github.com/Holodome/csbench
+//
+// csbench is dual-licensed under the terms of the MIT License and the Apache
+// License 2.0. This file may not be copied, modified, or distributed except
+// according to those terms.
+//
+// MIT License Notice
+//
+//    MIT License
+//
+//    Copyright (c) 2024-2026 Ilya Vinogradov
+//
+//    Permission is hereby granted, free of charge, to any
+//    person obtaining a copy of this software and associated
+//    documentation files (the "Software"), to deal in the
+//    Software without restriction, including without
+//    limitation the rights to use, copy, modify, merge,
+//    publish, distribute, sublicense, and/or sell copies of
+//    the Software, and to permit persons to whom the Software
+//    is furnished to do so, subject to the following
+//    conditions:
+//
+//    The above copyright notice and this permission notice
+//    shall be included in all copies or substantial portions
+//    of the Software.
+//
+//    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF
+//    ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED
+//    TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+//    PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT
+//    SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+//    CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+//    OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR
+//    IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+//    DEALINGS IN THE SOFTWARE.
+//
+// Apache License (Version 2.0) Notice
+//
+//    Copyright 2024 Ilya Vinogradov
+//    Licensed under the Apache License, Version 2.0 (the "License");
+//    you may not use this file except in compliance with the License.
+//    You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+//    Unless required by applicable law or agreed to in writing, software
+//    distributed under the License is distributed on an "AS IS" BASIS,
+//    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//    See the License for the specific language governing permissions and
+//    limitations under the License.
+
+// Allocation counting shim, which is loaded into benchmarked commands with
+// LD_PRELOAD. It is built as a separate shared library and does not include
+// csbench.h.
+//
+// Each process counts allocations made through malloc family of functions
+// and, when it exits, appends a line with totals to file descriptor set in
+// CSBENCH_ALLOC_FD environment variable:
+//
+//     csbench-alloc <allocations> <bytes requested> <peak live heap bytes>
+//
+// Live heap is tracked using malloc_usable_size(3), so it includes allocator
+// rounding.
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <errno.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// dlsym can allocate memory before real allocation functions are known, so
+// such allocations are served from static buffer and are never freed
+#define BOOTSTRAP_SIZE 4096
+
+static void *(*real_malloc)(size_t);
+static void *(*real_calloc)(size_t, size_t);
+static void *(*real_realloc)(void *, size_t);
+static void (*real_free)(void *);
+static int (*real_posix_memalign)(void **, size_t, size_t);
+static void *(*real_aligned_alloc)(size_t, size_t);
+static void *(*real_memalign)(size_t, size_t);
+
+static char g_bootstrap[BOOTSTRAP_SIZE] __attribute__((aligned(16)));
+static size_t g_bootstrap_used;
+static int g_initializing;
+
+static int g_fd = -1;
+static uint64_t g_allocs;
+static uint64_t g_bytes;
+static int64_t g_live;
+static int64_t g_peak;
+
+static void *bootstrap_alloc(size_t size)
+{
+    size = (size + 15) & ~(size_t)15;
+    if (g_bootstrap_used + size > sizeof(g_bootstrap))
+        return NULL;
+    void *ptr = g_bootstrap + g_bootstrap_used;
+    g_bootstrap_used += size;
+    return ptr;
+}
+
+static int is_bootstrap(const void *ptr)
+{
+    const char *cptr = ptr;
+    return cptr >= g_bootstrap && cptr < g_bootstrap + BOOTSTRAP_SIZE;
+}
+
+static void resolve(void *dst, const char *name)
+{
+    // Conversion between object and function pointers is not allowed in ISO C
+    void *sym = dlsym(RTLD_NEXT, name);
+    memcpy(dst, &sym, sizeof(sym));
+}
+
+static void init_real_functions(void)
+{
+    if (real_malloc != NULL || g_initializing)
+        return;
+    g_initializing = 1;
+    resolve(&real_calloc, "calloc");
+    resolve(&real_realloc, "realloc");
+    resolve(&real_free, "free");
+    resolve(&real_posix_memalign, "posix_memalign");
+    resolve(&real_aligned_alloc, "aligned_alloc");
+    resolve(&real_memalign, "memalign");
+    resolve(&real_malloc, "malloc");
+    g_initializing = 0;
+}
+
+static void count_alloc(size_t size, int64_t usable)
+{
+    __atomic_add_fetch(&g_allocs, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&g_bytes, size, __ATOMIC_RELAXED);
+    int64_t live = __atomic_add_fetch(&g_live, usable, __ATOMIC_RELAXED);
+    int64_t peak = __atomic_load_n(&g_peak, __ATOMIC_RELAXED);
+    while (live > peak && !__atomic_compare_exchange_n(&g_peak, &peak, live, 1,
+                                                       __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+static void count_free(void *ptr)
+{
+    __atomic_sub_fetch(&g_live, (int64_t)malloc_usable_size(ptr), __ATOMIC_RELAXED);
+}
+
+void *malloc(size_t size)
+{
+    init_real_functions();
+    if (real_malloc == NULL)
+        return bootstrap_alloc(size);
+    void *ptr = real_malloc(size);
+    if (ptr != NULL)
+        count_alloc(size, malloc_usable_size(ptr));
+    return ptr;
+}
+
+void *calloc(size_t count, size_t size)
+{
+    init_real_functions();
+    if (real_calloc == NULL) {
+        if (size != 0 && count > SIZE_MAX / size)
+            return NULL;
+        // Static buffer is zero-initialized and never reused
+        return bootstrap_alloc(count * size);
+    }
+    void *ptr = real_calloc(count, size);
+    if (ptr != NULL)
+        count_alloc(count * size, malloc_usable_size(ptr));
+    return ptr;
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    init_real_functions();
+    if (ptr != NULL && is_bootstrap(ptr)) {
+        void *new_ptr = malloc(size);
+        if (new_ptr != NULL) {
+            size_t available = g_bootstrap + BOOTSTRAP_SIZE - (char *)ptr;
+            memcpy(new_ptr, ptr, size < available ? size : available);
+        }
+        return new_ptr;
+    }
+    if (real_realloc == NULL)
+        return NULL;
+    int64_t old_usable = ptr != NULL ? (int64_t)malloc_usable_size(ptr) : 0;
+    void *new_ptr = real_realloc(ptr, size);
+    if (new_ptr != NULL) {
+        __atomic_sub_fetch(&g_live, old_usable, __ATOMIC_RELAXED);
+        count_alloc(size, malloc_usable_size(new_ptr));
+    } else if (size == 0 && ptr != NULL) {
+        __atomic_sub_fetch(&g_live, old_usable, __ATOMIC_RELAXED);
+    }
+    return new_ptr;
+}
+
+void free(void *ptr)
+{
+    if (ptr == NULL || is_bootstrap(ptr))
+        return;
+    init_real_functions();
+    count_free(ptr);
+    real_free(ptr);
+}
+
+int posix_memalign(void **ptr, size_t alignment, size_t size)
+{
+    init_real_functions();
+    if (real_posix_memalign == NULL)
+        return ENOMEM;
+    int ret = real_posix_memalign(ptr, alignment, size);
+    if (ret == 0)
+        count_alloc(size, malloc_usable_size(*ptr));
+    return ret;
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+    init_real_functions();
+    if (real_aligned_alloc == NULL)
+        return NULL;
+    void *ptr = real_aligned_alloc(alignment, size);
+    if (ptr != NULL)
+        count_alloc(size, malloc_usable_size(ptr));
+    return ptr;
+}
+
+void *memalign(size_t alignment, size_t size)
+{
+    init_real_functions();
+    if (real_memalign == NULL)
+        return NULL;
+    void *ptr = real_memalign(alignment, size);
+    if (ptr != NULL)
+        count_alloc(size, malloc_usable_size(ptr));
+    return ptr;
+}
+
+// Forked child reports its own allocations. Blocks inherited from parent can
+// still be freed by child, so live heap can become negative.
+static void reset_counters(void)
+{
+    g_allocs = 0;
+    g_bytes = 0;
+    g_live = 0;
+    g_peak = 0;
+}
+
+__attribute__((constructor)) static void csbench_alloc_init(void)
+{
+    init_real_functions();
+    // Read before command has a chance to change its environment
+    const char *fd_str = getenv("CSBENCH_ALLOC_FD");
+    if (fd_str != NULL)
+        g_fd = atoi(fd_str);
+    pthread_atfork(NULL, NULL, reset_counters);
+}
+
+__attribute__((destructor)) static void csbench_alloc_fini(void)
+{
+    if (g_fd < 0)
+        return;
+    char buf[128];
+    int len = snprintf(buf, sizeof(buf), "csbench-alloc %llu %llu %lld\n",
+                       (unsigned long long)__atomic_load_n(&g_allocs, __ATOMIC_RELAXED),
+                       (unsigned long long)__atomic_load_n(&g_bytes, __ATOMIC_RELAXED),
+                       (long long)__atomic_load_n(&g_peak, __ATOMIC_RELAXED));
+    // File is opened in append mode, so lines of different processes are not
+    // interleaved
+    ssize_t ret = write(g_fd, buf, len);
+    (void)ret;
+}
@@ -280,6 +280,165 @@ static void ols(const double *x, const double *y, size_t count, struct ols_regre
     set_ols_rvalue(x, y, count, result);
 }
 
+// Fit Amdahl's law and USL to relative capacities using their linearized
+// forms:
+//   N / C(N) - 1 = s (N - 1)
+//   N / C(N) - 1 = a (N - 1) + b N (N - 1)
+// All coefficients are constrained to be non-negative, and serial fraction and
+// contention can't exceed 1, which already means no speedup at all.
+static void fit_scaling(const double *n, const double *c, size_t count, double *serial,
+                        double *contention, double *coherency)
+{
+    double x1x1 = 0.0, x1x2 = 0.0, x2x2 = 0.0, x1y = 0.0, x2y = 0.0;
+    for (size_t i = 0; i < count; ++i) {
+        double x1 = n[i] - 1.0;
+        double x2 = n[i] * (n[i] - 1.0);
+        double y = n[i] / c[i] - 1.0;
+        x1x1 += x1 * x1;
+        x1x2 += x1 * x2;
+        x2x2 += x2 * x2;
+        x1y += x1 * y;
+        x2y += x2 * y;
+    }
+    double s = x1x1 != 0.0 ? x1y / x1x1 : 0.0;
+    if (s < 0.0)
+        s = 0.0;
+    else if (s > 1.0)
+        s = 1.0;
+    double a = s, b = 0.0;
+    double det = x1x1 * x2x2 - x1x2 * x1x2;
+    if (det != 0.0) {
+        double a_full = (x1y * x2x2 - x2y * x1x2) / det;
+        double b_full = (x2y * x1x1 - x1y * x1x2) / det;
+        if (b_full < 0.0) {
+            // Fall back to Amdahl's law
+        } else if (a_full < 0.0) {
+            a = 0.0;
+            b = x2x2 != 0.0 ? x2y / x2x2 : 0.0;
+            if (b < 0.0)
+                b = 0.0;
+        } else if (a_full > 1.0) {
+            a = 1.0;
+            b = x2x2 != 0.0 ? (x2y - x1x2) / x2x2 : 0.0;
+            if (b < 0.0)
+                b = 0.0;
+        } else {
+            a = a_full;
+            b = b_full;
+        }
+    }
+    *serial = s;
+    *contention = a;
+    *coherency = b;
+}
+
+double amdahl_approx(const struct scaling_fit *fit, double n)
+{
+    return n / (1.0 + fit->serial.point * (n - 1.0));
+}
+
+double usl_approx(const struct scaling_fit *fit, double n)
+{
+    return n / (1.0 + fit->contention.point * (n - 1.0) +
+                fit->coherency.point * n * (n - 1.0));
+}
+
+static double scaling_r2(const double *n, const double *c, size_t count,
+                         const struct scaling_fit *fit,
+                         double (*approx)(const struct scaling_fit *, double))
+{
+    double mean = 0.0;
+    for (size_t i = 0; i < count; ++i)
+        mean += c[i];
+    mean /= count;
+    double ss_tot = 0.0, ss_res = 0.0;
+    for (size_t i = 0; i < count; ++i) {
+        double d = c[i] - approx(fit, n[i]);
+        ss_res += d * d;
+        ss_tot += (c[i] - mean) * (c[i] - mean);
+    }
+    if (ss_tot == 0.0)
+        return 1.0;
+    return 1.0 - ss_res / ss_tot;
+}
+
+// Speedups are taken relative to the lowest parameter value N0, and
+// converted to capacities by multiplying by N0. Confidence intervals of
+// coefficients are obtained by bootstrapping runs of each benchmark
+// independently and refitting.
+static void analyze_scaling(const struct group_analysis *grp_al, size_t count,
+                            size_t nresamp, struct scaling_fit *fit)
+{
+    double *n = calloc(count, sizeof(*n));
+    double *c = calloc(count, sizeof(*c));
+    fit->speedup = calloc(count, sizeof(*fit->speedup));
+    fit->efficiency = calloc(count, sizeof(*fit->efficiency));
+    size_t ref_idx = 0;
+    size_t max_run_count = 0;
+    for (size_t i = 0; i < count; ++i) {
+        n[i] = grp_al->data[i].value_double;
+        if (n[i] < n[ref_idx])
+            ref_idx = i;
+        if (grp_al->data[i].distr->count > max_run_count)
+            max_run_count = grp_al->data[i].distr->count;
+    }
+    double n0 = n[ref_idx];
+    double t0 = grp_al->data[ref_idx].mean;
+    for (size_t i = 0; i < count; ++i) {
+        fit->speedup[i] = t0 / grp_al->data[i].mean;
+        c[i] = n0 * fit->speedup[i];
+        fit->efficiency[i] = c[i] / n[i];
+    }
+    fit_scaling(n, c, count, &fit->serial.point, &fit->contention.point,
+                &fit->coherency.point);
+    fit->amdahl_r2 = scaling_r2(n, c, count, fit, amdahl_approx);
+    fit->usl_r2 = scaling_r2(n, c, count, fit, usl_approx);
+    // Capacity does not grow with parameter at all, so there is no peak
+    if (fit->contention.point >= 1.0)
+        fit->usl_peak = NAN;
+    else if (fit->coherency.point == 0.0)
+        fit->usl_peak = INFINITY;
+    else
+        fit->usl_peak = sqrt((1.0 - fit->contention.point) / fit->coherency.point);
+    // Peak below the lowest parameter value means that capacity only decreases
+    if (fit->usl_peak <= n0)
+        fit->usl_peak = NAN;
+
+    double *tmp = malloc(sizeof(*tmp) * max_run_count);
+    double *means = calloc(count, sizeof(*means));
+    double *samples = malloc(sizeof(*samples) * nresamp * 3);
+    double *s_samples = samples;
+    double *a_samples = samples + nresamp;
+    double *b_samples = samples + nresamp * 2;
+    for (size_t sample = 0; sample < nresamp; ++sample) {
+        for (size_t i = 0; i < count; ++i) {
+            const struct distr *distr = grp_al->data[i].distr;
+            resample(distr->data, distr->count, tmp);
+            double sum = 0.0;
+            for (size_t j = 0; j < distr->count; ++j)
+                sum += tmp[j];
+            means[i] = sum / distr->count;
+        }
+        for (size_t i = 0; i < count; ++i)
+            c[i] = n0 * means[ref_idx] / means[i];
+        fit_scaling(n, c, count, s_samples + sample, a_samples + sample, b_samples + sample);
+    }
+    qsort(s_samples, nresamp, sizeof(*samples), compare_doubles);
+    qsort(a_samples, nresamp, sizeof(*samples), compare_doubles);
+    qsort(b_samples, nresamp, sizeof(*samples), compare_doubles);
+    fit->serial.lower = s_samples[25 * nresamp / 1000];
+    fit->serial.upper = s_samples[975 * nresamp / 1000];
+    fit->contention.lower = a_samples[25 * nresamp / 1000];
+    fit->contention.upper = a_samples[975 * nresamp / 1000];
+    fit->coherency.lower = b_samples[25 * nresamp / 1000];
+    fit->coherency.upper = b_samples[975 * nresamp / 1000];
+    free(samples);
+    free(means);
+    free(tmp);
+    free(n);
+    free(c);
+}
+
 static double t_statistic(const double *a, size_t n1, const double *b, size_t n2)
 {
     double a_mean = 0;
@@ -602,6 +761,19 @@ static void analyze_group(struct meas_analysis *al, const struct bench_group *gr
         free(x);
         free(y);
     }
+
+    // Speedup is only meaningful for time, not for memory or counts
+    if (values_are_doubles && g_scaling && units_is_time(&al->meas->units)) {
+        bool all_positive = true;
+        for (size_t i = 0; i < param->value_count; ++i) {
+            if (grp_al->data[i].value_double <= 0.0)
+                all_positive = false;
+        }
+        if (all_positive) {
+            grp_al->has_scaling = true;
+            analyze_scaling(grp_al, param->value_count, g_nresamp, &grp_al->scaling);
+        }
+    }
 }
 
 static void analyze_groups(struct meas_analysis *al)
@@ -1104,10 +1276,12 @@ static void do_group_sum_cmp(struct meas_analysis *al)
 static void analyze_bench(struct bench_analysis *analysis)
 {
     const struct bench *bench = analysis->bench;
-    size_t count = bench->run_count;
-    assert(count != 0);
+    assert(bench->run_count != 0);
     for (size_t i = 0; i < analysis->meas_count; ++i) {
-        assert(sb_len(bench->meas[i]) == count);
+        // Measurements can have fewer samples than runs when perf event groups
+        // are rotated
+        size_t count = sb_len(bench->meas[i]);
+        assert(count != 0 && count <= bench->run_count);
         estimate_distr(bench->meas[i], count, g_nresamp, analysis->meas + i);
     }
 }
@@ -1267,8 +1441,11 @@ static void free_bench_meas_analysis(struct meas_analysis *al)
     }
     free(al->val_benches_by_mean_time);
     if (al->group_analyses) {
-        for (size_t i = 0; i < base->group_count; ++i)
+        for (size_t i = 0; i < base->group_count; ++i) {
             free(al->group_analyses[i].data);
+            free(al->group_analyses[i].scaling.speedup);
+            free(al->group_analyses[i].scaling.efficiency);
+        }
         free(al->group_analyses);
     }
     free(al->bench_cmp.speedups);
@@ -1310,6 +1487,91 @@ static void free_analysis(struct analysis *al)
     }
 }
 
+static bool find_meas_mean(const struct analysis *al, size_t bench_idx,
+                           enum meas_kind kind, double *mean)
+{
+    for (size_t meas_idx = 0; meas_idx < al->meas_count; ++meas_idx) {
+        if (al->meas[meas_idx].kind == kind) {
+            *mean = al->bench_analyses[bench_idx].meas[meas_idx].mean.point;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool get_time_breakdown(const struct analysis *al, size_t bench_idx,
+                        struct time_breakdown *breakdown)
+{
+    double wall, utime, stime, run_delay;
+    if (!find_meas_mean(al, bench_idx, MEAS_WALL, &wall) ||
+        !find_meas_mean(al, bench_idx, MEAS_RUSAGE_UTIME, &utime) ||
+        !find_meas_mean(al, bench_idx, MEAS_RUSAGE_STIME, &stime) ||
+        !find_meas_mean(al, bench_idx, MEAS_SCHED_RUN_DELAY, &run_delay))
+        return false;
+    if (wall <= 0.0)
+        return false;
+    // CPU time includes children, while run delay is only known for command
+    // process, so parts can add up to more than wall clock time for
+    // multi-threaded or forking commands. Scale them down in this case.
+    double on_cpu = utime + stime;
+    double total = on_cpu + run_delay;
+    if (total < wall)
+        total = wall;
+    breakdown->on_cpu = on_cpu / total;
+    breakdown->runqueue = run_delay / total;
+    breakdown->sleeping = 1.0 - breakdown->on_cpu - breakdown->runqueue;
+    if (breakdown->sleeping < 0.0)
+        breakdown->sleeping = 0.0;
+    return true;
+}
+
+// Unbalanced one-way ANOVA estimator, where each run is a group
+bool get_iter_variance(const struct bench *bench, size_t meas_idx,
+                       struct iter_variance *variance)
+{
+    if (bench->iters == NULL || sb_len(bench->iters[meas_idx].values) == 0)
+        return false;
+    const struct iter_samples *iters = bench->iters + meas_idx;
+    const double *run_means = bench->meas[meas_idx];
+    size_t k = bench->run_count;
+    size_t n = sb_len(iters->values);
+    size_t *run_sizes = calloc(k, sizeof(*run_sizes));
+    double grand_mean = 0.0, ss_within = 0.0;
+    for (size_t i = 0; i < n; ++i) {
+        size_t run = iters->runs[i];
+        double d = iters->values[i] - run_means[run];
+        ++run_sizes[run];
+        grand_mean += iters->values[i];
+        ss_within += d * d;
+    }
+    grand_mean /= n;
+    double ss_between = 0.0, sum_sq_sizes = 0.0;
+    for (size_t i = 0; i < k; ++i) {
+        double d = run_means[i] - grand_mean;
+        ss_between += run_sizes[i] * d * d;
+        sum_sq_sizes += (double)run_sizes[i] * run_sizes[i];
+    }
+    free(run_sizes);
+    double ms_within = n > k ? ss_within / (n - k) : 0.0;
+    double var_between = 0.0;
+    if (k > 1) {
+        double ms_between = ss_between / (k - 1);
+        // Average number of samples per run, adjusted for unequal sizes
+        double n0 = (n - sum_sq_sizes / n) / (k - 1);
+        if (n0 > 0.0)
+            var_between = (ms_between - ms_within) / n0;
+        if (var_between < 0.0)
+            var_between = 0.0;
+    }
+    variance->count = n;
+    variance->run_count = k;
+    variance->within_st_dev = sqrt(ms_within);
+    variance->between_st_dev = sqrt(var_between);
+    double total = ms_within + var_between;
+    variance->icc = total > 0.0 ? var_between / total : 0.0;
+    return true;
+}
+
 bool do_analysis_and_make_report(const struct bench_data *data)
 {
     bool success = false;
@@ -52,6 +52,7 @@
 //    See the License for the specific language governing permissions and
 //    limitations under the License.
 #include "csbench.h"
+#include "csbench_probe.h"
 
 #include <assert.h>
 #include <ctype.h>
@@ -70,20 +71,63 @@
     }
 
 const struct meas BUILTIN_MEASUREMENTS[] = {
-    /* MEAS_CUSTOM */ {"", NULL, NULL, {0}, 0, false, 0},
-    /* MEAS_CUSTOM_RE */ {"", NULL, NULL, {0}, 0, false, 0},
-    {"wall clock time", NULL, NULL, {MU_S, ""}, MEAS_WALL, false, 0},
-    {"usrtime", NULL, NULL, {MU_S, ""}, MEAS_RUSAGE_UTIME, true, 0},
-    {"systime", NULL, NULL, {MU_S, ""}, MEAS_RUSAGE_STIME, true, 0},
-    {"maxrss", NULL, NULL, {MU_B, ""}, MEAS_RUSAGE_MAXRSS, true, 0},
-    {"minflt", NULL, NULL, {MU_NONE, ""}, MEAS_RUSAGE_MINFLT, true, 0},
-    {"majflt", NULL, NULL, {MU_NONE, ""}, MEAS_RUSAGE_MAJFLT, true, 0},
-    {"nvcsw", NULL, NULL, {MU_NONE, ""}, MEAS_RUSAGE_NVCSW, true, 0},
-    {"nivcsw", NULL, NULL, {MU_NONE, ""}, MEAS_RUSAGE_NIVCSW, true, 0},
-    {"cycles", NULL, NULL, {MU_NONE, ""}, MEAS_PERF_CYCLES, true, 0},
-    {"ins", NULL, NULL, {MU_NONE, ""}, MEAS_PERF_INS, true, 0},
-    {"b", NULL, NULL, {MU_NONE, ""}, MEAS_PERF_BRANCH, true, 0},
-    {"bm", NULL, NULL, {MU_NONE, ""}, MEAS_PERF_BRANCHM, true, 0},
+    /* MEAS_CUSTOM */ {"", NULL, NULL, {0}, 0, false, 0, 0},
+    /* MEAS_CUSTOM_RE */ {"", NULL, NULL, {0}, 0, false, 0, 0},
+    {"wall clock time", NULL, NULL, {MU_S, ""}, MEAS_WALL, false, 0, 0},
+    {"usrtime", NULL, NULL, {MU_S, ""}, MEAS_RUSAGE_UTIME, true, 0, 0},
+    {"systime", NULL, NULL, {MU_S, ""}, MEAS_RUSAGE_STIME, true, 0, 0},
+    {"maxrss", NULL, NULL, {MU_B, ""}, MEAS_RUSAGE_MAXRSS, true, 0, 0},
+    {"minflt", NULL, NULL, {MU_NONE, ""}, MEAS_RUSAGE_MINFLT, true, 0, 0},
+    {"majflt", NULL, NULL, {MU_NONE, ""}, MEAS_RUSAGE_MAJFLT, true, 0, 0},
+    {"nvcsw", NULL, NULL, {MU_NONE, ""}, MEAS_RUSAGE_NVCSW, true, 0, 0},
+    {"nivcsw", NULL, NULL, {MU_NONE, ""}, MEAS_RUSAGE_NIVCSW, true, 0, 0},
+    {"cycles", NULL, NULL, {MU_NONE, ""}, MEAS_PERF_CYCLES, true, 0, 0},
+    {"ins", NULL, NULL, {MU_NONE, ""}, MEAS_PERF_INS, true, 0, 0},
+    {"b", NULL, NULL, {MU_NONE, ""}, MEAS_PERF_BRANCH, true, 0, 0},
+    {"bm", NULL, NULL, {MU_NONE, ""}, MEAS_PERF_BRANCHM, true, 0, 0},
+    {"throughput", NULL, NULL, {MU_CUSTOM, "B/s"}, MEAS_PIPE_BYTES_RATE, true, 0, 0},
+    {"record throughput", NULL, NULL, {MU_CUSTOM, "rec/s"}, MEAS_PIPE_RECORDS_RATE, true, 0,
+     0},
+    {"page cache residency", NULL, NULL, {MU_CUSTOM, "%"}, MEAS_CACHE_RESIDENCY, true, 0,
+     0},
+    /* MEAS_PERF_EVENT */ {"", NULL, NULL, {0}, 0, false, 0, 0},
+    /* MEAS_TMA */ {"", NULL, NULL, {MU_CUSTOM, "%"}, MEAS_TMA, false, 0, 0},
+    {"cputime", NULL, NULL, {MU_S, ""}, MEAS_RUSAGE_CPUTIME, true, 0, 0},
+    {"faults", NULL, NULL, {MU_NONE, ""}, MEAS_RUSAGE_FLT, true, 0, 0},
+    {"csw", NULL, NULL, {MU_NONE, ""}, MEAS_RUSAGE_CSW, true, 0, 0},
+    /* MEAS_EXPR */ {"", NULL, NULL, {MU_NONE, ""}, MEAS_EXPR, false, 0, 0},
+    {"energy-pkg", NULL, NULL, {MU_J, ""}, MEAS_ENERGY_PKG, true, 0, 0},
+    {"energy-dram", NULL, NULL, {MU_J, ""}, MEAS_ENERGY_DRAM, true, 0, 0},
+    {"avg-power", NULL, NULL, {MU_W, ""}, MEAS_AVG_POWER, true, 0, 0},
+    {"rchar", NULL, NULL, {MU_B, ""}, MEAS_IO_RCHAR, true, 0, 0},
+    {"wchar", NULL, NULL, {MU_B, ""}, MEAS_IO_WCHAR, true, 0, 0},
+    {"syscr", NULL, NULL, {MU_NONE, ""}, MEAS_IO_SYSCR, true, 0, 0},
+    {"syscw", NULL, NULL, {MU_NONE, ""}, MEAS_IO_SYSCW, true, 0, 0},
+    {"read_bytes", NULL, NULL, {MU_B, ""}, MEAS_IO_READ_BYTES, true, 0, 0},
+    {"write_bytes", NULL, NULL, {MU_B, ""}, MEAS_IO_WRITE_BYTES, true, 0, 0},
+    {"mean rss", NULL, NULL, {MU_B, ""}, MEAS_RSS_MEAN, false, 0, 0},
+    {"rss-seconds", NULL, NULL, {MU_CUSTOM, "MB·s"}, MEAS_RSS_SECONDS, true, 0, 0},
+    {"run-delay", NULL, NULL, {MU_S, ""}, MEAS_SCHED_RUN_DELAY, true, 0, 0},
+    {"timeslices", NULL, NULL, {MU_NONE, ""}, MEAS_SCHED_TIMESLICES, true, 0, 0},
+    {"offcpu-io", NULL, NULL, {MU_S, ""}, MEAS_OFF_CPU_IO, true, 0, 0},
+    {"offcpu-futex", NULL, NULL, {MU_S, ""}, MEAS_OFF_CPU_FUTEX, true, 0, 0},
+    {"offcpu-sleep", NULL, NULL, {MU_S, ""}, MEAS_OFF_CPU_SLEEP, true, 0, 0},
+    {"offcpu-preempt", NULL, NULL, {MU_S, ""}, MEAS_OFF_CPU_PREEMPT, true, 0, 0},
+    {"offcpu-other", NULL, NULL, {MU_S, ""}, MEAS_OFF_CPU_OTHER, true, 0, 0},
+    {"allocs", NULL, NULL, {MU_NONE, ""}, MEAS_ALLOCS, false, 0, 0},
+    {"alloc-bytes", NULL, NULL, {MU_B, ""}, MEAS_ALLOC_BYTES, false, 0, 0},
+    {"peak-heap", NULL, NULL, {MU_B, ""}, MEAS_PEAK_HEAP, false, 0, 0},
+    /* MEAS_PROBE */ {"", NULL, NULL, {0}, 0, false, 0, 0},
+    /* MEAS_CUSTOM_RE_ITER */ {"", NULL, NULL, {0}, 0, false, 0, 0},
+    {"ttfb", NULL, NULL, {MU_S, ""}, MEAS_TTFB, false, 0, 0},
+    {"time-to-ready", NULL, NULL, {MU_S, ""}, MEAS_TIME_TO_READY, false, 0, 0},
+    {"latency", NULL, NULL, {MU_S, ""}, MEAS_REQ_LATENCY, false, 0, 0},
+    {"ld-startup", NULL, NULL, {MU_CUSTOM, "cycles"}, MEAS_LD_STARTUP, false, 0, 0},
+    {"ld-reloc-time", NULL, NULL, {MU_CUSTOM, "cycles"}, MEAS_LD_RELOC_TIME, false, 0, 0},
+    {"ld-load-time", NULL, NULL, {MU_CUSTOM, "cycles"}, MEAS_LD_LOAD_TIME, false, 0, 0},
+    {"ld-relocs", NULL, NULL, {MU_NONE, ""}, MEAS_LD_RELOCS, false, 0, 0},
+    {"ld-relative-relocs", NULL, NULL, {MU_NONE, ""}, MEAS_LD_RELATIVE_RELOCS, false, 0,
+     0},
 };
 
 static void print_tabulated(const char *s)
@@ -198,6 +242,19 @@ static void print_help_and_exit(int rc)
     print_opt("-P, --prepare", OPT_ARR("CMD"), "Execute <CMD> before each benchmark run.");
     print_opt("--round-prepare", OPT_ARR("CMD"),
               "Execute <CMD> in the beginning of each round, before the warmup.");
+    print_opt("--setup", OPT_ARR("CMD"),
+              "Execute <CMD> once before the first run of each benchmark.");
+    print_opt("--teardown", OPT_ARR("CMD"),
+              "Execute <CMD> once after the last run of each benchmark.");
+    print_opt("--service", OPT_ARR("CMD"),
+              "Launch <CMD> in background before the first run of each benchmark and keep "
+              "it running until the last run has finished. Resource usage of the service "
+              "is reported separately.");
+    print_opt("--service-ready", OPT_ARR("CMD"),
+              "Repeatedly execute <CMD> after launching service until it succeeds, "
+              "signalling that the service is ready.");
+    print_opt("--service-timeout", OPT_ARR("DURATION"),
+              "Wait at most <DURATION> for service to become ready (default: 10s).");
     print_opt("-j, --jobs", OPT_ARR("NUM"),
               "Execute benchmarks in parallel using <NUM> system threads (default: 1).");
     print_opt("-i, --ignore-failure", OPT_ARR(NULL),
@@ -219,13 +276,104 @@ static void print_help_and_exit(int rc)
     print_opt("--output", OPT_ARR("KIND"),
               "Control where stdout and stderr of benchmark commands is redirected. <KIND> "
               "can be \"null\", or \"inherit\".");
+    print_opt("--pipe-io", OPT_ARR(NULL),
+              "Feed input to stdin through a pipe from memory and drain stdout through a "
+              "pipe instead of using files. Adds throughput measurements in bytes and "
+              "newline-separated records of input per second. Requires input to be set.");
+    print_opt("--drain-rate", OPT_ARR("RATE"),
+              "Limit rate at which stdout is drained in --pipe-io mode to <RATE> bytes per "
+              "second. By default output is drained as fast as possible.");
+    print_opt("--ready-re", OPT_ARR("RE"),
+              "Consider command ready when regular expression <RE> matches a line of its "
+              "stdout or stderr, and terminate it. Adds \"time-to-ready\" measurement.");
+    print_opt("--ready-connect", OPT_ARR("ADDR"),
+              "Consider command ready when it accepts connections on <ADDR>, which is "
+              "either local TCP port, <HOST>:<PORT> pair, or path to Unix socket, and "
+              "terminate it. Adds \"time-to-ready\" measurement.");
+    print_opt("--ready-timeout", OPT_ARR("DURATION"),
+              "Wait at most <DURATION> for command to become ready (default: 10s).");
+    print_opt("--requests", OPT_ARR("FILE"),
+              "Launch each command once and send lines of <FILE> to its stdin as "
+              "requests, expecting one line of stdout in response to each. Latency of "
+              "requests is measured instead of running command for each sample.");
+    print_opt("--pipeline", OPT_ARR("N"),
+              "Keep up to <N> requests in flight in --requests mode (default: 1, send "
+              "next request only after response to previous one).");
+    print_opt("--request-timeout", OPT_ARR("DURATION"),
+              "Wait at most <DURATION> for response in --requests mode (default: 10s).");
+    print_opt("--cache", OPT_ARR("STATE"),
+              "Establish cache state before each run. <STATE> can be \"cold\", which "
+              "evicts cache files from page cache and flushes CPU caches, \"warm\", which "
+              "reads cache files into page cache, or \"both\", which runs cold and warm "
+              "variant of each command. Cache files are input file and files set with "
+              "--cache-file.");
+    print_opt("--cache-file", OPT_ARR("FILE"),
+              "Add file which cache state is controlled with --cache. Page cache residency "
+              "of cache files is reported as a measurement. Can be specified multiple "
+              "times.");
+    print_opt("--flush-llc", OPT_ARR(NULL),
+              "Flush CPU caches before each run by touching a buffer larger than last level "
+              "cache.");
     printf_colored(ANSI_BOLD, "\nMeasurement options:\n");
     print_opt(
         "--meas", OPT_ARR("MEAS"),
         "Specify list of built-in measurement to collect. <MEAS> is a comma-separated "
         "list of measurement names, which can be of the following: \"wall\", \"stime\", "
         "\"utime\", \"maxrss\", \"minflt\", \"majflt\", \"nvcsw\", \"nivcsw\", \"cycles\", "
-        "\"branches\", \"branch-misses\".");
+        "\"branches\", \"branch-misses\", \"energy-pkg\", \"energy-dram\", \"avg-power\", "
+        "\"rchar\", \"wchar\", \"syscr\", \"syscw\", \"read_bytes\", \"write_bytes\", "
+        "\"run-delay\", \"timeslices\", \"offcpu-io\", \"offcpu-futex\", "
+        "\"offcpu-sleep\", \"offcpu-preempt\", \"offcpu-other\", \"allocs\", "
+        "\"alloc-bytes\", \"peak-heap\", \"ttfb\", \"time-to-ready\", \"ld-startup\", "
+        "\"ld-reloc-time\", \"ld-load-time\", \"ld-relocs\", \"ld-relative-relocs\". "
+        "Other names are treated as performance counter events: generic events like "
+        "\"cache-misses\", \"LLC-load-misses\" or "
+        "\"dTLB-load-misses\", software events like \"task-clock\", \"context-switches\" "
+        "or \"page-faults\", raw events like \"r01c2\", or <type>:<config> pairs. "
+        "Events can be followed by \":u\" or \":k\" to count only user or kernel mode.");
+    print_opt("--rss-timeline", OPT_ARR("T"),
+              "Sample resident set size of command process tree every <T> during each "
+              "run. Adds measurements of time-weighted mean RSS and RSS-seconds, and "
+              "memory timeline plot of median run of each benchmark.");
+    print_opt("--alloc-shim", OPT_ARR("PATH"),
+              "Path to libcsbench_alloc.so, which is preloaded into commands to collect "
+              "\"allocs\", \"alloc-bytes\" and \"peak-heap\" measurements. By default it "
+              "is searched next to csbench executable and in ../lib relative to it.");
+    print_opt("--powercap-root", OPT_ARR("DIR"),
+              "Directory to look for RAPL energy counters in when measuring energy. "
+              "Default is /sys/class/powercap.");
+    print_opt("--perf-rotate", OPT_ARR(NULL),
+              "Split performance counter events into groups of --perf-slots events and "
+              "count one group per run, rotating groups between runs. Each group is "
+              "counted without multiplexing, at the cost of fewer samples per event.");
+    print_opt("--perf-slots", OPT_ARR("N"),
+              "Number of hardware counters available for --perf-rotate groups. Default "
+              "is 4.");
+    print_opt("--perf-split", OPT_ARR(NULL),
+              "Count each performance counter event separately in user and kernel mode, "
+              "as if it was specified with \":u\" and \":k\" modifiers.");
+    print_opt("--perf-roi", OPT_ARR(NULL),
+              "Count performance counter events only inside region of interest, which "
+              "command marks with csbench_probe_roi_begin and csbench_probe_roi_end "
+              "functions from csbench_probe.h header. Linux only.");
+    print_opt("--tma", OPT_ARR(NULL),
+              "Collect top-down microarchitecture analysis metrics: percentage of "
+              "pipeline slots that are frontend bound, bad speculation, backend bound and "
+              "retiring, and their level 2 breakdown where supported by CPU. Each metric "
+              "is a separate measurement. Ignored with a warning if CPU does not "
+              "support required events.");
+    print_opt("--profile", OPT_ARR(NULL),
+              "Sample call stacks of each benchmark in additional --profile-runs runs, "
+              "which are not measured. Folded stacks and flame graphs are saved in output "
+              "directory, as well as differential flame graphs against baseline. Full "
+              "call stacks require commands built with frame pointers.");
+    print_opt("--profile-runs", OPT_ARR("N"),
+              "Number of runs of each benchmark to profile with --profile. Default is 3.");
+    print_opt("--off-cpu", OPT_ARR(NULL),
+              "Trace scheduler switches of command process tree and report time spent off "
+              "CPU waiting for I/O, on futexes, sleeping, preempted and for other reasons "
+              "as measurements. Kernel stacks at which command blocks are saved in output "
+              "directory as folded stacks and flame graphs. Requires root privileges.");
     print_opt("--custom", OPT_ARR("NAME"),
               "Add custom measurement with name <NAME>. This measurement parses stdout of "
               "each command as a single real number and interprets it in seconds.");
@@ -238,11 +386,27 @@ static void print_help_and_exit(int rc)
         "--custom-x", OPT_ARR("NAME", "UNITS", "CMD"),
         "Add custom measurement with name <NAME>, This measurement pipes stdout of each "
         "command to <CMD>, parses its output as a single real number and interprets it "
-        "in <UNITS>. <UNITS> can be one of ns, us, ms, s, b, kb, mb, gb, none.");
+        "in <UNITS>. <UNITS> can be one of ns, us, ms, s, b, kb, mb, gb, j, w, none.");
     print_opt("--custom-re", OPT_ARR("NAME", "UNITS", "RE"),
               "Add custom measurement with name <NAME>, This measurement uses regular "
               "expression <RE> to extract data from stdout of each command, parses first "
               "subexpression as a single real number and interprets it in <UNITS>.");
+    print_opt("--custom-re-iter", OPT_ARR("NAME", "UNITS", "RE"),
+              "Same as --custom-re, but every line of stdout matching <RE> is a separate "
+              "sample, for commands that print one value per internal iteration. Value "
+              "of run is the mean of its samples, and variance is split into variance "
+              "within runs and between runs.");
+    print_opt("--probe", OPT_ARR("NAME"),
+              "Add measurement with name <NAME>, whose value is reported by command itself "
+              "using csbench_probe.h header, and interpret it in seconds.");
+    print_opt("--probe-x", OPT_ARR("NAME", "UNITS"),
+              "Add measurement with name <NAME>, whose value is reported by command itself "
+              "using csbench_probe.h header, and interpret it in <UNITS>.");
+    print_opt("--meas-expr", OPT_ARR("NAME=EXPR"),
+              "Add measurement with name <NAME> computed from other measurements of each "
+              "run. <EXPR> is an arithmetic expression with +, -, *, /, parentheses, "
+              "numbers and measurement names, for example 'ipc=instructions/cycles'. "
+              "Names can contain '-', so subtraction should be surrounded by spaces.");
     print_opt("--no-default-meas", OPT_ARR(NULL), "Do not use default measurements.");
     printf_colored(ANSI_BOLD, "\nParameterization options:\n");
     print_opt(
@@ -272,6 +436,9 @@ static void print_help_and_exit(int rc)
         "<TEST> are \"mwu\" and \"t-test\". Default is \"mwu\".");
     print_opt("--regr", OPT_ARR(NULL),
               "Perform linear regression of measurements in terms of benchmark parameters.");
+    print_opt("--scaling", OPT_ARR(NULL),
+              "Treat benchmark parameter as thread count and report speedup, efficiency "
+              "and fits of Amdahl's law and Universal Scalability Law.");
     printf_colored(ANSI_BOLD, "\nOutput options:\n");
     print_opt(
         "--baseline", OPT_ARR("NUM"),
@@ -412,21 +579,110 @@ static bool parse_comma_separated_settings(const char *str, const char **namep,
     return true;
 }
 
-static void parse_meas_list(const char *opts, enum meas_kind **meas_list)
+static void add_perf_event_meas(const char *name, struct meas **perf_meas_list)
+{
+    struct perf_event_spec spec;
+    if (!parse_perf_event_str(name, &spec)) {
+        error("invalid measurement name: '%s'", name);
+        exit(EXIT_FAILURE);
+    }
+    // Some software events can be measured with rusage when performance
+    // counters are not permitted, which is common in containers
+    enum meas_kind fallback;
+    if (perf_event_fallback(&spec, &fallback) && !perf_events_available()) {
+        warning("performance counters are not available, '%s' is measured using rusage",
+                spec.name);
+        struct meas meas = BUILTIN_MEASUREMENTS[fallback];
+        meas.name = spec.name;
+        sb_push(*perf_meas_list, meas);
+        return;
+    }
+    if (sb_len(g_perf_events) == MAX_PERF_EVENTS) {
+        error("too many performance counter events (maximum is %d)", MAX_PERF_EVENTS);
+        exit(EXIT_FAILURE);
+    }
+    struct meas meas = BUILTIN_MEASUREMENTS[MEAS_PERF_EVENT];
+    meas.name = spec.name;
+    meas.units.kind = spec.is_time ? MU_NS : MU_NONE;
+    meas.kind = MEAS_PERF_EVENT;
+    meas.is_secondary = true;
+    meas.event_idx = sb_len(g_perf_events);
+    sb_push(g_perf_events, spec);
+    sb_push(*perf_meas_list, meas);
+    g_use_perf = true;
+}
+
+static const char *builtin_perf_event_name(enum meas_kind kind)
+{
+    switch (kind) {
+    case MEAS_PERF_CYCLES:
+        return "cycles";
+    case MEAS_PERF_INS:
+        return "instructions";
+    case MEAS_PERF_BRANCH:
+        return "branches";
+    case MEAS_PERF_BRANCHM:
+        return "branch-misses";
+    default:
+        break;
+    }
+    return NULL;
+}
+
+static size_t builtin_perf_cnt_idx(enum meas_kind kind)
+{
+    switch (kind) {
+    case MEAS_PERF_CYCLES:
+        return PERF_CNT_CYCLES;
+    case MEAS_PERF_INS:
+        return PERF_CNT_INSTRUCTIONS;
+    case MEAS_PERF_BRANCH:
+        return PERF_CNT_BRANCHES;
+    case MEAS_PERF_BRANCHM:
+        return PERF_CNT_BRANCH_MISSES;
+    default:
+        break;
+    }
+    ASSERT_UNREACHABLE();
+}
+
+static bool has_perf_modifiers(const char *event)
+{
+    const char *colon = strrchr(event, ':');
+    return colon != NULL && colon[1] != '\0' && strspn(colon + 1, "uk") == strlen(colon + 1);
+}
+
+// Names that are not builtin measurements are treated as performance counter
+// events, each of which becomes separate measurement. With --perf-split each
+// performance counter event without modifiers is counted separately in user
+// and kernel mode.
+static void parse_meas_list(const char *opts, enum meas_kind **meas_list,
+                            struct meas **perf_meas_list)
 {
     const char **list = parse_comma_separated_list(opts);
     for (size_t i = 0; i < sb_len(list); ++i) {
         const char *opt = list[i];
         enum meas_kind kind;
-        if (!parse_meas_str(opt, &kind)) {
-            error("invalid measurement name: '%s'", opt);
-            exit(EXIT_FAILURE);
+        const char *event = opt;
+        if (parse_meas_str(opt, &kind)) {
+            event = builtin_perf_event_name(kind);
+            if (event == NULL) {
+                sb_push(*meas_list, kind);
+                continue;
+            }
+            if (!g_perf_split) {
+                g_use_perf = true;
+                g_perf_builtin_used[builtin_perf_cnt_idx(kind)] = true;
+                sb_push(*meas_list, kind);
+                continue;
+            }
         }
-        if (kind == MEAS_PERF_CYCLES || kind == MEAS_PERF_INS || kind == MEAS_PERF_BRANCH ||
-            kind == MEAS_PERF_BRANCHM) {
-            g_use_perf = true;
+        if (g_perf_split && !has_perf_modifiers(event)) {
+            add_perf_event_meas(csfmt("%s:u", event), perf_meas_list);
+            add_perf_event_meas(csfmt("%s:k", event), perf_meas_list);
+        } else {
+            add_perf_event_meas(event, perf_meas_list);
         }
-        sb_push(*meas_list, kind);
     }
     sb_free(list);
 }
@@ -609,6 +865,17 @@ static bool opt_int_pos(char **argv, int *cursorp, const char **opt_strs, const
     return true;
 }
 
+// Probe records store name in fixed-size buffer, so longer names could never
+// be matched
+static void check_probe_name(const char *name)
+{
+    if (strlen(name) >= CSBENCH_PROBE_NAME_LEN) {
+        error("probe name '%s' is too long, maximum length is %d", name,
+              CSBENCH_PROBE_NAME_LEN - 1);
+        exit(EXIT_FAILURE);
+    }
+}
+
 static bool opt_bool(char **argv, int *cursorp, const char *opt_str, bool *valuep)
 {
     if (strcmp(argv[*cursorp], opt_str) == 0) {
@@ -624,6 +891,12 @@ void parse_cli_args(int argc, char **argv, struct settings *settings)
     bool no_wall = false;
     struct meas *meas_list = NULL;
     enum meas_kind *rusage_opts = NULL;
+    struct meas *perf_meas_list = NULL;
+    // Parsed after all options, because parsing depends on --perf-split
+    const char **meas_strs = NULL;
+    const char **meas_expr_strs = NULL;
+    bool tma = false;
+    bool off_cpu = false;
 
     if (argc == 1)
         print_help_and_exit(EXIT_SUCCESS);
@@ -667,6 +940,12 @@ void parse_cli_args(int argc, char **argv, struct settings *settings)
                                "maximum round run count", &g_round_stop.max_runs)) {
         } else if (opt_arg(argv, &cursor, "--prepare", &settings->prepare)) {
         } else if (opt_arg(argv, &cursor, "--round-prepare", &settings->round_prepare)) {
+        } else if (opt_arg(argv, &cursor, "--setup", &settings->setup)) {
+        } else if (opt_arg(argv, &cursor, "--teardown", &settings->teardown)) {
+        } else if (opt_arg(argv, &cursor, "--service", &settings->service)) {
+        } else if (opt_arg(argv, &cursor, "--service-ready", &settings->service_ready)) {
+        } else if (opt_time(argv, &cursor, OPT_ARR("--service-timeout"), MU_S,
+                            "service timeout", &g_service_timeout)) {
         } else if (opt_arg(argv, &cursor, "--common-args", &g_common_argstring)) {
         } else if (opt_int_pos(argv, &cursor, OPT_ARR("--nrs"), "resamples count",
                                &g_nresamp)) {
@@ -702,6 +981,42 @@ void parse_cli_args(int argc, char **argv, struct settings *settings)
                 error("invalid --stat-test option");
                 exit(EXIT_FAILURE);
             }
+        } else if (opt_bool(argv, &cursor, "--pipe-io", &g_pipe_io)) {
+        } else if (opt_arg(argv, &cursor, "--drain-rate", &str)) {
+            char *str_end;
+            double value = strtod(str, &str_end);
+            if (str_end == str || *str_end != '\0') {
+                error("invalid --drain-rate argument");
+                exit(EXIT_FAILURE);
+            }
+            if (value <= 0.0) {
+                error("drain rate must be positive number");
+                exit(EXIT_FAILURE);
+            }
+            g_drain_rate = value;
+        } else if (opt_arg(argv, &cursor, "--ready-re", &g_ready_re)) {
+        } else if (opt_arg(argv, &cursor, "--ready-connect", &g_ready_connect)) {
+        } else if (opt_time(argv, &cursor, OPT_ARR("--ready-timeout"), MU_S,
+                            "ready timeout", &g_ready_timeout)) {
+        } else if (opt_arg(argv, &cursor, "--requests", &g_requests)) {
+        } else if (opt_int_pos(argv, &cursor, OPT_ARR("--pipeline"), "pipeline depth",
+                               &g_pipeline_depth)) {
+        } else if (opt_time(argv, &cursor, OPT_ARR("--request-timeout"), MU_S,
+                            "request timeout", &g_request_timeout)) {
+        } else if (opt_arg(argv, &cursor, "--cache", &str)) {
+            if (strcmp(str, "cold") == 0) {
+                settings->cache_state = CACHE_STATE_COLD;
+            } else if (strcmp(str, "warm") == 0) {
+                settings->cache_state = CACHE_STATE_WARM;
+            } else if (strcmp(str, "both") == 0) {
+                settings->cache_state = CACHE_STATE_BOTH;
+            } else {
+                error("invalid --cache option");
+                exit(EXIT_FAILURE);
+            }
+        } else if (opt_arg(argv, &cursor, "--cache-file", &str)) {
+            sb_push(settings->cache_files, str);
+        } else if (opt_bool(argv, &cursor, "--flush-llc", &g_flush_llc)) {
         } else if (strcmp(argv[cursor], "--no-input") == 0) {
             ++cursor;
             g_inputd = NULL;
@@ -766,10 +1081,11 @@ void parse_cli_args(int argc, char **argv, struct settings *settings)
             meas.kind = MEAS_CUSTOM;
             parse_units_str(units, &meas.units);
             sb_push(meas_list, meas);
-        } else if (strcmp(argv[cursor], "--custom-re") == 0) {
-            ++cursor;
+        } else if (strcmp(argv[cursor], "--custom-re") == 0 ||
+                   strcmp(argv[cursor], "--custom-re-iter") == 0) {
+            const char *opt = argv[cursor++];
             if (cursor + 2 >= argc) {
-                error("--custom-re requires 3 arguments: <NAME> <UNITS> <RE>");
+                error("%s requires 3 arguments: <NAME> <UNITS> <RE>", opt);
                 exit(EXIT_FAILURE);
             }
             const char *name = argv[cursor++];
@@ -780,6 +1096,30 @@ void parse_cli_args(int argc, char **argv, struct settings *settings)
             meas.name = name;
             meas.re = re;
             meas.kind = MEAS_CUSTOM_RE;
+            if (strcmp(opt, "--custom-re-iter") == 0)
+                meas.kind = MEAS_CUSTOM_RE_ITER;
+            parse_units_str(units, &meas.units);
+            sb_push(meas_list, meas);
+        } else if (opt_arg(argv, &cursor, "--probe", &str)) {
+            check_probe_name(str);
+            struct meas meas;
+            memset(&meas, 0, sizeof(meas));
+            meas.name = str;
+            meas.kind = MEAS_PROBE;
+            sb_push(meas_list, meas);
+        } else if (strcmp(argv[cursor], "--probe-x") == 0) {
+            ++cursor;
+            if (cursor + 1 >= argc) {
+                error("--probe-x requires 2 arguments: <NAME> <UNITS>");
+                exit(EXIT_FAILURE);
+            }
+            const char *name = argv[cursor++];
+            const char *units = argv[cursor++];
+            check_probe_name(name);
+            struct meas meas;
+            memset(&meas, 0, sizeof(meas));
+            meas.name = name;
+            meas.kind = MEAS_PROBE;
             parse_units_str(units, &meas.units);
             sb_push(meas_list, meas);
         } else if (strcmp(argv[cursor], "--rename") == 0) {
@@ -887,13 +1227,15 @@ void parse_cli_args(int argc, char **argv, struct settings *settings)
                                MAKE_PLOT_KDE_CMP_SMALL | MAKE_PLOT_BAR |
                                MAKE_PLOT_GROUP_REGR | MAKE_PLOT_ALL_GROUPS_REGR |
                                MAKE_PLOT_KDE_CMP_ALL_GROUPS | MAKE_PLOT_KDE_CMP_PER_VAL |
-                               MAKE_PLOT_KDE_CMP_PER_VAL_SMALL;
+                               MAKE_PLOT_KDE_CMP_PER_VAL_SMALL | MAKE_PLOT_GROUP_SCALING |
+                               MAKE_PLOT_RSS_TIMELINE;
         } else if (opt_bool(argv, &cursor, "--clear-out", &g_clear_out_dir)) {
         } else if (opt_bool(argv, &cursor, "--save-bin", &g_save_bin)) {
         } else if (opt_bool(argv, &cursor, "--plot", &g_plot)) {
             g_desired_plots |= MAKE_PLOT_KDE | MAKE_PLOT_KDE_CMP | MAKE_PLOT_BAR |
                                MAKE_PLOT_GROUP_REGR | MAKE_PLOT_ALL_GROUPS_REGR |
-                               MAKE_PLOT_KDE_CMP_ALL_GROUPS | MAKE_PLOT_KDE_CMP_PER_VAL;
+                               MAKE_PLOT_KDE_CMP_ALL_GROUPS | MAKE_PLOT_KDE_CMP_PER_VAL |
+                               MAKE_PLOT_GROUP_SCALING | MAKE_PLOT_RSS_TIMELINE;
         } else if (opt_bool(argv, &cursor, "--plot-src", &g_plot_src)) {
         } else if (opt_bool(argv, &cursor, "--no-default-meas", &no_wall)) {
         } else if (opt_bool(argv, &cursor, "--ignore-failure", &g_ignore_failure) ||
@@ -901,6 +1243,17 @@ void parse_cli_args(int argc, char **argv, struct settings *settings)
         } else if (opt_bool(argv, &cursor, "--csv", &g_csv)) {
         } else if (opt_bool(argv, &cursor, "--shuffle-runs", &g_shuffle_when_running)) {
         } else if (opt_bool(argv, &cursor, "--regr", &g_regr)) {
+        } else if (opt_bool(argv, &cursor, "--scaling", &g_scaling)) {
+        } else if (opt_bool(argv, &cursor, "--perf-rotate", &g_perf_rotate)) {
+        } else if (opt_bool(argv, &cursor, "--perf-split", &g_perf_split)) {
+        } else if (opt_bool(argv, &cursor, "--perf-roi", &g_perf_roi)) {
+        } else if (opt_bool(argv, &cursor, "--tma", &tma)) {
+        } else if (opt_int_pos(argv, &cursor, OPT_ARR("--perf-slots"), "perf slot count",
+                               &g_perf_slots)) {
+        } else if (opt_bool(argv, &cursor, "--off-cpu", &off_cpu)) {
+        } else if (opt_bool(argv, &cursor, "--profile", &g_profile)) {
+        } else if (opt_int_pos(argv, &cursor, OPT_ARR("--profile-runs"),
+                               "profile run count", &g_profile_runs)) {
         } else if (opt_bool(argv, &cursor, "--plot-debug", &g_plot_debug)) {
         } else if (strcmp(argv[cursor], "--no-warmup") == 0) {
             ++cursor;
@@ -925,7 +1278,17 @@ void parse_cli_args(int argc, char **argv, struct settings *settings)
             g_warmup_stop.time_limit = 0.0;
             g_bench_stop.time_limit = 1.0;
         } else if (opt_arg(argv, &cursor, "--meas", &str)) {
-            parse_meas_list(str, &rusage_opts);
+            sb_push(meas_strs, str);
+        } else if (opt_time(argv, &cursor, OPT_ARR("--rss-timeline"), MU_S,
+                            "RSS sampling interval", &g_rss_interval)) {
+            if (g_rss_interval == 0.0) {
+                error("RSS sampling interval must be positive");
+                exit(EXIT_FAILURE);
+            }
+        } else if (opt_arg(argv, &cursor, "--powercap-root", &g_powercap_root)) {
+        } else if (opt_arg(argv, &cursor, "--alloc-shim", &g_alloc_shim)) {
+        } else if (opt_arg(argv, &cursor, "--meas-expr", &str)) {
+            sb_push(meas_expr_strs, str);
         } else if (opt_int_pos(argv, &cursor, OPT_ARR("--baseline"), "baseline number",
                                &g_baseline)) {
             g_baseline_name = NULL;
@@ -985,6 +1348,58 @@ void parse_cli_args(int argc, char **argv, struct settings *settings)
         }
     }
 
+    for (size_t i = 0; i < sb_len(meas_strs); ++i)
+        parse_meas_list(meas_strs[i], &rusage_opts, &perf_meas_list);
+    sb_free(meas_strs);
+    if (off_cpu) {
+        for (int kind = MEAS_OFF_CPU_IO; kind <= MEAS_OFF_CPU_OTHER; ++kind) {
+            bool already_has = false;
+            for (size_t i = 0; i < sb_len(rusage_opts); ++i) {
+                if ((int)rusage_opts[i] == kind)
+                    already_has = true;
+            }
+            if (!already_has)
+                sb_push(rusage_opts, (enum meas_kind)kind);
+        }
+    }
+    bool has_ttfb = false, has_ready_meas = false;
+    for (size_t i = 0; i < sb_len(rusage_opts); ++i) {
+        if (rusage_opts[i] == MEAS_TTFB)
+            has_ttfb = true;
+        else if (rusage_opts[i] == MEAS_TIME_TO_READY)
+            has_ready_meas = true;
+    }
+    if (g_ready_re && g_ready_connect) {
+        error("--ready-re and --ready-connect can not be used together");
+        exit(EXIT_FAILURE);
+    }
+    if ((has_ttfb || g_ready_re || g_ready_connect) &&
+        (g_pipe_io || settings->output == OUTPUT_POLICY_INHERIT)) {
+        error("startup latency measurements can not be used with --pipe-io or inherited "
+              "output");
+        exit(EXIT_FAILURE);
+    }
+    if (g_ready_re || g_ready_connect) {
+        if (!has_ready_meas)
+            sb_push(rusage_opts, MEAS_TIME_TO_READY);
+    } else if (has_ready_meas) {
+        error("\"time-to-ready\" measurement requires --ready-re or --ready-connect");
+        exit(EXIT_FAILURE);
+    }
+    if (g_requests) {
+        if (sb_len(rusage_opts) != 0 || sb_len(perf_meas_list) != 0 ||
+            sb_len(meas_list) != 0 || tma || off_cpu || g_rss_interval != 0.0) {
+            error("--requests can not be used with other measurements");
+            exit(EXIT_FAILURE);
+        }
+        if (g_pipe_io || settings->input.kind != INPUT_POLICY_NULL || g_profile) {
+            error("--requests can not be used with input, --pipe-io or --profile");
+            exit(EXIT_FAILURE);
+        }
+        // Command is launched once, so per-run measurements do not apply
+        no_wall = true;
+        sb_push(settings->meas, BUILTIN_MEASUREMENTS[MEAS_REQ_LATENCY]);
+    }
     if (!no_wall) {
         sb_push(settings->meas, BUILTIN_MEASUREMENTS[MEAS_WALL]);
         bool already_has_stime = false, already_has_utime = false;
@@ -1004,9 +1419,103 @@ void parse_cli_args(int argc, char **argv, struct settings *settings)
         sb_push(settings->meas, BUILTIN_MEASUREMENTS[kind]);
     }
     sb_free(rusage_opts);
+    for (size_t i = 0; i < sb_len(perf_meas_list); ++i)
+        sb_push(settings->meas, perf_meas_list[i]);
+    sb_free(perf_meas_list);
     for (size_t i = 0; i < sb_len(meas_list); ++i)
         sb_push(settings->meas, meas_list[i]);
+    if (tma) {
+        if (g_perf_rotate) {
+            error("--tma can not be used with --perf-rotate");
+            exit(EXIT_FAILURE);
+        }
+        size_t metric_count = perf_tma_init();
+        if (metric_count == 0)
+            warning("CPU does not support top-down analysis events, --tma is ignored");
+        for (size_t i = 0; i < metric_count; ++i) {
+            struct meas meas = BUILTIN_MEASUREMENTS[MEAS_TMA];
+            meas.name = tma_metric_name(i);
+            meas.event_idx = i;
+            sb_push(settings->meas, meas);
+            g_use_perf = true;
+        }
+    }
+
+    if (g_pipe_io) {
+        if (settings->input.kind == INPUT_POLICY_NULL) {
+            error("--pipe-io requires input to be set");
+            exit(EXIT_FAILURE);
+        }
+        if (sb_len(meas_list) != 0 || settings->output == OUTPUT_POLICY_INHERIT) {
+            error("--pipe-io can not be used with custom measurements or inherited output");
+            exit(EXIT_FAILURE);
+        }
+        sb_push(settings->meas, BUILTIN_MEASUREMENTS[MEAS_PIPE_BYTES_RATE]);
+        sb_push(settings->meas, BUILTIN_MEASUREMENTS[MEAS_PIPE_RECORDS_RATE]);
+    }
+    if (g_rss_interval != 0.0) {
+        sb_push(settings->meas, BUILTIN_MEASUREMENTS[MEAS_RSS_MEAN]);
+        struct meas meas = BUILTIN_MEASUREMENTS[MEAS_RSS_SECONDS];
+        meas.primary_idx = sb_len(settings->meas) - 1;
+        sb_push(settings->meas, meas);
+    }
+    if (g_perf_roi && !g_use_perf) {
+        error("--perf-roi requires performance counter measurements");
+        exit(EXIT_FAILURE);
+    }
+    // Command enables counters in all threads that have inherited them,
+    // including helper threads started by csbench while command is running
+    if (g_perf_roi &&
+        (g_rss_interval != 0.0 || g_pipe_io || has_ttfb || g_ready_re || g_ready_connect)) {
+        error("--perf-roi can not be used with --rss-timeline, --pipe-io or startup latency "
+              "measurements");
+        exit(EXIT_FAILURE);
+    }
+    if (g_perf_rotate && g_use_perf) {
+        // Every group has to be counted at least once
+        int group_count = (int)perf_group_count();
+        if (g_bench_stop.runs != 0 && g_bench_stop.runs < group_count) {
+            error("--perf-rotate requires at least %d runs to count all event groups",
+                  group_count);
+            exit(EXIT_FAILURE);
+        }
+        if (g_bench_stop.min_runs < group_count)
+            g_bench_stop.min_runs = group_count;
+    }
+    if (sb_len(settings->cache_files) != 0 ||
+        (settings->cache_state != CACHE_STATE_NONE &&
+         settings->input.kind == INPUT_POLICY_FILE))
+        sb_push(settings->meas, BUILTIN_MEASUREMENTS[MEAS_CACHE_RESIDENCY]);
     sb_free(meas_list);
+    // Expressions are compiled last so that they can refer to any measurement,
+    // including previously defined expressions
+    for (size_t i = 0; i < sb_len(meas_expr_strs); ++i) {
+        const char *eq = strchr(meas_expr_strs[i], '=');
+        if (eq == NULL || eq == meas_expr_strs[i]) {
+            error("invalid --meas-expr argument '%s', expected <NAME>=<EXPR>",
+                  meas_expr_strs[i]);
+            exit(EXIT_FAILURE);
+        }
+        const char *name = csmkstr(meas_expr_strs[i], eq - meas_expr_strs[i]);
+        enum meas_kind kind;
+        bool exists = parse_meas_str(name, &kind);
+        for (size_t j = 0; j < sb_len(settings->meas) && !exists; ++j)
+            exists = strcmp(settings->meas[j].name, name) == 0;
+        if (exists) {
+            error("--meas-expr name '%s' collides with existing measurement name", name);
+            exit(EXIT_FAILURE);
+        }
+        struct meas_expr expr;
+        if (!compile_meas_expr(eq + 1, settings->meas, sb_len(settings->meas), &expr))
+            exit(EXIT_FAILURE);
+        struct meas meas = BUILTIN_MEASUREMENTS[MEAS_EXPR];
+        meas.name = name;
+        meas.units = expr.units;
+        meas.event_idx = sb_len(g_meas_exprs);
+        sb_push(g_meas_exprs, expr);
+        sb_push(settings->meas, meas);
+    }
+    sb_free(meas_expr_strs);
 }
 
 void free_settings(struct settings *settings)
@@ -1019,4 +1528,5 @@ void free_settings(struct settings *settings)
     sb_free(settings->args);
     sb_free(settings->meas);
     sb_free(settings->rename_list);
+    sb_free(settings->cache_files);
 }
@@ -54,6 +54,7 @@
 #include "csbench.h"
 
 #include <assert.h>
+#include <math.h>
 
 static void html_estimate(const char *name, const struct est *est, const struct units *units,
                           FILE *f)
@@ -199,6 +200,20 @@ static void html_toc_bench_meas(const struct meas_analysis *al, FILE *f)
                 "</li>",
                 meas_idx);
     }
+    if (g_scaling && base->group_count == 1 && al->group_analyses[0].has_scaling) {
+        fprintf(f,
+                "<li>"
+                /**/ "<a href=\"#scalings-%zu\">scaling analysis</a>"
+                "</li>",
+                meas_idx);
+    }
+    if (has_rss_timeline_plot(al)) {
+        fprintf(f,
+                "<li>"
+                /**/ "<a href=\"#rss-timeline-%zu\">memory timeline</a>"
+                "</li>",
+                meas_idx);
+    }
     if (base->bench_count > 1) {
         fprintf(f, "<li>"
                    /**/ "<a href=\"#cmps\">comparisons</a>"
@@ -289,6 +304,35 @@ static void html_toc_group_meas(const struct meas_analysis *al, FILE *f)
         }
         fprintf(f, "</ol>");
     }
+    if (has_scaling_analysis(al)) {
+        fprintf(f,
+                "<li>"
+                /**/ "<a href=\"#scalings-%zu\">scaling analysis</a>"
+                "</li>",
+                meas_idx);
+        fprintf(f, "<ol>");
+        foreach_group_by_avg_idx (grp_idx, al) {
+            if (!al->group_analyses[grp_idx].has_scaling)
+                continue;
+            fprintf(f,
+                    "<li>"
+                    /**/ "<a href=\"#scaling-%zu-%zu\">"
+                    /****/ "<tt>%s</tt>"
+                    /**/ "</a>"
+                    "</li>",
+                    grp_idx, meas_idx,              //
+                    bench_group_name(base, grp_idx) //
+            );
+        }
+        fprintf(f, "</ol>");
+    }
+    if (has_rss_timeline_plot(al)) {
+        fprintf(f,
+                "<li>"
+                /**/ "<a href=\"#rss-timeline-%zu\">memory timeline</a>"
+                "</li>",
+                meas_idx);
+    }
     if (base->group_count > 1) {
         bool need_list = base->group_count > 2;
         fprintf(f,
@@ -413,6 +457,24 @@ static void html_toc_group(const struct analysis *al, FILE *f)
     fprintf(f, "</ol>");
 }
 
+static bool has_profiles(const struct analysis *al)
+{
+    for (size_t bench_idx = 0; bench_idx < al->bench_count; ++bench_idx) {
+        if (al->benches[bench_idx].profile != NULL || al->benches[bench_idx].off_cpu != NULL)
+            return true;
+    }
+    return false;
+}
+
+static void html_toc_profiles(const struct analysis *al, FILE *f)
+{
+    if (!has_profiles(al))
+        return;
+    fprintf(f, "<ol>"
+               /**/ "<li><a href=\"#profiles\">profiles</a></li>"
+               "</ol>");
+}
+
 static void html_toc(const struct analysis *al, FILE *f)
 {
     fprintf(f, "<div>"
@@ -421,6 +483,7 @@ static void html_toc(const struct analysis *al, FILE *f)
         html_toc_bench(al, f);
     else
         html_toc_group(al, f);
+    html_toc_profiles(al, f);
     fprintf(f, "</div>");
 }
 
@@ -546,6 +609,84 @@ static void html_regr(const struct meas_analysis *al, FILE *f)
     );
 }
 
+static void html_scaling_group(const struct meas_analysis *al, size_t grp_idx, FILE *f)
+{
+    const struct analysis *base = al->base;
+    const struct bench_param *param = base->param;
+    const struct group_analysis *grp = al->group_analyses + grp_idx;
+    const struct scaling_fit *fit = &grp->scaling;
+    size_t meas_idx = al->meas_idx;
+    fprintf(f,
+            "<div id=\"scaling-%zu-%zu\">"
+            /**/ "<h3>group %s</h3>"
+            /**/ "<div class=\"row\">"
+            /****/ "<div class=\"col\">"
+            /******/ "<img src=\"scaling_%zu_%zu.svg\">"
+            /****/ "</div>"
+            /****/ "<div class=\"col stats\">"
+            /******/ "<p>amdahl serial fraction %.4f [%.4f %.4f]</p>"
+            /******/ "<p>amdahl R^2 %.2f</p>"
+            /******/ "<p>usl contention %.4f [%.4f %.4f]</p>"
+            /******/ "<p>usl coherency %.6f [%.6f %.6f]</p>"
+            /******/ "<p>usl R^2 %.2f</p>",
+            grp_idx, meas_idx,                                                   //
+            bench_group_name(base, grp_idx),                                     //
+            grp_idx, meas_idx,                                                   //
+            fit->serial.point, fit->serial.lower, fit->serial.upper,             //
+            fit->amdahl_r2,                                                      //
+            fit->contention.point, fit->contention.lower, fit->contention.upper, //
+            fit->coherency.point, fit->coherency.lower, fit->coherency.upper,    //
+            fit->usl_r2                                                          //
+    );
+    if (isfinite(fit->usl_peak))
+        fprintf(f, "<p>usl peak with %s=%.1f</p>", param->name, fit->usl_peak);
+    fprintf(f,
+            "<table>"
+            /**/ "<thead><tr><th>%s</th><th>speedup</th><th>efficiency</th></tr></thead>"
+            /**/ "<tbody>",
+            param->name);
+    for (size_t val_idx = 0; val_idx < param->value_count; ++val_idx) {
+        fprintf(f, "<tr><td>%s</td><td>%.3f</td><td>%.1f%%</td></tr>",
+                param->values[val_idx], fit->speedup[val_idx],
+                fit->efficiency[val_idx] * 100.0);
+    }
+    fprintf(f, "</tbody>"
+               "</table>"
+               "</div>" // col
+               "</div>" // row
+               "</div>");
+}
+
+static void html_scaling(const struct meas_analysis *al, FILE *f)
+{
+    const struct analysis *base = al->base;
+    if (!has_scaling_analysis(al))
+        return;
+    fprintf(f,
+            "<div id=\"scalings-%zu\">"
+            /**/ "<h2>scaling analysis</h2>"
+            /**/ "<p>speedup is relative to the lowest value of parameter %s</p>",
+            al->meas_idx, base->param->name);
+    foreach_group_by_avg_idx (grp_idx, al) {
+        if (al->group_analyses[grp_idx].has_scaling)
+            html_scaling_group(al, grp_idx, f);
+    }
+    fprintf(f, "</div>");
+}
+
+static void html_rss_timeline(const struct meas_analysis *al, FILE *f)
+{
+    if (!has_rss_timeline_plot(al))
+        return;
+    fprintf(f,
+            "<div id=\"rss-timeline-%zu\">"
+            /**/ "<h2>memory timeline</h2>"
+            /**/ "<p>resident set size of process tree during run with median mean RSS</p>"
+            /**/ "<img src=\"rss_timeline_%zu.svg\">"
+            "</div>",
+            al->meas_idx, al->meas_idx);
+}
+
 static void html_bench_summary(const struct meas_analysis *al, FILE *f)
 {
     const struct analysis *base = al->base;
@@ -806,7 +947,6 @@ static void html_distr(const struct bench_analysis *analysis, size_t bench_idx,
                        size_t meas_idx, const struct analysis *al, FILE *f)
 {
     const struct distr *distr = analysis->meas + meas_idx;
-    const struct bench *bench = analysis->bench;
     const struct meas *meas = al->meas + meas_idx;
     assert(!meas->is_secondary);
     char min_buf[256], median_buf[256], max_buf[256];
@@ -866,7 +1006,7 @@ static void html_distr(const struct bench_analysis *analysis, size_t bench_idx,
         meas->name,                                        //
         bench_idx, meas_idx,                               //
         bench_idx, meas_idx,                               //
-        bench->run_count,                                  //
+        distr->count,                                      //
         min_buf, median_buf, max_buf,                      //
         p1_buf, p5_buf, p25_buf, p75_buf, p95_buf, p99_buf //
     );
@@ -874,11 +1014,36 @@ static void html_distr(const struct bench_analysis *analysis, size_t bench_idx,
     html_estimate("st dev", &distr->st_dev, &meas->units, f);
     for (size_t j = 0; j < al->meas_count; ++j) {
         if (al->meas[j].is_secondary && al->meas[j].primary_idx == meas_idx)
-            html_estimate(al->meas[j].name, &analysis->meas[j].mean, &al->meas->units, f);
+            html_estimate(al->meas[j].name, &analysis->meas[j].mean, &al->meas[j].units, f);
     }
     fprintf(f, "</tbody>"
                "</table>");
-    html_outliers(&distr->outliers, bench->run_count, f);
+    html_outliers(&distr->outliers, distr->count, f);
+    struct iter_variance variance;
+    if (get_iter_variance(analysis->bench, meas_idx, &variance)) {
+        char within_buf[256], between_buf[256];
+        format_meas(within_buf, sizeof(within_buf), variance.within_st_dev, &meas->units);
+        format_meas(between_buf, sizeof(between_buf), variance.between_st_dev,
+                    &meas->units);
+        fprintf(f,
+                "<p>%zu iterations, st dev within runs %s, between runs %s (ICC %.2f)</p>",
+                variance.count, within_buf, between_buf, variance.icc);
+    }
+    const struct bench *bench = analysis->bench;
+    if (meas->kind == MEAS_REQ_LATENCY && bench->has_requests) {
+        const struct request_stats *stats = &bench->requests;
+        char p50[256], p99[256], p999[256];
+        format_time(p50, sizeof(p50), hdr_hist_quantile(&stats->latency, 0.5));
+        format_time(p99, sizeof(p99), hdr_hist_quantile(&stats->latency, 0.99));
+        format_time(p999, sizeof(p999), hdr_hist_quantile(&stats->latency, 0.999));
+        fprintf(f, "<p>%zu requests, %.1f req/s, p50 %s p99 %s p99.9 %s</p>",
+                stats->count, stats->count / stats->time, p50, p99, p999);
+    }
+    struct time_breakdown breakdown;
+    if (meas->kind == MEAS_WALL && get_time_breakdown(al, bench_idx, &breakdown))
+        fprintf(f, "<p>time breakdown: on-CPU %.1f%%, runqueue %.1f%%, sleeping %.1f%%</p>",
+                breakdown.on_cpu * 100.0, breakdown.runqueue * 100.0,
+                breakdown.sleeping * 100.0);
     fprintf(f,
             "</div>" // stats
             "</div>" // col
@@ -1305,6 +1470,54 @@ static void html_compare(const struct meas_analysis *al, FILE *f)
     }
 }
 
+static void html_profiles(const struct analysis *al, FILE *f)
+{
+    if (!has_profiles(al))
+        return;
+    size_t ref_idx = profile_ref_idx(al);
+    fprintf(f, "<div id=\"profiles\">"
+               "<h1>profiles</h1>");
+    for (size_t bench_idx = 0; bench_idx < al->bench_count; ++bench_idx) {
+        const struct bench *bench = al->benches + bench_idx;
+        if (bench->profile == NULL && bench->off_cpu == NULL)
+            continue;
+        fprintf(f,
+                "<div id=\"profile-%zu\">"
+                "<h3>benchmark <tt>%s</tt></h3>",
+                bench_idx, bench_name(al, bench_idx));
+        if (bench->profile != NULL)
+            fprintf(f,
+                    "<h5>flame graph</h5>"
+                    "<a href=\"flamegraph_%zu.svg\">"
+                    /**/ "<img src=\"flamegraph_%zu.svg\">"
+                    "</a>",
+                    bench_idx, bench_idx);
+        if (bench->off_cpu != NULL)
+            fprintf(f,
+                    "<h5>off-CPU flame graph</h5>"
+                    "<p class=\"offset-text\">Frame widths are time spent off CPU, "
+                    "kernel frames are marked with <tt>_[k]</tt>.</p>"
+                    "<a href=\"offcpu_flamegraph_%zu.svg\">"
+                    /**/ "<img src=\"offcpu_flamegraph_%zu.svg\">"
+                    "</a>",
+                    bench_idx, bench_idx);
+        if (bench->profile != NULL && ref_idx != SIZE_MAX && ref_idx != bench_idx) {
+            fprintf(f,
+                    "<h5>difference from <tt>%s</tt></h5>"
+                    "<p class=\"offset-text\">Frames are colored red if they take larger "
+                    "share of samples than in <tt>%s</tt>, and blue if smaller.</p>"
+                    "<a href=\"flamegraph_diff_%zu.svg\">"
+                    /**/ "<img src=\"flamegraph_diff_%zu.svg\">"
+                    "</a>",
+                    bench_name(al, ref_idx), bench_name(al, ref_idx), //
+                    bench_idx, bench_idx                              //
+            );
+        }
+        fprintf(f, "</div>");
+    }
+    fprintf(f, "</div>");
+}
+
 static void html_report(const struct analysis *al, FILE *f)
 {
     fprintf(f, "<!DOCTYPE html><html lang=\"en\">"
@@ -1352,10 +1565,13 @@ static void html_report(const struct analysis *al, FILE *f)
                 meas_idx, mal->meas->name);
         html_summary(mal, f);
         html_regr(mal, f);
+        html_scaling(mal, f);
+        html_rss_timeline(mal, f);
         html_compare(mal, f);
         html_benches(mal, f);
         fprintf(f, "</div>");
     }
+    html_profiles(al, f);
     fprintf(f, "</body>");
 }
 
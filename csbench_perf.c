@@ -53,77 +53,389 @@
 //    limitations under the License.
 #include "csbench.h"
 
+const char *tma_metric_name(enum tma_metric metric)
+{
+    switch (metric) {
+    case TMA_FRONTEND_BOUND:
+        return "frontend bound";
+    case TMA_BAD_SPECULATION:
+        return "bad speculation";
+    case TMA_BACKEND_BOUND:
+        return "backend bound";
+    case TMA_RETIRING:
+        return "retiring";
+    case TMA_FETCH_LATENCY:
+        return "fetch latency";
+    case TMA_FETCH_BANDWIDTH:
+        return "fetch bandwidth";
+    case TMA_BRANCH_MISPREDICTS:
+        return "branch mispredicts";
+    case TMA_MACHINE_CLEARS:
+        return "machine clears";
+    case TMA_MEMORY_BOUND:
+        return "memory bound";
+    case TMA_CORE_BOUND:
+        return "core bound";
+    case TMA_HEAVY_OPERATIONS:
+        return "heavy operations";
+    case TMA_LIGHT_OPERATIONS:
+        return "light operations";
+    case TMA_METRIC_COUNT:
+        break;
+    }
+    ASSERT_UNREACHABLE();
+}
+
 #ifdef __linux__
 
+#include <assert.h>
+#include <ctype.h>
 #include <linux/hw_breakpoint.h>
 #include <linux/perf_event.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/ioctl.h>
 #include <sys/syscall.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
+#define HW_CACHE_CONFIG(_cache, _op, _result)                                               \
+    (PERF_COUNT_HW_CACHE_##_cache | (PERF_COUNT_HW_CACHE_OP_##_op << 8) |                   \
+     (PERF_COUNT_HW_CACHE_RESULT_##_result << 16))
+
+// Event that can be referred to by name
+struct named_event {
+    const char *name;
+    uint32_t type;
+    uint64_t config;
+};
+
+// Order matches PERF_CNT_* constants
+static const struct named_event builtin_events[PERF_CNT_BUILTIN_COUNT] = {
+    {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {"branches", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_INSTRUCTIONS},
+    {"branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+};
+
+// Event names follow naming used by perf-list(1)
+static const struct named_event named_events[] = {
+    {"cache-references", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_REFERENCES},
+    {"cache-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {"bus-cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BUS_CYCLES},
+    {"stalled-cycles-frontend", PERF_TYPE_HARDWARE, PERF_COUNT_HW_STALLED_CYCLES_FRONTEND},
+    {"stalled-cycles-backend", PERF_TYPE_HARDWARE, PERF_COUNT_HW_STALLED_CYCLES_BACKEND},
+    {"ref-cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_REF_CPU_CYCLES},
+    {"L1-dcache-loads", PERF_TYPE_HW_CACHE, HW_CACHE_CONFIG(L1D, READ, ACCESS)},
+    {"L1-dcache-load-misses", PERF_TYPE_HW_CACHE, HW_CACHE_CONFIG(L1D, READ, MISS)},
+    {"L1-dcache-stores", PERF_TYPE_HW_CACHE, HW_CACHE_CONFIG(L1D, WRITE, ACCESS)},
+    {"L1-icache-load-misses", PERF_TYPE_HW_CACHE, HW_CACHE_CONFIG(L1I, READ, MISS)},
+    {"LLC-loads", PERF_TYPE_HW_CACHE, HW_CACHE_CONFIG(LL, READ, ACCESS)},
+    {"LLC-load-misses", PERF_TYPE_HW_CACHE, HW_CACHE_CONFIG(LL, READ, MISS)},
+    {"LLC-stores", PERF_TYPE_HW_CACHE, HW_CACHE_CONFIG(LL, WRITE, ACCESS)},
+    {"LLC-store-misses", PERF_TYPE_HW_CACHE, HW_CACHE_CONFIG(LL, WRITE, MISS)},
+    {"dTLB-loads", PERF_TYPE_HW_CACHE, HW_CACHE_CONFIG(DTLB, READ, ACCESS)},
+    {"dTLB-load-misses", PERF_TYPE_HW_CACHE, HW_CACHE_CONFIG(DTLB, READ, MISS)},
+    {"dTLB-stores", PERF_TYPE_HW_CACHE, HW_CACHE_CONFIG(DTLB, WRITE, ACCESS)},
+    {"dTLB-store-misses", PERF_TYPE_HW_CACHE, HW_CACHE_CONFIG(DTLB, WRITE, MISS)},
+    {"iTLB-load-misses", PERF_TYPE_HW_CACHE, HW_CACHE_CONFIG(ITLB, READ, MISS)},
+    {"branch-loads", PERF_TYPE_HW_CACHE, HW_CACHE_CONFIG(BPU, READ, ACCESS)},
+    {"branch-load-misses", PERF_TYPE_HW_CACHE, HW_CACHE_CONFIG(BPU, READ, MISS)},
+    // Software events are counted by kernel and do not require PMU
+    {"cpu-clock", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_CLOCK},
+    {"task-clock", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK},
+    {"page-faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS},
+    {"faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS},
+    {"minor-faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS_MIN},
+    {"major-faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS_MAJ},
+    {"context-switches", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES},
+    {"cs", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES},
+    {"cpu-migrations", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS},
+    {"migrations", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS},
+    {"alignment-faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_ALIGNMENT_FAULTS},
+    {"emulation-faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_EMULATION_FAULTS},
+};
+
+// All events that are counted: builtin events that are used, followed by
+// events from 'g_perf_events'. Builtin events are only opened if requested,
+// so that software events can be counted on systems without PMU.
+static struct perf_event_spec *g_counted_events;
+// Index in 'struct perf_cnt' of each event in 'g_counted_events'
+static size_t *g_counted_idxs;
+
+static bool find_named_event(const char *str, const struct named_event *events, size_t count,
+                             struct perf_event_spec *spec)
+{
+    for (size_t i = 0; i < count; ++i) {
+        if (strcmp(events[i].name, str) == 0) {
+            spec->type = events[i].type;
+            spec->config = events[i].config;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool parse_perf_event_str_internal(const char *str, struct perf_event_spec *spec,
+                                          bool allow_builtin)
+{
+    if (allow_builtin && find_named_event(str, builtin_events, PERF_CNT_BUILTIN_COUNT, spec))
+        return true;
+    if (find_named_event(str, named_events, sizeof(named_events) / sizeof(*named_events),
+                         spec))
+        return true;
+    char *end;
+    // Raw hardware event encoding, like r01c2
+    if (str[0] == 'r' && isxdigit(str[1])) {
+        spec->type = PERF_TYPE_RAW;
+        spec->config = strtoull(str + 1, &end, 16);
+        return *end == '\0';
+    }
+    // Explicit 'type:config' pair
+    if (isdigit(str[0])) {
+        spec->type = strtoul(str, &end, 10);
+        if (*end != ':' || end[1] == '\0')
+            return false;
+        const char *config_str = end + 1;
+        spec->config = strtoull(config_str, &end, 0);
+        return *end == '\0';
+    }
+    return false;
+}
+
+static bool parse_perf_event_str_modifiers(const char *str, struct perf_event_spec *spec)
+{
+    spec->name = str;
+    // Modifiers like in perf-list(1): 'u' counts user mode, 'k' counts
+    // kernel mode, both by default
+    const char *colon = strrchr(str, ':');
+    if (colon != NULL && colon[1] != '\0' && strspn(colon + 1, "uk") == strlen(colon + 1)) {
+        const char *base = csmkstr(str, colon - str);
+        if (!parse_perf_event_str_internal(base, spec, true))
+            return false;
+        bool user = strchr(colon + 1, 'u') != NULL;
+        bool kernel = strchr(colon + 1, 'k') != NULL;
+        spec->exclude_user = !user;
+        spec->exclude_kernel = !kernel;
+        return true;
+    }
+    // Builtin events without modifiers are builtin measurements
+    return parse_perf_event_str_internal(str, spec, false);
+}
+
+bool parse_perf_event_str(const char *str, struct perf_event_spec *spec)
+{
+    memset(spec, 0, sizeof(*spec));
+    if (!parse_perf_event_str_modifiers(str, spec))
+        return false;
+    spec->is_time = spec->type == PERF_TYPE_SOFTWARE &&
+                    (spec->config == PERF_COUNT_SW_CPU_CLOCK ||
+                     spec->config == PERF_COUNT_SW_TASK_CLOCK);
+    return true;
+}
+
+bool perf_event_fallback(const struct perf_event_spec *spec, enum meas_kind *kind)
+{
+    if (spec->type != PERF_TYPE_SOFTWARE || spec->exclude_user || spec->exclude_kernel)
+        return false;
+    switch (spec->config) {
+    case PERF_COUNT_SW_TASK_CLOCK:
+        *kind = MEAS_RUSAGE_CPUTIME;
+        return true;
+    case PERF_COUNT_SW_PAGE_FAULTS:
+        *kind = MEAS_RUSAGE_FLT;
+        return true;
+    case PERF_COUNT_SW_PAGE_FAULTS_MIN:
+        *kind = MEAS_RUSAGE_MINFLT;
+        return true;
+    case PERF_COUNT_SW_PAGE_FAULTS_MAJ:
+        *kind = MEAS_RUSAGE_MAJFLT;
+        return true;
+    case PERF_COUNT_SW_CONTEXT_SWITCHES:
+        *kind = MEAS_RUSAGE_CSW;
+        return true;
+    default:
+        break;
+    }
+    return false;
+}
+
+// Check that counters can be opened the same way they are opened for
+// commands. This fails if perf_event_open is forbidden, for example by
+// perf_event_paranoid sysctl or seccomp filter of container.
+bool perf_events_available(void)
+{
+    static int available = -1;
+    if (available != -1)
+        return available;
+    struct perf_event_attr attr = {0};
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_SOFTWARE;
+    attr.config = PERF_COUNT_SW_TASK_CLOCK;
+    attr.disabled = 1;
+    attr.inherit = 1;
+    attr.exclude_hv = 1;
+    int fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+    available = fd != -1;
+    if (fd != -1)
+        close(fd);
+    return available;
+}
+
 bool init_perf(void)
 {
+    for (size_t i = 0; i < PERF_CNT_BUILTIN_COUNT; ++i) {
+        if (!g_perf_builtin_used[i])
+            continue;
+        struct perf_event_spec spec = {0};
+        spec.name = builtin_events[i].name;
+        spec.type = builtin_events[i].type;
+        spec.config = builtin_events[i].config;
+        sb_push(g_counted_events, spec);
+        sb_push(g_counted_idxs, i);
+    }
+    for (size_t i = 0; i < sb_len(g_perf_events); ++i) {
+        sb_push(g_counted_events, g_perf_events[i]);
+        sb_push(g_counted_idxs, PERF_CNT_BUILTIN_COUNT + i);
+    }
     return true;
 }
+
 void deinit_perf(void)
 {
+    sb_free(g_counted_events);
+    g_counted_events = NULL;
+    sb_free(g_counted_idxs);
+    g_counted_idxs = NULL;
 }
+
 void perf_signal_cleanup(void)
 {
 }
 
+size_t perf_group_count(void)
+{
+    size_t count = sb_len(g_perf_events);
+    for (size_t i = 0; i < PERF_CNT_BUILTIN_COUNT; ++i) {
+        if (g_perf_builtin_used[i])
+            ++count;
+    }
+    if (!g_perf_rotate)
+        return 1;
+    return (count + g_perf_slots - 1) / g_perf_slots;
+}
+
+// Value read from counter with PERF_FORMAT_TOTAL_TIME_ENABLED and
+// PERF_FORMAT_TOTAL_TIME_RUNNING
+struct perf_read_value {
+    uint64_t value;
+    uint64_t time_enabled;
+    uint64_t time_running;
+};
+
 struct perf_events {
+    // Index of first event in 'g_counted_events'
+    size_t first;
     size_t count;
+    // If set, events are opened as a group with first event as leader, which
+    // means that they are scheduled on PMU together
+    bool grouped;
     int *fds;
-    int *ids;
-    size_t read_buf_len;
-    uint64_t *read_buf;
+    // Values from previous read. Counters are never reset, because reset does
+    // not clear values accumulated from exited child processes, so values of
+    // a run are computed as difference of two reads.
+    struct perf_read_value *last;
 };
 
-static struct perf_events *open_counters(const int *config, size_t count, pid_t pid)
+// Counters used to measure commands are opened once per worker thread and
+// then reused for all runs. With --perf-rotate counters are indexed by group,
+// but only the group selected for current run is open at any time, see
+// 'get_run_counters'. They are attached to the worker thread itself with
+// 'inherit' set, so that forked command gets its own copy of each counter.
+// Counters are disabled and have 'enable_on_exec' set, so worker thread is
+// not counted, and command starts counting exactly at execve(2) without any
+// synchronization with parent. Counts of command and all its descendants are
+// accumulated into worker thread counters when they exit.
+static __thread struct perf_events *g_run_events[MAX_PERF_CNT];
+// Non-inherited event opened alongside reused counters. When all events of a
+// task are inherited, kernel treats context of forked child as a clone of
+// parent context and may swap them on context switch. Then child execve
+// consumes 'enable_on_exec' of parent counters, and subsequent children are
+// never counted. Single event that is not inherited prevents this.
+static __thread int g_uninherited_fd = -1;
+
+static bool open_uninherited_event(void)
+{
+    struct perf_event_attr attr = {0};
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_SOFTWARE;
+    attr.config = PERF_COUNT_SW_DUMMY;
+    attr.exclude_kernel = 1;
+    attr.disabled = 1;
+    int fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+    if (fd == -1) {
+        csperror("perf_event_open (dummy event)");
+        return false;
+    }
+    g_uninherited_fd = fd;
+    return true;
+}
+
+// Events are opened with 'inherit' set, because it is required to count
+// whole process trees. Group reads are not supported for inherited counters,
+// so even grouped events are read separately.
+//
+// When not grouped, events are opened independently, because group with more
+// events than there are hardware counters can't be scheduled at all. Instead
+// kernel multiplexes events and values are scaled accordingly.
+static struct perf_events *open_counters(size_t first, size_t count, bool grouped,
+                                         pid_t pid, bool enable_on_exec)
 {
     struct perf_events *events = calloc(1, sizeof(*events));
+    events->first = first;
     events->count = count;
+    events->grouped = grouped;
     events->fds = calloc(count, sizeof(*events->fds));
-    events->ids = calloc(count, sizeof(*events->ids));
+    events->last = calloc(count, sizeof(*events->last));
 
     struct perf_event_attr attr = {0};
-    attr.type = PERF_TYPE_HARDWARE;
     attr.size = sizeof(attr);
-    attr.disabled = 1;
-    attr.exclude_kernel = 0;
+    attr.disabled = enable_on_exec ? 1 : 0;
+    attr.enable_on_exec = enable_on_exec ? 1 : 0;
+    attr.inherit = 1;
     attr.exclude_hv = 1;
     attr.sample_period = 0;
-    attr.read_format = PERF_FORMAT_ID | PERF_FORMAT_GROUP;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
 
-    int group = -1;
+    int group = -1, leader = -1;
     for (size_t i = 0; i < count; ++i) {
-        attr.config = config[i];
-        int fd = syscall(__NR_perf_event_open, &attr, pid, -1, group, 0);
+        const struct perf_event_spec *spec = g_counted_events + first + i;
+        attr.type = spec->type;
+        attr.config = spec->config;
+        attr.exclude_user = spec->exclude_user;
+        attr.exclude_kernel = spec->exclude_kernel;
+        int group_fd = group;
+        if (!grouped && spec->group_with_prev)
+            group_fd = leader;
+        int fd =
+            syscall(__NR_perf_event_open, &attr, pid, -1, group_fd, PERF_FLAG_FD_CLOEXEC);
         if (fd == -1) {
-            csperror("perf_event_open");
-        err_free_all_others:
+            csfmtperror("perf_event_open (event '%s')", spec->name);
             for (size_t j = 0; j < i; ++j)
                 close(events->fds[j]);
             free(events->fds);
+            free(events->last);
             free(events);
             return NULL;
         }
-        if (ioctl(fd, PERF_EVENT_IOC_ID, events->ids + i) == -1) {
-            error("failed to open pmc");
-            goto err_free_all_others;
-        }
         events->fds[i] = fd;
-        if (group == -1) {
+        if (grouped && group == -1)
             group = fd;
-        }
+        if (!spec->group_with_prev)
+            leader = fd;
     }
-    events->read_buf_len = 1 + count * 2;
-    events->read_buf = calloc(events->read_buf_len, sizeof(*events->read_buf));
     return events;
 }
 
@@ -131,100 +443,492 @@ static void free_counters(struct perf_events *events)
 {
     for (size_t i = 0; i < events->count; ++i)
         close(events->fds[i]);
-    free(events->ids);
     free(events->fds);
-    free(events->read_buf);
+    free(events->last);
+    free(events);
 }
 
-static bool start_counting(struct perf_events *events)
+// Multiplexed counter only counts for part of the time it has been enabled,
+// so value is extrapolated to the whole time.
+static double scale_counter(uint64_t value, uint64_t time_enabled, uint64_t time_running)
 {
-    if (ioctl(events->fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP) == -1) {
-        error("failed to reset pmc");
-        return false;
+    if (time_running == 0)
+        return 0.0;
+    if (time_running == time_enabled)
+        return value;
+    return (double)value * time_enabled / time_running;
+}
+
+static bool read_values(struct perf_events *events, struct perf_read_value *values)
+{
+    for (size_t i = 0; i < events->count; ++i) {
+        ssize_t nread = read(events->fds[i], values + i, sizeof(*values));
+        if (nread != sizeof(*values)) {
+            if (nread == -1)
+                csperror("read");
+            else
+                error("failed to read pmc values");
+            return false;
+        }
     }
-    if (ioctl(events->fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP) == -1) {
-        error("failed to enable pmc counting");
+    return true;
+}
+
+// Read values counted since previous read
+static bool read_counters(struct perf_events *events, struct perf_cnt *cnt)
+{
+    struct perf_read_value values[MAX_PERF_CNT];
+    assert(events->count <= MAX_PERF_CNT);
+    if (!read_values(events, values))
         return false;
+    memset(cnt, 0, sizeof(*cnt));
+    for (size_t i = 0; i < events->count; ++i) {
+        uint64_t value = values[i].value - events->last[i].value;
+        uint64_t enabled = values[i].time_enabled - events->last[i].time_enabled;
+        uint64_t running = values[i].time_running - events->last[i].time_running;
+        events->last[i] = values[i];
+        // Group is scheduled as a whole, if it does not fit on PMU it is
+        // never scheduled
+        if (events->grouped && enabled != 0 && running == 0) {
+            error("performance counter group has not been scheduled, it likely does not "
+                  "fit into PMU (try decreasing --perf-slots)");
+            return false;
+        }
+        size_t idx = g_counted_idxs[events->first + i];
+        cnt->values[idx] = scale_counter(value, enabled, running);
+        cnt->counted[idx] = true;
+    }
+    return true;
+}
+
+// With --perf-rotate events are split into groups that fit into PMU, and each
+// run counts one of the groups exactly, without multiplexing.
+static struct perf_events *get_run_counters(size_t run_idx)
+{
+    size_t group_idx = run_idx % perf_group_count();
+    if (g_run_events[group_idx] != NULL)
+        return g_run_events[group_idx];
+    // Invariant: only counters of the group selected for this run are open.
+    // Every open counter is inherited by forked command and enabled on
+    // execve(2), so otherwise all groups would compete for PMU and be
+    // multiplexed again. Counters of previous group are closed instead.
+    for (size_t i = 0; i < MAX_PERF_CNT; ++i) {
+        if (g_run_events[i] != NULL) {
+            free_counters(g_run_events[i]);
+            g_run_events[i] = NULL;
+        }
+    }
+    if (g_uninherited_fd == -1 && !open_uninherited_event())
+        return NULL;
+
+    size_t count = sb_len(g_counted_events);
+    struct perf_events *events;
+    if (!g_perf_rotate) {
+        events = open_counters(0, count, false, 0, !g_perf_roi);
+    } else {
+        size_t first = group_idx * g_perf_slots;
+        size_t group_size = count - first;
+        if (group_size > (size_t)g_perf_slots)
+            group_size = g_perf_slots;
+        events = open_counters(first, group_size, true, 0, !g_perf_roi);
     }
+    if (events == NULL)
+        return NULL;
+    // With --perf-roi counters are only enabled by command itself, instead of
+    // on execve(2)
+    if (g_perf_roi) {
+        for (size_t i = 0; i < events->count; ++i) {
+            if (ioctl(events->fds[i], PERF_EVENT_IOC_DISABLE, 0) == -1) {
+                csperror("ioctl(PERF_EVENT_IOC_DISABLE)");
+                free_counters(events);
+                return NULL;
+            }
+        }
+    }
+    g_run_events[group_idx] = events;
+    return events;
+}
+
+bool perf_cnt_prepare(size_t run_idx)
+{
+    struct perf_events *events = get_run_counters(run_idx);
+    if (events == NULL)
+        return false;
+    // Discard everything counted between runs, for example warmup runs and
+    // custom measurement commands
+    return read_values(events, events->last);
+}
+
+bool perf_cnt_roi_fds(size_t run_idx, const int **fds, size_t *count)
+{
+    struct perf_events *events = get_run_counters(run_idx);
+    if (events == NULL)
+        return false;
+    *fds = events->fds;
+    *count = events->count;
     return true;
 }
 
-static int stop_counting(struct perf_events *events)
+bool perf_cnt_collect(pid_t pid, size_t run_idx, struct perf_cnt *cnt)
 {
-    if (ioctl(events->fds[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP) == -1) {
-        error("failed to stop pmc counting");
+    struct perf_events *events = get_run_counters(run_idx);
+    assert(events != NULL);
+    // Child counters are added to parent ones when child exits
+    siginfo_t siginfo;
+    if (waitid(P_PID, pid, &siginfo, WEXITED | WNOWAIT) == -1) {
+        csperror("waitid");
         return false;
     }
-    size_t bytes_to_read = events->read_buf_len * sizeof(*events->read_buf);
-    ssize_t nread;
-    if ((nread = read(events->fds[0], events->read_buf, bytes_to_read)) !=
-        (ssize_t)bytes_to_read) {
-        if (nread == -1) {
-            csperror("read");
+    if (!g_perf_roi)
+        return read_counters(events, cnt);
+    // Command could have exited inside region of interest, in which case
+    // counters of csbench itself are still enabled
+    for (size_t i = 0; i < events->count; ++i) {
+        if (ioctl(events->fds[i], PERF_EVENT_IOC_DISABLE, 0) == -1) {
+            csperror("ioctl(PERF_EVENT_IOC_DISABLE)");
             return false;
         }
-        error("failed to read pmc values");
-        return false;
     }
-    if (events->read_buf[0] != events->count) {
-        error("pmc count is incorrect");
+    uint64_t time_enabled = events->last[0].time_enabled;
+    if (!read_counters(events, cnt))
+        return false;
+    if (events->last[0].time_enabled == time_enabled) {
+        error("command did not enter region of interest, it has to call "
+              "csbench_probe_roi_begin when --perf-roi is used");
         return false;
     }
     return true;
 }
 
-static uint64_t get_counter(struct perf_events *events, size_t idx)
+void perf_cnt_release(void)
 {
-    uint64_t id = events->ids[idx];
-    const uint64_t *cursor = events->read_buf + 1;
-    const uint64_t *end = events->read_buf + events->read_buf_len;
-    for (; cursor < end; cursor += 2) {
-        if (*cursor == id)
-            return cursor[1];
+    for (size_t i = 0; i < MAX_PERF_CNT; ++i) {
+        if (g_run_events[i] != NULL) {
+            free_counters(g_run_events[i]);
+            g_run_events[i] = NULL;
+        }
+    }
+    if (g_uninherited_fd != -1) {
+        close(g_uninherited_fd);
+        g_uninherited_fd = -1;
     }
-    return 0;
 }
 
-bool perf_cnt_collect(pid_t pid, struct perf_cnt *cnt)
+#define SYSFS_PMU_DIR "/sys/bus/event_source/devices"
+
+static bool read_sysfs_str(const char *path, char *buf, size_t buf_size)
 {
-    static const int config[] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
-                                 PERF_COUNT_HW_BRANCH_INSTRUCTIONS,
-                                 PERF_COUNT_HW_BRANCH_MISSES};
+    FILE *f = fopen(path, "r");
+    if (f == NULL)
+        return false;
+    bool success = fgets(buf, buf_size, f) != NULL;
+    fclose(f);
+    if (success)
+        buf[strcspn(buf, "\n")] = '\0';
+    return success;
+}
 
-    struct perf_events *events =
-        open_counters(config, sizeof(config) / sizeof(*config), pid);
-    if (events == NULL)
+// Place bits of 'value' into 'config' according to PMU format of 'term',
+// which is a list of bit ranges like 'config:0-7,32-35'
+static bool apply_sysfs_format(const char *pmu, const char *term, uint64_t value,
+                               uint64_t *config)
+{
+    char buf[256];
+    if (!read_sysfs_str(csfmt("%s/%s/format/%s", SYSFS_PMU_DIR, pmu, term), buf,
+                        sizeof(buf)))
         return false;
+    // Only events that are fully encoded in 'config' field are supported
+    if (strncmp(buf, "config:", 7) != 0)
+        return false;
+    const char *cursor = buf + 7;
+    for (;;) {
+        char *end;
+        unsigned long lo = strtoul(cursor, &end, 10), hi = lo;
+        if (end == cursor)
+            return false;
+        if (*end == '-') {
+            cursor = end + 1;
+            hi = strtoul(cursor, &end, 10);
+            if (end == cursor)
+                return false;
+        }
+        if (hi < lo || hi > 63)
+            return false;
+        for (unsigned long bit = lo; bit <= hi; ++bit) {
+            if (value & 1)
+                *config |= 1ull << bit;
+            value >>= 1;
+        }
+        if (*end != ',')
+            break;
+        cursor = end + 1;
+    }
+    return value == 0;
+}
 
-    if (!start_counting(events))
-        goto err_free_counters;
+// Parse event exported by kernel in sysfs, which is a list of terms like
+// 'event=0x00,umask=0x80'. Events can also have scale in separate file.
+static bool parse_sysfs_event(const char *pmu, const char *name,
+                              struct perf_event_spec *spec, double *scale)
+{
+    char buf[256];
+    memset(spec, 0, sizeof(*spec));
+    spec->name = name;
+    if (!read_sysfs_str(csfmt("%s/%s/type", SYSFS_PMU_DIR, pmu), buf, sizeof(buf)))
+        return false;
+    spec->type = strtoul(buf, NULL, 10);
+    if (!read_sysfs_str(csfmt("%s/%s/events/%s", SYSFS_PMU_DIR, pmu, name), buf,
+                        sizeof(buf)))
+        return false;
+    for (char *term = buf; *term != '\0';) {
+        char *term_end = term + strcspn(term, ",");
+        bool last = *term_end == '\0';
+        *term_end = '\0';
+        uint64_t value = 1;
+        char *eq = strchr(term, '=');
+        if (eq != NULL) {
+            *eq = '\0';
+            value = strtoull(eq + 1, NULL, 0);
+        }
+        if (!apply_sysfs_format(pmu, term, value, &spec->config))
+            return false;
+        if (last)
+            break;
+        term = term_end + 1;
+    }
+    *scale = 1.0;
+    if (read_sysfs_str(csfmt("%s/%s/events/%s.scale", SYSFS_PMU_DIR, pmu, name), buf,
+                       sizeof(buf)))
+        *scale = strtod(buf, NULL);
+    return true;
+}
 
-    // signal process to start executing
-    if (kill(pid, SIGUSR1) == -1) {
-        csperror("kill");
-        goto err_stop_counting;
+// Intel CPUs starting from Ice Lake report level 1 (and on some models
+// level 2) top-down metrics directly in PERF_METRICS register. These events
+// must be in a group led by 'slots' event, and each of them is read as number
+// of slots attributed to category.
+enum {
+    TMA_EV_SLOTS,
+    TMA_EV_RETIRING,
+    TMA_EV_BAD_SPEC,
+    TMA_EV_FE_BOUND,
+    TMA_EV_BE_BOUND,
+    TMA_EV_HEAVY_OPS,
+    TMA_EV_BR_MISPREDICT,
+    TMA_EV_FETCH_LAT,
+    TMA_EV_MEM_BOUND,
+    TMA_EV_COUNT
+};
+
+static const char *const tma_metrics_events[] = {
+    "slots",
+    "topdown-retiring",
+    "topdown-bad-spec",
+    "topdown-fe-bound",
+    "topdown-be-bound",
+    "topdown-heavy-ops",
+    "topdown-br-mispredict",
+    "topdown-fetch-lat",
+    "topdown-mem-bound",
+};
+
+// Older Intel CPUs export events for computing level 1 metrics from slot
+// counts using formulas from perf-stat(1) --topdown
+enum {
+    TMA_EV_TOTAL_SLOTS,
+    TMA_EV_SLOTS_ISSUED,
+    TMA_EV_SLOTS_RETIRED,
+    TMA_EV_FETCH_BUBBLES,
+    TMA_EV_RECOVERY_BUBBLES,
+    TMA_EV_LEGACY_COUNT
+};
+
+static const char *const tma_legacy_events[] = {
+    "topdown-total-slots",   "topdown-slots-issued",     "topdown-slots-retired",
+    "topdown-fetch-bubbles", "topdown-recovery-bubbles",
+};
+
+static enum { TMA_NONE, TMA_PERF_METRICS, TMA_LEGACY } g_tma_mode;
+// Index of each event in 'struct perf_cnt'
+static size_t g_tma_events[TMA_EV_COUNT];
+static double g_tma_scales[TMA_EV_COUNT];
+
+static size_t find_tma_events(const char *pmu, const char *const *names, size_t count,
+                              struct perf_event_spec *specs)
+{
+    size_t found = 0;
+    while (found < count &&
+           parse_sysfs_event(pmu, names[found], specs + found, g_tma_scales + found))
+        ++found;
+    return found;
+}
+
+size_t perf_tma_init(void)
+{
+    // Hybrid CPUs have separate PMUs for performance and efficiency cores,
+    // only performance cores support top-down events
+    const char *pmus[] = {"cpu", "cpu_core"};
+    struct perf_event_spec specs[TMA_EV_COUNT];
+    size_t event_count = 0;
+    size_t metric_count = 0;
+    for (size_t i = 0; i < sizeof(pmus) / sizeof(*pmus) && metric_count == 0; ++i) {
+        size_t found = find_tma_events(pmus[i], tma_metrics_events, TMA_EV_COUNT, specs);
+        if (found == TMA_EV_COUNT) {
+            g_tma_mode = TMA_PERF_METRICS;
+            event_count = TMA_EV_COUNT;
+            metric_count = TMA_METRIC_COUNT;
+        } else if (found >= TMA_EV_HEAVY_OPS) {
+            g_tma_mode = TMA_PERF_METRICS;
+            event_count = TMA_EV_HEAVY_OPS;
+            metric_count = TMA_LEVEL1_COUNT;
+        } else if (find_tma_events(pmus[i], tma_legacy_events, TMA_EV_LEGACY_COUNT, specs) ==
+                   TMA_EV_LEGACY_COUNT) {
+            g_tma_mode = TMA_LEGACY;
+            event_count = TMA_EV_LEGACY_COUNT;
+            metric_count = TMA_LEVEL1_COUNT;
+        }
+    }
+    if (metric_count == 0)
+        return 0;
+    if (sb_len(g_perf_events) + event_count > MAX_PERF_EVENTS) {
+        g_tma_mode = TMA_NONE;
+        return 0;
     }
+    for (size_t i = 0; i < event_count; ++i) {
+        // Metrics are only meaningful when all events count the same
+        // interval, so they are always scheduled together
+        specs[i].group_with_prev = i != 0;
+        g_tma_events[i] = PERF_CNT_BUILTIN_COUNT + sb_len(g_perf_events);
+        sb_push(g_perf_events, specs[i]);
+    }
+    return metric_count;
+}
 
-    siginfo_t siginfo;
-    if (waitid(P_PID, pid, &siginfo, WEXITED | WNOWAIT) == -1) {
-        csperror("waitid");
-        goto err_stop_counting;
+static double tma_value(const struct perf_cnt *cnt, size_t event)
+{
+    return cnt->values[g_tma_events[event]] * g_tma_scales[event];
+}
+
+static double tma_perf_metrics(const struct perf_cnt *cnt, enum tma_metric metric)
+{
+    double retiring = tma_value(cnt, TMA_EV_RETIRING);
+    double bad_spec = tma_value(cnt, TMA_EV_BAD_SPEC);
+    double fe_bound = tma_value(cnt, TMA_EV_FE_BOUND);
+    double be_bound = tma_value(cnt, TMA_EV_BE_BOUND);
+    // Sum of level 1 categories is equal to slots up to rounding
+    double slots = retiring + bad_spec + fe_bound + be_bound;
+    if (slots == 0.0)
+        return 0.0;
+    double v;
+    switch (metric) {
+    case TMA_FRONTEND_BOUND:
+        v = fe_bound;
+        break;
+    case TMA_BAD_SPECULATION:
+        v = bad_spec;
+        break;
+    case TMA_BACKEND_BOUND:
+        v = be_bound;
+        break;
+    case TMA_RETIRING:
+        v = retiring;
+        break;
+    case TMA_FETCH_LATENCY:
+        v = tma_value(cnt, TMA_EV_FETCH_LAT);
+        break;
+    case TMA_FETCH_BANDWIDTH:
+        v = fe_bound - tma_value(cnt, TMA_EV_FETCH_LAT);
+        break;
+    case TMA_BRANCH_MISPREDICTS:
+        v = tma_value(cnt, TMA_EV_BR_MISPREDICT);
+        break;
+    case TMA_MACHINE_CLEARS:
+        v = bad_spec - tma_value(cnt, TMA_EV_BR_MISPREDICT);
+        break;
+    case TMA_MEMORY_BOUND:
+        v = tma_value(cnt, TMA_EV_MEM_BOUND);
+        break;
+    case TMA_CORE_BOUND:
+        v = be_bound - tma_value(cnt, TMA_EV_MEM_BOUND);
+        break;
+    case TMA_HEAVY_OPERATIONS:
+        v = tma_value(cnt, TMA_EV_HEAVY_OPS);
+        break;
+    case TMA_LIGHT_OPERATIONS:
+        v = retiring - tma_value(cnt, TMA_EV_HEAVY_OPS);
+        break;
+    default:
+        ASSERT_UNREACHABLE();
     }
+    return v / slots;
+}
 
-    if (!stop_counting(events))
-        goto err_free_counters;
+static double tma_legacy(const struct perf_cnt *cnt, enum tma_metric metric)
+{
+    double total = tma_value(cnt, TMA_EV_TOTAL_SLOTS);
+    if (total == 0.0)
+        return 0.0;
+    double fe_bound = tma_value(cnt, TMA_EV_FETCH_BUBBLES) / total;
+    double bad_spec = (tma_value(cnt, TMA_EV_SLOTS_ISSUED) -
+                       tma_value(cnt, TMA_EV_SLOTS_RETIRED) +
+                       tma_value(cnt, TMA_EV_RECOVERY_BUBBLES)) /
+                      total;
+    double retiring = tma_value(cnt, TMA_EV_SLOTS_RETIRED) / total;
+    switch (metric) {
+    case TMA_FRONTEND_BOUND:
+        return fe_bound;
+    case TMA_BAD_SPECULATION:
+        return bad_spec;
+    case TMA_BACKEND_BOUND:
+        return 1.0 - fe_bound - bad_spec - retiring;
+    case TMA_RETIRING:
+        return retiring;
+    default:
+        break;
+    }
+    ASSERT_UNREACHABLE();
+}
 
-    cnt->cycles = get_counter(events, 0);
-    cnt->instructions = get_counter(events, 1);
-    cnt->branches = get_counter(events, 2);
-    cnt->missed_branches = get_counter(events, 3);
-    free_counters(events);
+bool perf_tma_metric(const struct perf_cnt *cnt, enum tma_metric metric, double *value)
+{
+    assert(g_tma_mode != TMA_NONE);
+    if (!cnt->counted[g_tma_events[0]])
+        return false;
+    // If command has not executed on a core that supports top-down events (for
+    // example, efficiency core of hybrid CPU), no slots are counted and all
+    // metrics are zero
+    double v = g_tma_mode == TMA_PERF_METRICS ? tma_perf_metrics(cnt, metric)
+                                              : tma_legacy(cnt, metric);
+    // Formulas can go slightly out of range because of counter skid
+    if (v < 0.0)
+        v = 0.0;
+    else if (v > 1.0)
+        v = 1.0;
+    *value = v * 100.0;
     return true;
-err_stop_counting:
-    stop_counting(events);
-err_free_counters:
-    free_counters(events);
-    return false;
+}
+
+struct perf_cnt_tracker {
+    struct perf_events *events;
+};
+
+struct perf_cnt_tracker *perf_cnt_attach(pid_t pid)
+{
+    struct perf_events *events =
+        open_counters(0, sb_len(g_counted_events), false, pid, false);
+    if (events == NULL)
+        return NULL;
+    struct perf_cnt_tracker *tracker = calloc(1, sizeof(*tracker));
+    tracker->events = events;
+    return tracker;
+}
+
+bool perf_cnt_detach(struct perf_cnt_tracker *tracker, struct perf_cnt *cnt)
+{
+    bool success = read_counters(tracker->events, cnt);
+    free_counters(tracker->events);
+    free(tracker);
+    return success;
 }
 
 #elif defined(__APPLE__)
@@ -769,8 +1473,58 @@ void deinit_perf(void)
     perf_lib_deinit();
 }
 
-bool perf_cnt_collect(pid_t pid, struct perf_cnt *cnt)
+size_t perf_group_count(void)
+{
+    return 1;
+}
+
+bool perf_event_fallback(const struct perf_event_spec *spec, enum meas_kind *kind)
+{
+    (void)spec;
+    (void)kind;
+    return false;
+}
+
+bool perf_events_available(void)
+{
+    return true;
+}
+
+bool perf_cnt_prepare(size_t run_idx)
+{
+    (void)run_idx;
+    return true;
+}
+
+bool perf_cnt_roi_fds(size_t run_idx, const int **fds, size_t *count)
+{
+    (void)run_idx;
+    (void)fds;
+    (void)count;
+    ASSERT_UNREACHABLE();
+}
+
+size_t perf_tma_init(void)
+{
+    return 0;
+}
+
+bool perf_tma_metric(const struct perf_cnt *cnt, enum tma_metric metric, double *value)
+{
+    (void)cnt;
+    (void)metric;
+    (void)value;
+    return false;
+}
+
+void perf_cnt_release(void)
+{
+}
+
+bool perf_cnt_collect(pid_t pid, size_t run_idx, struct perf_cnt *cnt)
 {
+    (void)run_idx;
+    memset(cnt, 0, sizeof(*cnt));
     int ret;
     // check permission
     int force_ctrs = 0;
@@ -1044,15 +1798,20 @@ bool perf_cnt_collect(pid_t pid, struct perf_cnt *cnt)
     for (size_t i = 0; i < ev_count; i++) {
         const struct event_alias *alias = profile_events + i;
         uint64_t val = data.counters_1[counter_map[i]] - data.counters_0[counter_map[i]];
+        size_t idx;
         if (strcmp(alias->alias, "cycles") == 0) {
-            cnt->cycles = val;
+            idx = PERF_CNT_CYCLES;
         } else if (strcmp(alias->alias, "instructions") == 0) {
-            cnt->instructions = val;
+            idx = PERF_CNT_INSTRUCTIONS;
         } else if (strcmp(alias->alias, "branches") == 0) {
-            cnt->branches = val;
+            idx = PERF_CNT_BRANCHES;
         } else if (strcmp(alias->alias, "branch-misses") == 0) {
-            cnt->missed_branches = val;
+            idx = PERF_CNT_BRANCH_MISSES;
+        } else {
+            continue;
         }
+        cnt->values[idx] = val;
+        cnt->counted[idx] = true;
     }
 
     return true;
@@ -1073,6 +1832,28 @@ err_free_db:
     return false;
 }
 
+bool parse_perf_event_str(const char *str, struct perf_event_spec *spec)
+{
+    (void)str;
+    (void)spec;
+    return false;
+}
+
+struct perf_cnt_tracker *perf_cnt_attach(pid_t pid)
+{
+    (void)pid;
+    error("counting performance counters of running process is not supported on this "
+          "platform");
+    return NULL;
+}
+
+bool perf_cnt_detach(struct perf_cnt_tracker *tracker, struct perf_cnt *cnt)
+{
+    (void)tracker;
+    (void)cnt;
+    ASSERT_UNREACHABLE();
+}
+
 void perf_signal_cleanup(void)
 {
     kdebug_trace_enable(0);
@@ -89,6 +89,23 @@ struct group_regr_plot {
     double regr_x_step;
 };
 
+struct group_scaling_plot {
+    const struct meas_analysis *al;
+    const struct group_analysis *grp;
+    // Measured relative capacity for each parameter value
+    double *capacity;
+    size_t nfit;
+    double highest_x;
+    double lowest_x;
+    double fit_x_step;
+};
+
+struct rss_timeline_plot {
+    const struct meas_analysis *al;
+    // Samples of the run with median mean RSS for each benchmark
+    const struct rss_sample **timelines; // [bench_count]
+};
+
 struct kde_data {
     size_t point_count;
     double min, step, max;
@@ -377,6 +394,60 @@ static void init_group_regr(const struct meas_analysis *al, size_t idx,
     plot->regr_x_step = (plot->highest_x - plot->lowest_x) / plot->nregr;
 }
 
+static void init_group_scaling(const struct meas_analysis *al, size_t idx,
+                               struct group_scaling_plot *plot)
+{
+    memset(plot, 0, sizeof(*plot));
+    const struct bench_param *param = al->base->param;
+    const struct group_analysis *grp = al->group_analyses + idx;
+    plot->al = al;
+    plot->grp = grp;
+    plot->lowest_x = INFINITY;
+    plot->highest_x = -INFINITY;
+    for (size_t i = 0; i < param->value_count; ++i) {
+        double v = grp->data[i].value_double;
+        if (v < plot->lowest_x)
+            plot->lowest_x = v;
+        if (v > plot->highest_x)
+            plot->highest_x = v;
+    }
+    plot->capacity = calloc(param->value_count, sizeof(*plot->capacity));
+    for (size_t i = 0; i < param->value_count; ++i)
+        plot->capacity[i] = grp->scaling.speedup[i] * plot->lowest_x;
+    plot->nfit = 100;
+    plot->fit_x_step = (plot->highest_x - plot->lowest_x) / plot->nfit;
+}
+
+static void free_group_scaling(struct group_scaling_plot *plot)
+{
+    free(plot->capacity);
+}
+
+static void init_rss_timeline(const struct meas_analysis *al,
+                              struct rss_timeline_plot *plot)
+{
+    const struct analysis *base = al->base;
+    plot->al = al;
+    plot->timelines = calloc(base->bench_count, sizeof(*plot->timelines));
+    foreach_bench_idx (bench_idx, al) {
+        const struct bench *bench = base->benches + bench_idx;
+        const struct distr *distr = al->benches[bench_idx];
+        size_t median_run = 0;
+        for (size_t run_idx = 0; run_idx < distr->count; ++run_idx) {
+            if (fabs(distr->data[run_idx] - distr->median) <
+                fabs(distr->data[median_run] - distr->median))
+                median_run = run_idx;
+        }
+        assert(median_run < sb_len(bench->rss_timelines));
+        plot->timelines[bench_idx] = bench->rss_timelines[median_run];
+    }
+}
+
+static void free_rss_timeline(struct rss_timeline_plot *plot)
+{
+    free(plot->timelines);
+}
+
 #define init_kde_small_plot(_distr, _meas, _plot)                                           \
     init_kde_plot_internal(_distr, _meas, true, NULL, _plot)
 #define init_kde_plot(_distr, _meas, _name, _plot)                                          \
@@ -770,6 +841,89 @@ static void make_group_regr_mpl(const struct group_regr_plot *plot,
     );
 }
 
+static void make_group_scaling_mpl(const struct group_scaling_plot *plot,
+                                   struct plot_maker_ctx *ctx)
+{
+    const struct bench_param *param = plot->al->base->param;
+    const struct group_analysis *grp = plot->grp;
+    FILE *f = ctx->f;
+    fprintf(f, "x = [");
+    for (size_t i = 0; i < param->value_count; ++i)
+        fprintf(f, "%g,", grp->data[i].value_double);
+    fprintf(f, "]\n");
+    fprintf(f, "y = [");
+    for (size_t i = 0; i < param->value_count; ++i)
+        fprintf(f, "%g,", plot->capacity[i]);
+    fprintf(f, "]\n");
+    fprintf(f, "fitx = [");
+    for (size_t i = 0; i < plot->nfit + 1; ++i)
+        fprintf(f, "%g,", plot->lowest_x + plot->fit_x_step * i);
+    fprintf(f, "]\n");
+    fprintf(f, "amdahl = [");
+    for (size_t i = 0; i < plot->nfit + 1; ++i) {
+        double x = plot->lowest_x + plot->fit_x_step * i;
+        fprintf(f, "%g,", amdahl_approx(&grp->scaling, x));
+    }
+    fprintf(f, "]\n");
+    fprintf(f, "usl = [");
+    for (size_t i = 0; i < plot->nfit + 1; ++i) {
+        double x = plot->lowest_x + plot->fit_x_step * i;
+        fprintf(f, "%g,", usl_approx(&grp->scaling, x));
+    }
+    fprintf(f, "]\n");
+    const char *color = mpl_nth_color(grp->grp_idx);
+    fprintf(f,
+            "import matplotlib as mpl\n"
+            "mpl.use('svg')\n"
+            "import matplotlib.pyplot as plt\n"
+            "plt.plot(fitx, fitx, '--', color='tab:gray', alpha=0.5, label='ideal')\n"
+            "plt.plot(x, y, '.', color='%s', label=r'%s')\n"
+            "plt.plot(fitx, amdahl, color='%s', alpha=0.3, label='Amdahl')\n"
+            "plt.plot(fitx, usl, '-.', color='%s', alpha=0.5, label='USL')\n"
+            "plt.legend(loc='best')\n"
+            "plt.xticks(x)\n"
+            "plt.grid()\n"
+            "plt.xlabel(r'%s')\n"
+            "plt.ylabel('relative capacity')\n"
+            "plt.savefig(r'%s', bbox_inches='tight')\n",
+            color, grp->group->name, //
+            color,                   //
+            color,                   //
+            param->name,             //
+            ctx->image_filename      //
+    );
+}
+
+static void make_rss_timeline_mpl(const struct rss_timeline_plot *plot,
+                                  struct plot_maker_ctx *ctx)
+{
+    const struct meas_analysis *al = plot->al;
+    FILE *f = ctx->f;
+    fprintf(f, "import matplotlib as mpl\n"
+               "mpl.use('svg')\n"
+               "import matplotlib.pyplot as plt\n");
+    foreach_bench_idx (bench_idx, al) {
+        const struct rss_sample *samples = plot->timelines[bench_idx];
+        fprintf(f, "x = [");
+        for (size_t i = 0; i < sb_len(samples); ++i)
+            fprintf(f, "%g,", samples[i].time);
+        fprintf(f, "]\n");
+        fprintf(f, "y = [");
+        for (size_t i = 0; i < sb_len(samples); ++i)
+            fprintf(f, "%g,", samples[i].rss / (1 << 20));
+        fprintf(f, "]\n");
+        fprintf(f, "plt.step(x, y, where='post', color='%s', label=r'%s')\n",
+                mpl_nth_color(bench_idx), bench_name(al->base, bench_idx));
+    }
+    fprintf(f,
+            "plt.grid()\n"
+            "plt.legend(loc='upper left')\n"
+            "plt.xlabel('time [s]')\n"
+            "plt.ylabel('RSS [MB]')\n"
+            "plt.savefig(r'%s', bbox_inches='tight')\n",
+            ctx->image_filename);
+}
+
 static void make_kde_small_plot_mpl(const struct kde_plot *plot, struct plot_maker_ctx *ctx)
 {
     assert(plot->is_small);
@@ -1186,6 +1340,25 @@ static bool group_regr_mpl(const struct meas_analysis *al, size_t idx,
     return true;
 }
 
+static bool group_scaling_mpl(const struct meas_analysis *al, size_t idx,
+                              struct plot_maker_ctx *ctx)
+{
+    struct group_scaling_plot plot;
+    init_group_scaling(al, idx, &plot);
+    make_group_scaling_mpl(&plot, ctx);
+    free_group_scaling(&plot);
+    return true;
+}
+
+static bool rss_timeline_mpl(const struct meas_analysis *al, struct plot_maker_ctx *ctx)
+{
+    struct rss_timeline_plot plot;
+    init_rss_timeline(al, &plot);
+    make_rss_timeline_mpl(&plot, ctx);
+    free_rss_timeline(&plot);
+    return true;
+}
+
 static bool kde_small_mpl(const struct distr *distr, const struct meas *meas,
                           struct plot_maker_ctx *ctx)
 {
@@ -1463,6 +1636,101 @@ static bool make_group_regr_gnuplot(const struct group_regr_plot *plot,
     return true;
 }
 
+static bool make_group_scaling_gnuplot(const struct group_scaling_plot *plot,
+                                       struct plot_maker_ctx *ctx)
+{
+    const struct bench_param *param = plot->al->base->param;
+    const struct group_analysis *grp = plot->grp;
+    FILE *f = ctx->f;
+    const char *dat1_name = NULL, *dat2_name = NULL;
+    {
+        FILE *dat1 = gnuplot_data_file(ctx, &dat1_name);
+        if (dat1 == NULL)
+            return false;
+        for (size_t val_idx = 0; val_idx < param->value_count; ++val_idx)
+            fprintf(dat1, "%g\t%g\n", grp->data[val_idx].value_double,
+                    plot->capacity[val_idx]);
+        fclose(dat1);
+    }
+    {
+        FILE *dat2 = gnuplot_data_file(ctx, &dat2_name);
+        if (dat2 == NULL)
+            return false;
+        for (size_t i = 0; i < plot->nfit + 1; ++i) {
+            double x = plot->lowest_x + plot->fit_x_step * i;
+            fprintf(dat2, "%g\t%g\t%g\n", x, amdahl_approx(&grp->scaling, x),
+                    usl_approx(&grp->scaling, x));
+        }
+        fclose(dat2);
+    }
+    fprintf(f, "set xtics (");
+    for (size_t i = 0; i < param->value_count; ++i) {
+        fprintf(f, "%s", param->values[i]);
+        if (i != param->value_count - 1)
+            fprintf(f, ", ");
+    }
+    fprintf(f, ")\n");
+    define_gnuplot_linetypes(0.5, f);
+    fprintf(f,
+            "set term svg enhanced background rgb 'white'\n"
+            "set output '%s'\n"
+            "set xlabel '%s'\n"
+            "set ylabel 'relative capacity'\n"
+            "set grid\n"
+            "set key left top\n"
+            "plot '%s' using 1:1 with lines dt 2 ls 8 title 'ideal', \\\n"
+            "\t'%s' using 1:2 with points ls 1 title '%s', \\\n"
+            "\t'%s' using 1:2 with lines ls 2 title 'Amdahl', \\\n"
+            "\t'%s' using 1:3 with lines ls 3 title 'USL'\n",
+            ctx->image_filename,         //
+            param->name,                 //
+            dat2_name,                   //
+            dat1_name, grp->group->name, //
+            dat2_name,                   //
+            dat2_name                    //
+    );
+    return true;
+}
+
+static bool make_rss_timeline_gnuplot(const struct rss_timeline_plot *plot,
+                                      struct plot_maker_ctx *ctx)
+{
+    const struct meas_analysis *al = plot->al;
+    FILE *f = ctx->f;
+    const char **dat_names = calloc(al->base->bench_count, sizeof(*dat_names));
+    foreach_bench_idx (bench_idx, al) {
+        FILE *dat = gnuplot_data_file(ctx, dat_names + bench_idx);
+        if (dat == NULL) {
+            free(dat_names);
+            return false;
+        }
+        const struct rss_sample *samples = plot->timelines[bench_idx];
+        for (size_t i = 0; i < sb_len(samples); ++i)
+            fprintf(dat, "%g\t%g\n", samples[i].time, samples[i].rss / (1 << 20));
+        fclose(dat);
+    }
+    define_gnuplot_linetypes(0.5, f);
+    fprintf(f,
+            "set term svg enhanced background rgb 'white'\n"
+            "set output '%s'\n"
+            "set xlabel 'time [s]'\n"
+            "set ylabel 'RSS [MB]'\n"
+            "set grid\n"
+            "set key left top\n"
+            "set yrange [0:*]\n"
+            "plot ",
+            ctx->image_filename);
+    size_t i = 0;
+    foreach_bench_idx (bench_idx, al) {
+        fprintf(f, "%s'%s' using 1:2 with steps ls %zu title '%s'",
+                i++ != 0 ? ", \\\n\t" : "", dat_names[bench_idx], bench_idx % 10 + 1,
+                bench_name(al->base, bench_idx));
+    }
+    fprintf(f, "\n");
+    free(dat_names);
+    return true;
+}
+
 static bool make_kde_small_plot_gnuplot(const struct kde_plot *plot,
                                         struct plot_maker_ctx *ctx)
 {
@@ -1883,6 +2151,25 @@ static bool group_regr_gnuplot(const struct meas_analysis *al, size_t idx,
     return make_group_regr_gnuplot(&plot, ctx);
 }
 
+static bool group_scaling_gnuplot(const struct meas_analysis *al, size_t idx,
+                                  struct plot_maker_ctx *ctx)
+{
+    struct group_scaling_plot plot;
+    init_group_scaling(al, idx, &plot);
+    bool success = make_group_scaling_gnuplot(&plot, ctx);
+    free_group_scaling(&plot);
+    return success;
+}
+
+static bool rss_timeline_gnuplot(const struct meas_analysis *al, struct plot_maker_ctx *ctx)
+{
+    struct rss_timeline_plot plot;
+    init_rss_timeline(al, &plot);
+    bool success = make_rss_timeline_gnuplot(&plot, ctx);
+    free_rss_timeline(&plot);
+    return success;
+}
+
 static bool kde_small_gnuplot(const struct distr *distr, const struct meas *meas,
                               struct plot_maker_ctx *ctx)
 {
@@ -2029,6 +2316,7 @@ void init_plot_maker(enum plot_backend backend, struct plot_maker *maker)
         maker->bar = bar_mpl;
         maker->group_bar = group_bar_mpl;
         maker->group_regr = group_regr_mpl;
+        maker->group_scaling = group_scaling_mpl;
         maker->kde_small = kde_small_mpl;
         maker->kde = kde_mpl;
         maker->kde_cmp_small = kde_cmp_small_mpl;
@@ -2036,12 +2324,14 @@ void init_plot_maker(enum plot_backend backend, struct plot_maker *maker)
         maker->kde_cmp_group = kde_cmp_group_mpl;
         maker->kde_cmp_per_val_small = kde_cmp_per_val_small_mpl;
         maker->kde_cmp_per_val = kde_cmp_per_val_mpl;
+        maker->rss_timeline = rss_timeline_mpl;
         break;
     case PLOT_BACKEND_GNUPLOT:
         maker->src_extension = "gp";
         maker->bar = bar_gnuplot;
         maker->group_bar = group_bar_gnuplot;
         maker->group_regr = group_regr_gnuplot;
+        maker->group_scaling = group_scaling_gnuplot;
         maker->kde_small = kde_small_gnuplot;
         maker->kde = kde_gnuplot;
         maker->kde_cmp_small = kde_cmp_small_gnuplot;
@@ -2049,6 +2339,7 @@ void init_plot_maker(enum plot_backend backend, struct plot_maker *maker)
         maker->kde_cmp_group = kde_cmp_group_gnuplot;
         maker->kde_cmp_per_val_small = kde_cmp_per_val_small_gnuplot;
         maker->kde_cmp_per_val = kde_cmp_per_val_gnuplot;
+        maker->rss_timeline = rss_timeline_gnuplot;
         break;
     case PLOT_BACKEND_DEFAULT:
         ASSERT_UNREACHABLE();
@@ -0,0 +1,241 @@
+// csbench
+// command-line benchmarking tool
+// Ilya Vinogradov 2024
+// https://github.com/Holodome/csbench
+//
+// csbench is dual-licensed under the terms of the MIT License and the Apache
+// License 2.0. This file may not be copied, modified, or distributed except
+// according to those terms.
+//
+// MIT License Notice
+//
+//    MIT License
+//
+//    Copyright (c) 2024-2026 Ilya Vinogradov
+//
+//    Permission is hereby granted, free of charge, to any
+//    person obtaining a copy of this software and associated
+//    documentation files (the "Software"), to deal in the
+//    Software without restriction, including without
+//    limitation the rights to use, copy, modify, merge,
+//    publish, distribute, sublicense, and/or sell copies of
+//    the Software, and to permit persons to whom the Software
+//    is furnished to do so, subject to the following
+//    conditions:
+//
+//    The above copyright notice and this permission notice
+//    shall be included in all copies or substantial portions
+//    of the Software.
+//
+//    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF
+//    ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED
+//    TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+//    PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT
+//    SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+//    CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+//    OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR
+//    IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+//    DEALINGS IN THE SOFTWARE.
+//
+// Apache License (Version 2.0) Notice
+//
+//    Copyright 2024 Ilya Vinogradov
+//    Licensed under the Apache License, Version 2.0 (the "License");
+//    you may not use this file except in compliance with the License.
+//    You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+//    Unless required by applicable law or agreed to in writing, software
+//    distributed under the License is distributed on an "AS IS" BASIS,
+//    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//    See the License for the specific language governing permissions and
+//    limitations under the License.
+#ifndef CSBENCH_PROBE_H
+#define CSBENCH_PROBE_H
+
+// Header-only API for reporting measurements from benchmarked programs to
+// csbench without parsing their output. Values are written to shared memory
+// that csbench maps for each run, and become measurements added with --probe
+// and --probe-x options:
+//
+//     #include "csbench_probe.h"
+//
+//     double start = csbench_probe_now();
+//     parse(input);
+//     csbench_probe_end("parse", start);       // adds elapsed seconds
+//     csbench_probe_add("tokens", token_count); // adds to counter
+//     csbench_probe_set("ratio", ratio);        // overwrites value
+//
+// Values of the same name are summed within a run, unless set with
+// 'csbench_probe_set', in which case the last one is used. When program is not
+// run by csbench, all functions do nothing. Functions are thread-safe and can
+// be used by child processes of the command too. POSIX functions clock_gettime
+// and mmap are used, so in strict ISO C mode _POSIX_C_SOURCE must be defined.
+//
+// With --perf-roi performance counters only count between
+// 'csbench_probe_roi_begin' and 'csbench_probe_roi_end' calls, so that
+// startup and teardown of the program are excluded:
+//
+//     csbench_probe_roi_begin();
+//     kernel();
+//     csbench_probe_roi_end();
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#endif
+
+#define CSBENCH_PROBE_ENV "CSBENCH_PROBE_FD"
+// Comma-separated list of performance counter descriptors used with --perf-roi
+#define CSBENCH_PROBE_PERF_ENV "CSBENCH_PERF_FDS"
+#define CSBENCH_PROBE_MAX_PERF_FDS 128
+#define CSBENCH_PROBE_MAGIC 0x70627363u
+// Maximum length of name, including null terminator
+#define CSBENCH_PROBE_NAME_LEN 48
+
+enum csbench_probe_op {
+    CSBENCH_PROBE_ADD,
+    CSBENCH_PROBE_SET,
+};
+
+struct csbench_probe_record {
+    char name[CSBENCH_PROBE_NAME_LEN];
+    uint32_t op;
+    // Set after other fields are written
+    uint32_t ready;
+    double value;
+};
+
+// Shared memory consists of this header followed by 'capacity' records.
+// Records that do not fit are dropped, but still counted in 'count'.
+struct csbench_probe_shm {
+    uint32_t magic;
+    uint32_t record_size;
+    uint64_t capacity;
+    uint64_t count;
+};
+
+static inline struct csbench_probe_shm *csbench_probe_shm(void)
+{
+    // 1 is used as a marker of absent shared memory
+    static struct csbench_probe_shm *shm = NULL;
+    struct csbench_probe_shm *cur = __atomic_load_n(&shm, __ATOMIC_ACQUIRE);
+    if (cur != NULL)
+        return cur == (struct csbench_probe_shm *)1 ? NULL : cur;
+    cur = (struct csbench_probe_shm *)1;
+    const char *fd_str = getenv(CSBENCH_PROBE_ENV);
+    if (fd_str != NULL) {
+        char *size_str = NULL;
+        long fd = strtol(fd_str, &size_str, 10);
+        // Variable has format <fd>:<size>
+        size_t size = *size_str == ':' ? (size_t)strtoull(size_str + 1, NULL, 10) : 0;
+        void *map = MAP_FAILED;
+        if (size >= sizeof(struct csbench_probe_shm))
+            map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, (int)fd, 0);
+        if (map != MAP_FAILED) {
+            struct csbench_probe_shm *mapped = (struct csbench_probe_shm *)map;
+            if (mapped->magic == CSBENCH_PROBE_MAGIC &&
+                mapped->record_size == sizeof(struct csbench_probe_record))
+                cur = mapped;
+            else
+                munmap(map, size);
+        }
+    }
+    struct csbench_probe_shm *expected = NULL;
+    if (!__atomic_compare_exchange_n(&shm, &expected, cur, 0, __ATOMIC_ACQ_REL,
+                                     __ATOMIC_ACQUIRE)) {
+        // Another thread has mapped memory first
+        if (cur != (struct csbench_probe_shm *)1)
+            munmap(cur, sizeof(*cur) + cur->capacity * sizeof(struct csbench_probe_record));
+        cur = expected;
+    }
+    return cur == (struct csbench_probe_shm *)1 ? NULL : cur;
+}
+
+static inline void csbench_probe_record(const char *name, enum csbench_probe_op op,
+                                        double value)
+{
+    struct csbench_probe_shm *shm = csbench_probe_shm();
+    if (shm == NULL)
+        return;
+    uint64_t idx = __atomic_fetch_add(&shm->count, 1, __ATOMIC_RELAXED);
+    if (idx >= shm->capacity)
+        return;
+    struct csbench_probe_record *record = (struct csbench_probe_record *)(shm + 1) + idx;
+    strncpy(record->name, name, CSBENCH_PROBE_NAME_LEN - 1);
+    record->op = op;
+    record->value = value;
+    __atomic_store_n(&record->ready, 1, __ATOMIC_RELEASE);
+}
+
+static inline void csbench_probe_add(const char *name, double value)
+{
+    csbench_probe_record(name, CSBENCH_PROBE_ADD, value);
+}
+
+static inline void csbench_probe_set(const char *name, double value)
+{
+    csbench_probe_record(name, CSBENCH_PROBE_SET, value);
+}
+
+// Monotonic time in seconds
+static inline double csbench_probe_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Add time elapsed since 'start', which was returned by 'csbench_probe_now'
+static inline void csbench_probe_end(const char *name, double start)
+{
+    csbench_probe_add(name, csbench_probe_now() - start);
+}
+
+// Counters are inherited from csbench, and enabling or disabling them through
+// descriptor of csbench counter applies to their copies in this process too.
+// Descriptors are parsed before the first call, so that parsing is not counted.
+static inline void csbench_probe_roi_ioctl(int enable)
+{
+#ifdef __linux__
+    static int fds[CSBENCH_PROBE_MAX_PERF_FDS];
+    static int fd_count = -1;
+    int count = __atomic_load_n(&fd_count, __ATOMIC_ACQUIRE);
+    if (count == -1) {
+        count = 0;
+        const char *str = getenv(CSBENCH_PROBE_PERF_ENV);
+        while (str != NULL && *str && count < CSBENCH_PROBE_MAX_PERF_FDS) {
+            char *end;
+            long fd = strtol(str, &end, 10);
+            if (end == str)
+                break;
+            fds[count++] = (int)fd;
+            str = *end == ',' ? end + 1 : end;
+        }
+        __atomic_store_n(&fd_count, count, __ATOMIC_RELEASE);
+    }
+    unsigned long request = enable ? PERF_EVENT_IOC_ENABLE : PERF_EVENT_IOC_DISABLE;
+    for (int i = 0; i < count; ++i)
+        ioctl(fds[i], request, 0);
+#else
+    (void)enable;
+#endif
+}
+
+static inline void csbench_probe_roi_begin(void)
+{
+    csbench_probe_roi_ioctl(1);
+}
+
+static inline void csbench_probe_roi_end(void)
+{
+    csbench_probe_roi_ioctl(0);
+}
+
+#endif // CSBENCH_PROBE_H
@@ -0,0 +1,1375 @@
+// csbench
+// command-line benchmarking tool
+// Ilya Vinogradov 2024
+// https://github.com/Holodome/csbench
+//
+// csbench is dual-licensed under the terms of the MIT License and the Apache
+// License 2.0. This file may not be copied, modified, or distributed except
+// according to those terms.
+//
+// MIT License Notice
+//
+//    MIT License
+//
+//    Copyright (c) 2024-2026 Ilya Vinogradov
+//
+//    Permission is hereby granted, free of charge, to any
+//    person obtaining a copy of this software and associated
+//    documentation files (the "Software"), to deal in the
+//    Software without restriction, including without
+//    limitation the rights to use, copy, modify, merge,
+//    publish, distribute, sublicense, and/or sell copies of
+//    the Software, and to permit persons to whom the Software
+//    is furnished to do so, subject to the following
+//    conditions:
+//
+//    The above copyright notice and this permission notice
+//    shall be included in all copies or substantial portions
+//    of the Software.
+//
+//    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF
+//    ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED
+//    TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+//    PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT
+//    SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+//    CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+//    OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR
+//    IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+//    DEALINGS IN THE SOFTWARE.
+//
+// Apache License (Version 2.0) Notice
+//
+//    Copyright 2024 Ilya Vinogradov
+//    Licensed under the Apache License, Version 2.0 (the "License");
+//    you may not use this file except in compliance with the License.
+//    You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+//    Unless required by applicable law or agreed to in writing, software
+//    distributed under the License is distributed on an "AS IS" BASIS,
+//    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//    See the License for the specific language governing permissions and
+//    limitations under the License.
+#include "csbench.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+//
+// Flame graphs
+//
+
+#define FLAME_WIDTH 1200
+#define FLAME_PAD 10
+#define FLAME_TITLE_HEIGHT 40
+#define FLAME_FRAME_HEIGHT 16
+#define FLAME_FONT_SIZE 12
+// Approximate width of a character, used to truncate frame labels
+#define FLAME_CHAR_WIDTH 7
+// Frames narrower than this are not drawn
+#define FLAME_MIN_WIDTH 0.1
+
+// Call tree built from folded stacks. Node 0 is the root that contains all
+// samples.
+struct flame_node {
+    // Points into folded stack string, not null-terminated
+    const char *name;
+    size_t name_len;
+    // Samples of this frame and all its callees
+    size_t count;
+    size_t *children; // sb
+};
+
+struct flame_tree {
+    struct flame_node *nodes; // sb
+    size_t depth;
+};
+
+static size_t flame_find_child(const struct flame_tree *tree, size_t node_idx,
+                               const char *name, size_t name_len)
+{
+    const struct flame_node *node = tree->nodes + node_idx;
+    for (size_t i = 0; i < sb_len(node->children); ++i) {
+        const struct flame_node *child = tree->nodes + node->children[i];
+        if (child->name_len == name_len && memcmp(child->name, name, name_len) == 0)
+            return node->children[i];
+    }
+    return SIZE_MAX;
+}
+
+static void init_flame_tree(const struct profile_stack *profile, struct flame_tree *tree)
+{
+    memset(tree, 0, sizeof(*tree));
+    struct flame_node *root = sb_new(tree->nodes);
+    memset(root, 0, sizeof(*root));
+    root->name = "all";
+    root->name_len = 3;
+    for (size_t i = 0; i < sb_len(profile); ++i) {
+        const struct profile_stack *stack = profile + i;
+        tree->nodes[0].count += stack->count;
+        size_t node_idx = 0, depth = 0;
+        for (const char *cursor = stack->stack; *cursor;) {
+            const char *end = strchr(cursor, ';');
+            if (end == NULL)
+                end = cursor + strlen(cursor);
+            size_t len = end - cursor;
+            size_t child_idx = flame_find_child(tree, node_idx, cursor, len);
+            if (child_idx == SIZE_MAX) {
+                child_idx = sb_len(tree->nodes);
+                struct flame_node *child = sb_new(tree->nodes);
+                memset(child, 0, sizeof(*child));
+                child->name = cursor;
+                child->name_len = len;
+                sb_push(tree->nodes[node_idx].children, child_idx);
+            }
+            tree->nodes[child_idx].count += stack->count;
+            node_idx = child_idx;
+            ++depth;
+            cursor = *end ? end + 1 : end;
+        }
+        if (depth > tree->depth)
+            tree->depth = depth;
+    }
+}
+
+static void free_flame_tree(struct flame_tree *tree)
+{
+    for (size_t i = 0; i < sb_len(tree->nodes); ++i)
+        sb_free(tree->nodes[i].children);
+    sb_free(tree->nodes);
+}
+
+static void svg_escape(const char *str, size_t len, FILE *f)
+{
+    for (size_t i = 0; i < len; ++i) {
+        switch (str[i]) {
+        case '<':
+            fprintf(f, "&lt;");
+            break;
+        case '>':
+            fprintf(f, "&gt;");
+            break;
+        case '&':
+            fprintf(f, "&amp;");
+            break;
+        case '"':
+            fprintf(f, "&quot;");
+            break;
+        default:
+            fputc(str[i], f);
+        }
+    }
+}
+
+// Share of samples of a frame in whole profile
+static double flame_share(const struct flame_tree *tree, size_t node_idx)
+{
+    if (node_idx == SIZE_MAX || tree->nodes[0].count == 0)
+        return 0.0;
+    return (double)tree->nodes[node_idx].count / tree->nodes[0].count;
+}
+
+// Largest change of frame share compared to base profile, used to normalize
+// colors of differential flame graph
+static double flame_max_delta(const struct flame_tree *tree, size_t node_idx,
+                              const struct flame_tree *base, size_t base_idx)
+{
+    double result = fabs(flame_share(tree, node_idx) - flame_share(base, base_idx));
+    const struct flame_node *node = tree->nodes + node_idx;
+    for (size_t i = 0; i < sb_len(node->children); ++i) {
+        const struct flame_node *child = tree->nodes + node->children[i];
+        size_t base_child_idx = SIZE_MAX;
+        if (base_idx != SIZE_MAX)
+            base_child_idx = flame_find_child(base, base_idx, child->name, child->name_len);
+        double delta = flame_max_delta(tree, node->children[i], base, base_child_idx);
+        if (delta > result)
+            result = delta;
+    }
+    return result;
+}
+
+struct flame_graph {
+    const struct flame_tree *tree;
+    // Set for differential flame graph
+    const struct flame_tree *base;
+    double max_delta;
+    double height;
+    const char *units;
+    FILE *f;
+};
+
+// Classic flame graph palette, color only depends on frame name so that the
+// same function has the same color in all graphs
+static void flame_color(const char *name, size_t name_len, int rgb[3])
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < name_len; ++i) {
+        hash ^= (unsigned char)name[i];
+        hash *= 16777619u;
+    }
+    rgb[0] = 205 + (hash & 0xff) * 50 / 255;
+    rgb[1] = ((hash >> 8) & 0xff) * 230 / 255;
+    rgb[2] = ((hash >> 16) & 0xff) * 55 / 255;
+}
+
+// Red frames take larger share of samples than in base profile, blue frames
+// take less
+static void flame_diff_color(double delta, double max_delta, int rgb[3])
+{
+    double t = max_delta != 0.0 ? fabs(delta) / max_delta : 0.0;
+    int fade = 255 - (int)(200 * t);
+    if (delta > 0) {
+        rgb[0] = 255;
+        rgb[1] = rgb[2] = fade;
+    } else {
+        rgb[0] = rgb[1] = fade;
+        rgb[2] = 255;
+    }
+}
+
+static void flame_draw(const struct flame_graph *graph, size_t node_idx, size_t base_idx,
+                       double x, size_t depth)
+{
+    const struct flame_tree *tree = graph->tree;
+    const struct flame_node *node = tree->nodes + node_idx;
+    double scale = (double)(FLAME_WIDTH - 2 * FLAME_PAD) / tree->nodes[0].count;
+    double width = node->count * scale;
+    if (width < FLAME_MIN_WIDTH)
+        return;
+    double y = graph->height - FLAME_PAD - (depth + 1) * FLAME_FRAME_HEIGHT;
+    double share = flame_share(tree, node_idx);
+    int rgb[3];
+    FILE *f = graph->f;
+    fprintf(f, "<g><title>");
+    svg_escape(node->name, node->name_len, f);
+    fprintf(f, " (%zu %s, %.2f%%", node->count, graph->units, share * 100.0);
+    if (graph->base) {
+        double delta = share - flame_share(graph->base, base_idx);
+        fprintf(f, ", %+.2f%%", delta * 100.0);
+        flame_diff_color(delta, graph->max_delta, rgb);
+    } else {
+        flame_color(node->name, node->name_len, rgb);
+    }
+    fprintf(f,
+            ")</title>"
+            "<rect x=\"%.1f\" y=\"%.1f\" width=\"%.1f\" height=\"%d\" "
+            "fill=\"rgb(%d,%d,%d)\" rx=\"2\" ry=\"2\"/>",
+            x, y, width, FLAME_FRAME_HEIGHT - 1, rgb[0], rgb[1], rgb[2]);
+    size_t max_chars = (size_t)((width - 6) / FLAME_CHAR_WIDTH);
+    if (max_chars >= 3) {
+        fprintf(f, "<text x=\"%.1f\" y=\"%.1f\">", x + 3, y + FLAME_FRAME_HEIGHT - 4);
+        if (node->name_len <= max_chars) {
+            svg_escape(node->name, node->name_len, f);
+        } else {
+            svg_escape(node->name, max_chars - 2, f);
+            fprintf(f, "..");
+        }
+        fprintf(f, "</text>");
+    }
+    fprintf(f, "</g>\n");
+
+    for (size_t i = 0; i < sb_len(node->children); ++i) {
+        const struct flame_node *child = tree->nodes + node->children[i];
+        size_t base_child_idx = SIZE_MAX;
+        if (graph->base && base_idx != SIZE_MAX)
+            base_child_idx =
+                flame_find_child(graph->base, base_idx, child->name, child->name_len);
+        flame_draw(graph, node->children[i], base_child_idx, x, depth + 1);
+        x += child->count * scale;
+    }
+}
+
+bool write_flamegraph(const struct profile_stack *profile, const struct profile_stack *base,
+                      const char *title, const char *units, FILE *f)
+{
+    struct flame_tree tree, base_tree;
+    init_flame_tree(profile, &tree);
+    if (base)
+        init_flame_tree(base, &base_tree);
+
+    struct flame_graph graph = {0};
+    graph.tree = &tree;
+    graph.f = f;
+    graph.units = units;
+    graph.height = FLAME_TITLE_HEIGHT + (tree.depth + 1) * FLAME_FRAME_HEIGHT + FLAME_PAD;
+    if (base) {
+        graph.base = &base_tree;
+        graph.max_delta = flame_max_delta(&tree, 0, &base_tree, 0);
+    }
+    fprintf(f,
+            "<svg version=\"1.1\" width=\"%d\" height=\"%.0f\" viewBox=\"0 0 %d %.0f\" "
+            "xmlns=\"http://www.w3.org/2000/svg\">\n"
+            "<rect x=\"0\" y=\"0\" width=\"100%%\" height=\"100%%\" fill=\"#f8f8f8\"/>\n"
+            "<text x=\"%d\" y=\"24\" text-anchor=\"middle\" font-size=\"17\" "
+            "font-family=\"Verdana\">",
+            FLAME_WIDTH, graph.height, FLAME_WIDTH, graph.height, FLAME_WIDTH / 2);
+    svg_escape(title, strlen(title), f);
+    fprintf(f, "</text>\n<g font-size=\"%d\" font-family=\"Verdana\" fill=\"#000\">\n",
+            FLAME_FONT_SIZE);
+    if (tree.nodes[0].count != 0)
+        flame_draw(&graph, 0, base ? 0 : SIZE_MAX, FLAME_PAD, 0);
+    fprintf(f, "</g>\n</svg>\n");
+
+    free_flame_tree(&tree);
+    if (base)
+        free_flame_tree(&base_tree);
+    return true;
+}
+
+void free_profile(struct profile_stack *profile)
+{
+    for (size_t i = 0; i < sb_len(profile); ++i)
+        free(profile[i].stack);
+    sb_free(profile);
+}
+
+#ifdef __linux__
+
+#include <elf.h>
+#include <fcntl.h>
+#include <linux/perf_event.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Sampling frequency in samples per second of CPU time
+#define PROFILE_FREQ 999
+// Number of data pages in ring buffer of each CPU, must be a power of two
+#define PROFILE_MMAP_PAGES 64
+#define PROFILE_STACK_BUF 8192
+
+struct elf_symbol {
+    uint64_t addr;
+    uint64_t size;
+    // Offset in 'strtab'
+    uint32_t name;
+};
+
+struct elf_segment {
+    uint64_t offset;
+    uint64_t vaddr;
+    uint64_t size;
+};
+
+// Executable or shared library mapped by profiled processes. Symbol table is
+// loaded once per file and kept for all profiled runs.
+struct elf_file {
+    char *path;
+    const char *basename;
+    struct elf_segment *segments; // sb
+    struct elf_symbol *symbols;   // sb, sorted by address
+    char *strtab;
+};
+
+struct profile_map {
+    uint64_t start;
+    uint64_t end;
+    uint64_t pgoff;
+    struct elf_file *file;
+};
+
+struct profile_proc {
+    pid_t pid;
+    char comm[16];
+    struct profile_map *maps; // sb
+};
+
+// Record copied from ring buffer
+struct profile_record {
+    uint64_t time;
+    size_t offset;
+};
+
+struct profiler {
+    size_t page_size;
+    size_t event_count;
+    struct pollfd *fds;   // [event_count]
+    void **buffers;       // [event_count]
+    int uninherited_fd;
+    // Records of current run. Ring buffers of different CPUs are not ordered
+    // relative to each other, so records are sorted by time and processed when
+    // process exits.
+    char *records;                  // sb
+    struct profile_record *indexes; // sb
+    struct profile_proc *procs;     // sb
+    struct elf_file **files;        // sb
+    // Open addressing hash table of folded stacks
+    struct profile_stack *stacks; // [stack_capacity]
+    size_t stack_capacity;
+    size_t stack_count;
+    uint64_t lost;
+    // Set for tracer opened with 'off_cpu_profiler_open'. Counts of its stacks
+    // are microseconds spent off CPU instead of samples.
+    bool off_cpu;
+    struct off_cpu_thread *threads; // sb
+    // Nanoseconds spent off CPU since last call to 'profiler_off_cpu_times'
+    uint64_t off_cpu_ns[OFF_CPU_REASON_COUNT];
+};
+
+// Thread of traced command that has been switched out and is waiting to be
+// switched back in
+struct off_cpu_thread {
+    pid_t tid;
+    uint64_t time;
+    enum off_cpu_reason reason;
+    char *stack;
+};
+
+// Kernel function symbols from /proc/kallsyms and layout of raw data of
+// sched:sched_switch tracepoint, loaded in 'off_cpu_init'
+static struct elf_file g_kernel_file;
+static uint64_t g_sched_switch_id;
+static size_t g_prev_state_offset;
+static size_t g_prev_state_size;
+
+static int elf_symbol_cmp(const void *a, const void *b)
+{
+    const struct elf_symbol *as = a;
+    const struct elf_symbol *bs = b;
+    if (as->addr < bs->addr)
+        return -1;
+    if (as->addr > bs->addr)
+        return 1;
+    return 0;
+}
+
+// Load program headers and function symbols of ELF file. Symbols are taken
+// from '.symtab' if file is not stripped, and from '.dynsym' otherwise. If
+// file can't be parsed, frames in it are named after the file.
+static void load_elf_file(struct elf_file *file)
+{
+    int fd = open(file->path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return;
+    struct stat st;
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(Elf64_Ehdr)) {
+        close(fd);
+        return;
+    }
+    size_t size = st.st_size;
+    void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return;
+
+    const char *data = map;
+    const Elf64_Ehdr *ehdr = map;
+    if (memcmp(ehdr->e_ident, ELFMAG, SELFMAG) != 0 ||
+        ehdr->e_ident[EI_CLASS] != ELFCLASS64 ||
+        ehdr->e_phoff + (uint64_t)ehdr->e_phnum * sizeof(Elf64_Phdr) > size ||
+        ehdr->e_shoff + (uint64_t)ehdr->e_shnum * sizeof(Elf64_Shdr) > size)
+        goto out;
+
+    const Elf64_Phdr *phdrs = (const Elf64_Phdr *)(data + ehdr->e_phoff);
+    for (size_t i = 0; i < ehdr->e_phnum; ++i) {
+        if (phdrs[i].p_type != PT_LOAD)
+            continue;
+        struct elf_segment segment = {phdrs[i].p_offset, phdrs[i].p_vaddr,
+                                      phdrs[i].p_filesz};
+        sb_push(file->segments, segment);
+    }
+
+    const Elf64_Shdr *shdrs = (const Elf64_Shdr *)(data + ehdr->e_shoff);
+    const Elf64_Shdr *symtab = NULL;
+    for (size_t i = 0; i < ehdr->e_shnum; ++i) {
+        if (shdrs[i].sh_type == SHT_SYMTAB ||
+            (shdrs[i].sh_type == SHT_DYNSYM && symtab == NULL))
+            symtab = shdrs + i;
+    }
+    if (symtab == NULL || symtab->sh_link >= ehdr->e_shnum)
+        goto out;
+    const Elf64_Shdr *strtab = shdrs + symtab->sh_link;
+    if (symtab->sh_offset + symtab->sh_size > size ||
+        strtab->sh_offset + strtab->sh_size > size || strtab->sh_size == 0)
+        goto out;
+
+    file->strtab = malloc(strtab->sh_size);
+    memcpy(file->strtab, data + strtab->sh_offset, strtab->sh_size);
+    file->strtab[strtab->sh_size - 1] = '\0';
+    const Elf64_Sym *syms = (const Elf64_Sym *)(data + symtab->sh_offset);
+    size_t sym_count = symtab->sh_size / sizeof(Elf64_Sym);
+    for (size_t i = 0; i < sym_count; ++i) {
+        const Elf64_Sym *sym = syms + i;
+        int type = ELF64_ST_TYPE(sym->st_info);
+        if ((type != STT_FUNC && type != STT_GNU_IFUNC) || sym->st_shndx == SHN_UNDEF ||
+            sym->st_value == 0 || sym->st_name >= strtab->sh_size)
+            continue;
+        struct elf_symbol symbol = {sym->st_value, sym->st_size, sym->st_name};
+        sb_push(file->symbols, symbol);
+    }
+    if (file->symbols != NULL)
+        qsort(file->symbols, sb_len(file->symbols), sizeof(*file->symbols),
+              elf_symbol_cmp);
+out:
+    munmap(map, size);
+}
+
+static struct elf_file *get_elf_file(struct profiler *profiler, const char *path)
+{
+    for (size_t i = 0; i < sb_len(profiler->files); ++i) {
+        if (strcmp(profiler->files[i]->path, path) == 0)
+            return profiler->files[i];
+    }
+    struct elf_file *file = calloc(1, sizeof(*file));
+    file->path = strdup(path);
+    const char *slash = strrchr(file->path, '/');
+    file->basename = slash ? slash + 1 : file->path;
+    // Special mappings like [vdso] have no backing file
+    if (path[0] == '/')
+        load_elf_file(file);
+    sb_push(profiler->files, file);
+    return file;
+}
+
+static void free_elf_file(struct elf_file *file)
+{
+    free(file->path);
+    sb_free(file->segments);
+    sb_free(file->symbols);
+    free(file->strtab);
+    free(file);
+}
+
+// Returns symbol name, or NULL if address does not belong to any function
+static const char *elf_file_symbol(const struct elf_file *file, uint64_t offset)
+{
+    uint64_t addr = 0;
+    bool found = false;
+    for (size_t i = 0; i < sb_len(file->segments); ++i) {
+        const struct elf_segment *segment = file->segments + i;
+        if (offset >= segment->offset && offset < segment->offset + segment->size) {
+            addr = offset - segment->offset + segment->vaddr;
+            found = true;
+            break;
+        }
+    }
+    if (!found || file->symbols == NULL)
+        return NULL;
+    // Last symbol that starts at or before address
+    size_t lo = 0, hi = sb_len(file->symbols);
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (file->symbols[mid].addr <= addr)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo == 0)
+        return NULL;
+    const struct elf_symbol *symbol = file->symbols + lo - 1;
+    if (symbol->size != 0 && addr >= symbol->addr + symbol->size)
+        return NULL;
+    return file->strtab + symbol->name;
+}
+
+static struct profile_proc *get_proc(struct profiler *profiler, pid_t pid)
+{
+    for (size_t i = 0; i < sb_len(profiler->procs); ++i) {
+        if (profiler->procs[i].pid == pid)
+            return profiler->procs + i;
+    }
+    struct profile_proc *proc = sb_new(profiler->procs);
+    memset(proc, 0, sizeof(*proc));
+    proc->pid = pid;
+    return proc;
+}
+
+static void free_procs(struct profiler *profiler)
+{
+    for (size_t i = 0; i < sb_len(profiler->procs); ++i)
+        sb_free(profiler->procs[i].maps);
+    sb_free(profiler->procs);
+    profiler->procs = NULL;
+}
+
+static void write_frame(const struct profile_proc *proc, uint64_t ip,
+                        struct string_writer *writer)
+{
+    // Search from the end, so that newer mappings take precedence
+    for (size_t i = sb_len(proc->maps); i-- > 0;) {
+        const struct profile_map *map = proc->maps + i;
+        if (ip < map->start || ip >= map->end)
+            continue;
+        const char *symbol = elf_file_symbol(map->file, ip - map->start + map->pgoff);
+        if (symbol != NULL)
+            strwriter_printf(writer, ";%s", symbol);
+        else
+            strwriter_printf(writer, ";[%s]", map->file->basename);
+        return;
+    }
+    strwriter_printf(writer, ";[unknown]");
+}
+
+static uint64_t hash_stack(const char *str)
+{
+    uint64_t hash = UINT64_C(14695981039346656037);
+    for (; *str; ++str) {
+        hash ^= (unsigned char)*str;
+        hash *= UINT64_C(1099511628211);
+    }
+    return hash;
+}
+
+static void add_stack(struct profiler *profiler, const char *stack, size_t count)
+{
+    if ((profiler->stack_count + 1) * 2 > profiler->stack_capacity) {
+        size_t old_capacity = profiler->stack_capacity;
+        struct profile_stack *old_stacks = profiler->stacks;
+        profiler->stack_capacity = old_capacity ? old_capacity * 2 : 1024;
+        profiler->stacks = calloc(profiler->stack_capacity, sizeof(*profiler->stacks));
+        for (size_t i = 0; i < old_capacity; ++i) {
+            if (old_stacks[i].stack == NULL)
+                continue;
+            size_t idx = hash_stack(old_stacks[i].stack) & (profiler->stack_capacity - 1);
+            while (profiler->stacks[idx].stack != NULL)
+                idx = (idx + 1) & (profiler->stack_capacity - 1);
+            profiler->stacks[idx] = old_stacks[i];
+        }
+        free(old_stacks);
+    }
+    size_t idx = hash_stack(stack) & (profiler->stack_capacity - 1);
+    while (profiler->stacks[idx].stack != NULL) {
+        if (strcmp(profiler->stacks[idx].stack, stack) == 0) {
+            profiler->stacks[idx].count += count;
+            return;
+        }
+        idx = (idx + 1) & (profiler->stack_capacity - 1);
+    }
+    profiler->stacks[idx].stack = strdup(stack);
+    profiler->stacks[idx].count = count;
+    ++profiler->stack_count;
+}
+
+// PERF_RECORD_SAMPLE with PERF_SAMPLE_IP | PERF_SAMPLE_TID | PERF_SAMPLE_TIME |
+// PERF_SAMPLE_CALLCHAIN
+struct sample_record {
+    struct perf_event_header header;
+    uint64_t ip;
+    uint32_t pid;
+    uint32_t tid;
+    uint64_t time;
+    uint64_t nr;
+    uint64_t ips[];
+};
+
+struct mmap2_record {
+    struct perf_event_header header;
+    uint32_t pid;
+    uint32_t tid;
+    uint64_t addr;
+    uint64_t len;
+    uint64_t pgoff;
+    uint32_t maj;
+    uint32_t min;
+    uint64_t ino;
+    uint64_t ino_generation;
+    uint32_t prot;
+    uint32_t flags;
+    char filename[];
+};
+
+struct comm_record {
+    struct perf_event_header header;
+    uint32_t pid;
+    uint32_t tid;
+    char comm[];
+};
+
+struct fork_record {
+    struct perf_event_header header;
+    uint32_t pid;
+    uint32_t ppid;
+    uint32_t tid;
+    uint32_t ptid;
+    uint64_t time;
+};
+
+static void process_sample(struct profiler *profiler, const struct sample_record *record)
+{
+    const struct profile_proc *proc = get_proc(profiler, record->pid);
+    char stack[PROFILE_STACK_BUF];
+    struct string_writer writer = strwriter(stack, sizeof(stack));
+    strwriter_printf(&writer, "%s", proc->comm[0] ? proc->comm : "[unknown]");
+    size_t nr = record->nr;
+    if ((sizeof(*record) + nr * sizeof(uint64_t)) > record->header.size)
+        return;
+    // Callchain starts with the sampled instruction and goes up to the root.
+    // Other addresses are return addresses which may point to the next
+    // function, so they are adjusted to point into the call instruction.
+    size_t leaf = nr;
+    for (size_t i = 0; i < nr; ++i) {
+        if (record->ips[i] < PERF_CONTEXT_MAX) {
+            leaf = i;
+            break;
+        }
+    }
+    if (leaf == nr) {
+        write_frame(proc, record->ip, &writer);
+    } else {
+        for (size_t i = nr; i-- > leaf;) {
+            uint64_t ip = record->ips[i];
+            if (ip >= PERF_CONTEXT_MAX)
+                continue;
+            write_frame(proc, i == leaf ? ip : ip - 1, &writer);
+        }
+    }
+    add_stack(profiler, stack, 1);
+}
+
+// PERF_RECORD_SWITCH followed by 'sample_id_all' fields
+struct switch_record {
+    struct perf_event_header header;
+    uint32_t pid;
+    uint32_t tid;
+    uint64_t time;
+};
+
+static struct off_cpu_thread *get_off_cpu_thread(struct profiler *profiler, pid_t tid)
+{
+    for (size_t i = 0; i < sb_len(profiler->threads); ++i) {
+        if (profiler->threads[i].tid == tid)
+            return profiler->threads + i;
+    }
+    struct off_cpu_thread *thread = sb_new(profiler->threads);
+    memset(thread, 0, sizeof(*thread));
+    thread->tid = tid;
+    return thread;
+}
+
+static void free_off_cpu_threads(struct profiler *profiler)
+{
+    for (size_t i = 0; i < sb_len(profiler->threads); ++i)
+        free(profiler->threads[i].stack);
+    sb_free(profiler->threads);
+    profiler->threads = NULL;
+}
+
+// Reason is guessed from task state and kernel functions on stack at the time
+// task has been switched out
+static enum off_cpu_reason classify_off_cpu(uint64_t prev_state, const char *kernel_stack)
+{
+    // TASK_INTERRUPTIBLE and TASK_UNINTERRUPTIBLE, task is preempted if
+    // neither is set
+    if ((prev_state & 3) == 0)
+        return OFF_CPU_PREEMPT;
+    if (strstr(kernel_stack, "futex") != NULL)
+        return OFF_CPU_FUTEX;
+    if (strstr(kernel_stack, "nanosleep") != NULL)
+        return OFF_CPU_SLEEP;
+    if ((prev_state & 2) || strstr(kernel_stack, "io_schedule") != NULL)
+        return OFF_CPU_IO;
+    return OFF_CPU_OTHER;
+}
+
+// Sample of sched:sched_switch is taken in context of task that is being
+// switched out, before the switch
+static void process_off_cpu_sample(struct profiler *profiler,
+                                   const struct sample_record *record)
+{
+    size_t nr = record->nr;
+    size_t size = sizeof(*record) + nr * sizeof(uint64_t) + sizeof(uint32_t);
+    if (size > record->header.size)
+        return;
+    uint32_t raw_size;
+    memcpy(&raw_size, record->ips + nr, sizeof(raw_size));
+    const char *raw = (const char *)(record->ips + nr) + sizeof(raw_size);
+    if (size + raw_size > record->header.size ||
+        g_prev_state_offset + g_prev_state_size > raw_size)
+        return;
+    uint64_t prev_state = 0;
+    if (g_prev_state_size == sizeof(uint64_t)) {
+        memcpy(&prev_state, raw + g_prev_state_offset, sizeof(uint64_t));
+    } else {
+        uint32_t value;
+        memcpy(&value, raw + g_prev_state_offset, sizeof(value));
+        prev_state = value;
+    }
+
+    // Callchain consists of kernel frames followed by user frames, each
+    // going from leaf to root and preceded by context marker. In folded stack
+    // user frames come first, and kernel frames are marked with '_[k]'.
+    size_t kernel_start = nr, kernel_end = nr, user_start = nr;
+    for (size_t i = 0; i < nr; ++i) {
+        if (record->ips[i] == PERF_CONTEXT_KERNEL) {
+            kernel_start = i + 1;
+        } else if (record->ips[i] == PERF_CONTEXT_USER) {
+            if (kernel_start != nr && kernel_end == nr)
+                kernel_end = i;
+            user_start = i + 1;
+        }
+    }
+    const struct profile_proc *proc = get_proc(profiler, record->pid);
+    char stack[PROFILE_STACK_BUF];
+    struct string_writer writer = strwriter(stack, sizeof(stack));
+    strwriter_printf(&writer, "%s", proc->comm[0] ? proc->comm : "[unknown]");
+    for (size_t i = nr; i-- > user_start;) {
+        uint64_t ip = record->ips[i];
+        if (ip >= PERF_CONTEXT_MAX)
+            continue;
+        write_frame(proc, i == user_start ? ip : ip - 1, &writer);
+    }
+    size_t kernel_offset = strlen(stack);
+    for (size_t i = kernel_end; i-- > kernel_start;) {
+        const char *symbol = elf_file_symbol(&g_kernel_file, record->ips[i]);
+        strwriter_printf(&writer, ";%s_[k]", symbol ? symbol : "[unknown]");
+    }
+
+    struct off_cpu_thread *thread = get_off_cpu_thread(profiler, record->tid);
+    free(thread->stack);
+    thread->stack = strdup(stack);
+    thread->time = record->time;
+    thread->reason = classify_off_cpu(prev_state, stack + kernel_offset);
+}
+
+static void process_switch_in(struct profiler *profiler, const struct switch_record *record)
+{
+    struct off_cpu_thread *thread = get_off_cpu_thread(profiler, record->tid);
+    if (thread->stack == NULL)
+        return;
+    if (record->time > thread->time) {
+        uint64_t ns = record->time - thread->time;
+        profiler->off_cpu_ns[thread->reason] += ns;
+        add_stack(profiler, thread->stack, (ns + 500) / 1000);
+    }
+    free(thread->stack);
+    thread->stack = NULL;
+}
+
+static void process_record(struct profiler *profiler, const char *data)
+{
+    const struct perf_event_header *header = (const struct perf_event_header *)data;
+    switch (header->type) {
+    case PERF_RECORD_SAMPLE:
+        if (profiler->off_cpu)
+            process_off_cpu_sample(profiler, (const struct sample_record *)data);
+        else
+            process_sample(profiler, (const struct sample_record *)data);
+        break;
+    case PERF_RECORD_SWITCH:
+        // Threads that exit are switched out for the last time and never
+        // switched in
+        if (!(header->misc & PERF_RECORD_MISC_SWITCH_OUT))
+            process_switch_in(profiler, (const struct switch_record *)data);
+        break;
+    case PERF_RECORD_MMAP2: {
+        const struct mmap2_record *record = (const struct mmap2_record *)data;
+        struct profile_proc *proc = get_proc(profiler, record->pid);
+        struct profile_map map;
+        map.start = record->addr;
+        map.end = record->addr + record->len;
+        map.pgoff = record->pgoff;
+        map.file = get_elf_file(profiler, record->filename);
+        sb_push(proc->maps, map);
+        break;
+    }
+    case PERF_RECORD_COMM: {
+        const struct comm_record *record = (const struct comm_record *)data;
+        struct profile_proc *proc = get_proc(profiler, record->pid);
+        // New program image replaces all mappings
+        if (header->misc & PERF_RECORD_MISC_COMM_EXEC)
+            sb_purge(proc->maps);
+        if (record->pid == record->tid) {
+            strncpy(proc->comm, record->comm, sizeof(proc->comm) - 1);
+            // Spaces and semicolons separate folded stack frames
+            for (char *c = proc->comm; *c; ++c) {
+                if (*c == ' ' || *c == ';')
+                    *c = '_';
+            }
+        }
+        break;
+    }
+    case PERF_RECORD_FORK: {
+        const struct fork_record *record = (const struct fork_record *)data;
+        // Threads share address space with the process
+        if (record->pid == record->ppid)
+            break;
+        const struct profile_proc *parent = get_proc(profiler, record->ppid);
+        char comm[sizeof(parent->comm)];
+        memcpy(comm, parent->comm, sizeof(comm));
+        struct profile_map *maps = NULL;
+        for (size_t i = 0; i < sb_len(parent->maps); ++i)
+            sb_push(maps, parent->maps[i]);
+        // 'parent' may be invalidated by adding new process
+        struct profile_proc *proc = get_proc(profiler, record->pid);
+        sb_free(proc->maps);
+        proc->maps = maps;
+        memcpy(proc->comm, comm, sizeof(comm));
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+static int profile_stack_cmp(const void *a, const void *b)
+{
+    const struct profile_stack *as = a;
+    const struct profile_stack *bs = b;
+    return strcmp(as->stack, bs->stack);
+}
+
+static int profile_record_cmp(const void *a, const void *b)
+{
+    const struct profile_record *ar = a;
+    const struct profile_record *br = b;
+    if (ar->time != br->time)
+        return ar->time < br->time ? -1 : 1;
+    if (ar->offset != br->offset)
+        return ar->offset < br->offset ? -1 : 1;
+    return 0;
+}
+
+static void copy_from_ring(const char *ring, size_t ring_size, uint64_t pos, void *dst,
+                           size_t size)
+{
+    size_t offset = pos & (ring_size - 1);
+    size_t first = ring_size - offset;
+    if (first > size)
+        first = size;
+    memcpy(dst, ring + offset, first);
+    memcpy((char *)dst + first, ring, size - first);
+}
+
+static void drain_ring_buffer(struct profiler *profiler, size_t idx)
+{
+    struct perf_event_mmap_page *meta = profiler->buffers[idx];
+    const char *ring = (const char *)meta + profiler->page_size;
+    size_t ring_size = PROFILE_MMAP_PAGES * profiler->page_size;
+    uint64_t head = __atomic_load_n(&meta->data_head, __ATOMIC_ACQUIRE);
+    uint64_t tail = meta->data_tail;
+    while (tail < head) {
+        struct perf_event_header header;
+        copy_from_ring(ring, ring_size, tail, &header, sizeof(header));
+        if (header.size < sizeof(header))
+            break;
+        switch (header.type) {
+        case PERF_RECORD_LOST: {
+            // id and number of lost records
+            uint64_t lost[2];
+            copy_from_ring(ring, ring_size, tail + sizeof(header), lost, sizeof(lost));
+            profiler->lost += lost[1];
+            break;
+        }
+        case PERF_RECORD_SAMPLE:
+        case PERF_RECORD_SWITCH:
+        case PERF_RECORD_MMAP2:
+        case PERF_RECORD_COMM:
+        case PERF_RECORD_FORK: {
+            size_t offset = sb_len(profiler->records);
+            // Keep records aligned
+            sb_resize(profiler->records, offset + ((header.size + 7) & ~(size_t)7));
+            char *record = profiler->records + offset;
+            copy_from_ring(ring, ring_size, tail, record, header.size);
+            // Samples contain time after ip and tid, all other records have
+            // it at the end as part of 'sample_id_all' fields
+            uint64_t time;
+            if (header.type == PERF_RECORD_SAMPLE)
+                time = ((const struct sample_record *)record)->time;
+            else
+                memcpy(&time, record + header.size - sizeof(time), sizeof(time));
+            struct profile_record index = {time, offset};
+            sb_push(profiler->indexes, index);
+            break;
+        }
+        default:
+            break;
+        }
+        tail += header.size;
+    }
+    __atomic_store_n(&meta->data_tail, tail, __ATOMIC_RELEASE);
+}
+
+static int open_sampling_event(uint32_t type, uint64_t config, bool off_cpu, int cpu)
+{
+    struct perf_event_attr attr = {0};
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.sample_type =
+        PERF_SAMPLE_IP | PERF_SAMPLE_TID | PERF_SAMPLE_TIME | PERF_SAMPLE_CALLCHAIN;
+    if (off_cpu) {
+        // Every switch out is sampled with kernel stack and task state, and
+        // switch records tell when task runs again
+        attr.sample_period = 1;
+        attr.sample_type |= PERF_SAMPLE_RAW;
+        attr.context_switch = 1;
+    } else {
+        attr.freq = 1;
+        attr.sample_freq = PROFILE_FREQ;
+        attr.exclude_kernel = 1;
+        attr.exclude_callchain_kernel = 1;
+    }
+    attr.disabled = 1;
+    attr.enable_on_exec = 1;
+    attr.inherit = 1;
+    attr.exclude_hv = 1;
+    attr.mmap = 1;
+    attr.mmap2 = 1;
+    attr.comm = 1;
+    attr.comm_exec = 1;
+    attr.task = 1;
+    attr.sample_id_all = 1;
+    attr.watermark = 1;
+    attr.wakeup_watermark = PROFILE_MMAP_PAGES * sysconf(_SC_PAGESIZE) / 4;
+    return syscall(__NR_perf_event_open, &attr, 0, cpu, -1, PERF_FLAG_FD_CLOEXEC);
+}
+
+// Sampling events with ring buffers must be bound to CPU when inherited, so
+// one event is opened for each CPU. Cycles are sampled if hardware supports it,
+// otherwise CPU clock is used. Off-CPU tracer uses sched:sched_switch
+// tracepoint.
+static bool open_sampling_events(struct profiler *profiler)
+{
+    long cpu_count = sysconf(_SC_NPROCESSORS_CONF);
+    if (cpu_count < 1)
+        cpu_count = 1;
+    profiler->fds = calloc(cpu_count, sizeof(*profiler->fds));
+    profiler->buffers = calloc(cpu_count, sizeof(*profiler->buffers));
+    uint32_t types[] = {PERF_TYPE_HARDWARE, PERF_TYPE_SOFTWARE};
+    uint64_t configs[] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_SW_CPU_CLOCK};
+    size_t attempt_count = 2;
+    if (profiler->off_cpu) {
+        types[0] = PERF_TYPE_TRACEPOINT;
+        configs[0] = g_sched_switch_id;
+        attempt_count = 1;
+    }
+    for (size_t attempt = 0; attempt < attempt_count; ++attempt) {
+        bool success = true;
+        for (long cpu = 0; cpu < cpu_count; ++cpu) {
+            int fd = open_sampling_event(types[attempt], configs[attempt], profiler->off_cpu,
+                                         cpu);
+            if (fd == -1) {
+                // Offline CPU
+                if (errno == ENODEV)
+                    continue;
+                success = false;
+                break;
+            }
+            profiler->fds[profiler->event_count].fd = fd;
+            profiler->fds[profiler->event_count].events = POLLIN;
+            ++profiler->event_count;
+        }
+        if (success && profiler->event_count != 0)
+            return true;
+        if (attempt == attempt_count - 1) {
+            if (profiler->off_cpu && (errno == EACCES || errno == EPERM))
+                error("tracing scheduler events requires root privileges or "
+                      "kernel.perf_event_paranoid=-1");
+            else
+                csperror("perf_event_open (sampling event)");
+            return false;
+        }
+        for (size_t i = 0; i < profiler->event_count; ++i)
+            close(profiler->fds[i].fd);
+        profiler->event_count = 0;
+    }
+    ASSERT_UNREACHABLE();
+}
+
+static void free_profiler(struct profiler *profiler)
+{
+    size_t mmap_size = (PROFILE_MMAP_PAGES + 1) * profiler->page_size;
+    for (size_t i = 0; i < profiler->event_count; ++i) {
+        if (profiler->buffers[i] != NULL)
+            munmap(profiler->buffers[i], mmap_size);
+        close(profiler->fds[i].fd);
+    }
+    if (profiler->uninherited_fd != -1)
+        close(profiler->uninherited_fd);
+    free(profiler->fds);
+    free(profiler->buffers);
+    sb_free(profiler->records);
+    sb_free(profiler->indexes);
+    free_procs(profiler);
+    free_off_cpu_threads(profiler);
+    for (size_t i = 0; i < sb_len(profiler->files); ++i)
+        free_elf_file(profiler->files[i]);
+    sb_free(profiler->files);
+    for (size_t i = 0; i < profiler->stack_capacity; ++i)
+        free(profiler->stacks[i].stack);
+    free(profiler->stacks);
+    free(profiler);
+}
+
+// Events are opened on the calling thread in the same way as performance
+// counters in csbench_perf.c: they are inherited by forked commands and
+// enabled on execve, so that only commands are sampled.
+static struct profiler *open_profiler(bool off_cpu)
+{
+    struct profiler *profiler = calloc(1, sizeof(*profiler));
+    profiler->page_size = sysconf(_SC_PAGESIZE);
+    profiler->uninherited_fd = -1;
+    profiler->off_cpu = off_cpu;
+    if (!open_sampling_events(profiler))
+        goto err;
+    size_t mmap_size = (PROFILE_MMAP_PAGES + 1) * profiler->page_size;
+    for (size_t i = 0; i < profiler->event_count; ++i) {
+        void *buffer = mmap(NULL, mmap_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                            profiler->fds[i].fd, 0);
+        if (buffer == MAP_FAILED) {
+            csperror("mmap (sampling event)");
+            goto err;
+        }
+        profiler->buffers[i] = buffer;
+    }
+    // See comment to 'g_uninherited_fd' in csbench_perf.c
+    struct perf_event_attr attr = {0};
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_SOFTWARE;
+    attr.config = PERF_COUNT_SW_DUMMY;
+    attr.exclude_kernel = 1;
+    attr.disabled = 1;
+    profiler->uninherited_fd =
+        syscall(__NR_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+    if (profiler->uninherited_fd == -1) {
+        csperror("perf_event_open (dummy event)");
+        goto err;
+    }
+    return profiler;
+err:
+    free_profiler(profiler);
+    return NULL;
+}
+
+struct profiler *profiler_open(void)
+{
+    return open_profiler(false);
+}
+
+struct profiler *off_cpu_profiler_open(void)
+{
+    assert(g_sched_switch_id != 0);
+    return open_profiler(true);
+}
+
+static void drain_ring_buffers(struct profiler *profiler)
+{
+    for (size_t i = 0; i < profiler->event_count; ++i)
+        drain_ring_buffer(profiler, i);
+}
+
+bool profiler_collect(struct profiler *profiler, pid_t pid)
+{
+    for (;;) {
+        drain_ring_buffers(profiler);
+        siginfo_t siginfo;
+        memset(&siginfo, 0, sizeof(siginfo));
+        if (waitid(P_PID, pid, &siginfo, WEXITED | WNOHANG | WNOWAIT) == -1) {
+            if (errno == EINTR)
+                continue;
+            csperror("waitid");
+            return false;
+        }
+        if (siginfo.si_pid == pid)
+            break;
+        // Ring buffers signal when they are filled by a quarter, but process
+        // exit has to be checked periodically
+        if (poll(profiler->fds, profiler->event_count, 10) == -1 && errno != EINTR) {
+            csperror("poll");
+            return false;
+        }
+    }
+    drain_ring_buffers(profiler);
+
+    if (profiler->indexes != NULL)
+        qsort(profiler->indexes, sb_len(profiler->indexes), sizeof(*profiler->indexes),
+              profile_record_cmp);
+    for (size_t i = 0; i < sb_len(profiler->indexes); ++i)
+        process_record(profiler, profiler->records + profiler->indexes[i].offset);
+    sb_purge(profiler->records);
+    sb_purge(profiler->indexes);
+    free_procs(profiler);
+    free_off_cpu_threads(profiler);
+    return true;
+}
+
+void profiler_off_cpu_times(struct profiler *profiler, double *times)
+{
+    assert(profiler->off_cpu);
+    for (size_t i = 0; i < OFF_CPU_REASON_COUNT; ++i) {
+        times[i] = profiler->off_cpu_ns[i] * 1e-9;
+        profiler->off_cpu_ns[i] = 0;
+    }
+}
+
+void profiler_close(struct profiler *profiler, struct profile_stack **profile)
+{
+    if (profile != NULL) {
+        if (profiler->lost != 0)
+            warning("profiler lost %llu events", (unsigned long long)profiler->lost);
+        for (size_t i = 0; i < profiler->stack_capacity; ++i) {
+            if (profiler->stacks[i].stack == NULL)
+                continue;
+            sb_push(*profile, profiler->stacks[i]);
+            profiler->stacks[i].stack = NULL;
+        }
+        if (*profile != NULL)
+            qsort(*profile, sb_len(*profile), sizeof(**profile), profile_stack_cmp);
+        // Profile may already contain stacks from previous profilers, merge
+        // duplicates
+        size_t count = 0;
+        for (size_t i = 0; i < sb_len(*profile); ++i) {
+            struct profile_stack *stack = *profile + i;
+            if (count != 0 && strcmp((*profile)[count - 1].stack, stack->stack) == 0) {
+                (*profile)[count - 1].count += stack->count;
+                free(stack->stack);
+            } else {
+                (*profile)[count++] = *stack;
+            }
+        }
+        if (*profile != NULL)
+            sb_resize(*profile, count);
+    }
+    free_profiler(profiler);
+}
+
+// Find tracepoint id and offset of 'prev_state' field in its raw data
+static bool read_sched_switch_format(void)
+{
+    const char *paths[] = {"/sys/kernel/tracing/events/sched/sched_switch/format",
+                           "/sys/kernel/debug/tracing/events/sched/sched_switch/format"};
+    FILE *f = NULL;
+    for (size_t i = 0; i < sizeof(paths) / sizeof(*paths) && f == NULL; ++i)
+        f = fopen(paths[i], "r");
+    if (f == NULL) {
+        error("failed to open format of sched:sched_switch tracepoint, tracefs has to be "
+              "mounted at /sys/kernel/tracing");
+        return false;
+    }
+    char line[512];
+    bool has_prev_state = false;
+    while (fgets(line, sizeof(line), f)) {
+        unsigned long long id;
+        if (sscanf(line, "ID: %llu", &id) == 1) {
+            g_sched_switch_id = id;
+            continue;
+        }
+        const char *field = strstr(line, " prev_state;");
+        if (field == NULL)
+            continue;
+        const char *offset = strstr(field, "offset:");
+        const char *size = strstr(field, "size:");
+        if (offset == NULL || size == NULL)
+            continue;
+        g_prev_state_offset = strtoull(offset + 7, NULL, 10);
+        g_prev_state_size = strtoull(size + 5, NULL, 10);
+        has_prev_state = true;
+    }
+    fclose(f);
+    if (g_sched_switch_id == 0 || !has_prev_state ||
+        (g_prev_state_size != sizeof(uint32_t) && g_prev_state_size != sizeof(uint64_t))) {
+        error("unsupported format of sched:sched_switch tracepoint");
+        return false;
+    }
+    return true;
+}
+
+// Addresses in /proc/kallsyms are zero if they are hidden from current user,
+// in which case kernel frames are shown as '[unknown]'
+static void load_kernel_symbols(void)
+{
+    struct elf_file *file = &g_kernel_file;
+    file->basename = "kernel";
+    struct elf_segment segment = {0, 0, UINT64_MAX};
+    sb_push(file->segments, segment);
+    FILE *f = fopen("/proc/kallsyms", "r");
+    if (f == NULL)
+        return;
+    char *strtab = NULL; // sb
+    char line[512];
+    while (fgets(line, sizeof(line), f)) {
+        unsigned long long addr;
+        char type;
+        char name[256];
+        if (sscanf(line, "%llx %c %255s", &addr, &type, name) != 3)
+            continue;
+        if (addr == 0 || (type != 't' && type != 'T'))
+            continue;
+        struct elf_symbol symbol = {addr, 0, sb_len(strtab)};
+        sb_push(file->symbols, symbol);
+        size_t len = strlen(name) + 1;
+        size_t offset = sb_len(strtab);
+        sb_resize(strtab, offset + len);
+        memcpy(strtab + offset, name, len);
+    }
+    fclose(f);
+    if (file->symbols == NULL) {
+        sb_free(strtab);
+        return;
+    }
+    // Copy string table out of stretchy buffer to free it like ELF files
+    file->strtab = malloc(sb_len(strtab));
+    memcpy(file->strtab, strtab, sb_len(strtab));
+    sb_free(strtab);
+    qsort(file->symbols, sb_len(file->symbols), sizeof(*file->symbols), elf_symbol_cmp);
+}
+
+bool off_cpu_init(void)
+{
+    if (!read_sched_switch_format())
+        return false;
+    load_kernel_symbols();
+    return true;
+}
+
+void off_cpu_deinit(void)
+{
+    sb_free(g_kernel_file.segments);
+    sb_free(g_kernel_file.symbols);
+    free(g_kernel_file.strtab);
+    memset(&g_kernel_file, 0, sizeof(g_kernel_file));
+    g_sched_switch_id = 0;
+}
+
+#else // !__linux__
+
+struct profiler *profiler_open(void)
+{
+    error("profiling is not supported on this platform");
+    return NULL;
+}
+
+struct profiler *off_cpu_profiler_open(void)
+{
+    ASSERT_UNREACHABLE();
+}
+
+void profiler_off_cpu_times(struct profiler *profiler, double *times)
+{
+    (void)profiler;
+    (void)times;
+    ASSERT_UNREACHABLE();
+}
+
+bool off_cpu_init(void)
+{
+    error("off-CPU tracing is not supported on this platform");
+    return false;
+}
+
+void off_cpu_deinit(void)
+{
+}
+
+bool profiler_collect(struct profiler *profiler, pid_t pid)
+{
+    (void)profiler;
+    (void)pid;
+    ASSERT_UNREACHABLE();
+}
+
+void profiler_close(struct profiler *profiler, struct profile_stack **profile)
+{
+    (void)profiler;
+    (void)profile;
+    ASSERT_UNREACHABLE();
+}
+
+#endif // __linux__
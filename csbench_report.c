@@ -68,6 +68,8 @@ enum plot_kind {
     PLOT_GROUP_BAR,
     PLOT_GROUP_REGR,
     PLOT_ALL_GROUPS_REGR,
+    PLOT_GROUP_SCALING,
+    PLOT_RSS_TIMELINE,
     PLOT_KDE_SMALL,
     PLOT_KDE,
     PLOT_KDE_CMP_SMALL,
@@ -155,8 +157,9 @@ static bool export_json(const struct analysis *al, const char *filename)
             fprintf(f, "\"units\": \"%s\",", buf);
             json_escape(buf, sizeof(buf), meas->cmd);
             fprintf(f, " \"cmd\": \"%s\", \"val\": [", buf);
-            for (size_t k = 0; k < run_count; ++k)
-                fprintf(f, "%f%s", bench->meas[j][k], k != run_count - 1 ? ", " : "");
+            size_t val_count = sb_len(bench->meas[j]);
+            for (size_t k = 0; k < val_count; ++k)
+                fprintf(f, "%f%s", bench->meas[j][k], k != val_count - 1 ? ", " : "");
             fprintf(f, "]}");
             if (j != al->meas_count - 1)
                 fprintf(f, ", ");
@@ -170,6 +173,32 @@ static bool export_json(const struct analysis *al, const char *filename)
     return true;
 }
 
+// Memory timeline is plotted for mean RSS measurement if samples are
+// available, which is not the case for loaded data
+bool has_rss_timeline_plot(const struct meas_analysis *al)
+{
+    if (al->meas->kind != MEAS_RSS_MEAN || !(g_desired_plots & MAKE_PLOT_RSS_TIMELINE))
+        return false;
+    const struct analysis *base = al->base;
+    for (size_t bench_idx = 0; bench_idx < base->bench_count; ++bench_idx) {
+        const struct bench *bench = base->benches + bench_idx;
+        if (sb_len(bench->rss_timelines) != bench->run_count)
+            return false;
+    }
+    return true;
+}
+
+bool has_scaling_analysis(const struct meas_analysis *al)
+{
+    if (!g_scaling)
+        return false;
+    for (size_t grp_idx = 0; grp_idx < al->base->group_count; ++grp_idx) {
+        if (al->group_analyses[grp_idx].has_scaling)
+            return true;
+    }
+    return false;
+}
+
 static bool plot_walker(bool (*walk)(struct plot_walker_args *args),
                         struct plot_walker_args *args)
 {
@@ -209,6 +238,22 @@ static bool plot_walker(bool (*walk)(struct plot_walker_args *args),
             }
         }
     }
+    if (g_scaling && (g_desired_plots & MAKE_PLOT_GROUP_SCALING)) {
+        for (size_t grp_idx = 0; grp_idx < grp_count; ++grp_idx) {
+            const struct group_analysis *grp = al->group_analyses + grp_idx;
+            if (!grp->has_scaling)
+                continue;
+            args->plot_kind = PLOT_GROUP_SCALING;
+            args->grp_idx = grp_idx;
+            if (!walk(args))
+                return false;
+        }
+    }
+    if (has_rss_timeline_plot(al)) {
+        args->plot_kind = PLOT_RSS_TIMELINE;
+        if (!walk(args))
+            return false;
+    }
     foreach_bench_idx (bench_idx, al) {
         args->plot_kind = PLOT_KDE_SMALL;
         args->bench_idx = bench_idx;
@@ -281,6 +326,14 @@ static void format_plot_name(char *buf, size_t buf_size, const struct plot_walke
     case PLOT_ALL_GROUPS_REGR:
         snprintf(buf, buf_size, "%s/groups_%zu.%s", g_out_dir, args->meas_idx, extension);
         break;
+    case PLOT_GROUP_SCALING:
+        snprintf(buf, buf_size, "%s/scaling_%zu_%zu.%s", g_out_dir, args->grp_idx,
+                 args->meas_idx, extension);
+        break;
+    case PLOT_RSS_TIMELINE:
+        snprintf(buf, buf_size, "%s/rss_timeline_%zu.%s", g_out_dir, args->meas_idx,
+                 extension);
+        break;
     case PLOT_KDE_SMALL:
         snprintf(buf, buf_size, "%s/kde_small_%zu_%zu.%s", g_out_dir, args->bench_idx,
                  args->meas_idx, extension);
@@ -333,6 +386,10 @@ static bool make_plot_src(struct plot_walker_args *args, FILE *f)
         return plot_maker->group_regr(al, args->grp_idx, &ctx);
     case PLOT_ALL_GROUPS_REGR:
         return plot_maker->group_regr(al, (size_t)-1, &ctx);
+    case PLOT_GROUP_SCALING:
+        return plot_maker->group_scaling(al, args->grp_idx, &ctx);
+    case PLOT_RSS_TIMELINE:
+        return plot_maker->rss_timeline(al, &ctx);
     case PLOT_KDE_SMALL:
         return plot_maker->kde_small(al->benches[args->bench_idx], meas, &ctx);
     case PLOT_KDE:
@@ -511,6 +568,18 @@ static void make_plots_map_meas(const struct meas_analysis *al, FILE *f)
             }
         }
     }
+    if (has_scaling_analysis(al) && (g_desired_plots & MAKE_PLOT_GROUP_SCALING)) {
+        fprintf(f, "### scaling plots\n");
+        for (size_t grp_idx = 0; grp_idx < grp_count; ++grp_idx) {
+            const struct group_analysis *grp = al->group_analyses + grp_idx;
+            if (!grp->has_scaling)
+                continue;
+            fprintf(f, "- [group %s scaling plot](scaling_%zu_%zu.svg)\n",
+                    bench_group_name(base, grp_idx), grp_idx, meas_idx);
+        }
+    }
+    if (has_rss_timeline_plot(al))
+        fprintf(f, "- [memory timeline of median runs](rss_timeline_%zu.svg)\n", meas_idx);
     if (g_desired_plots & MAKE_PLOT_KDE_SMALL) {
         fprintf(f, "### benchmark KDE (small)\n");
         foreach_bench_idx (bench_idx, al) {
@@ -629,7 +698,9 @@ static void export_csv_bench_raw(const struct bench *bench, const struct analysi
     fprintf(f, "\n");
     for (size_t run_idx = 0; run_idx < bench->run_count; ++run_idx) {
         for (size_t meas_idx = 0; meas_idx < al->meas_count; ++meas_idx) {
-            fprintf(f, "%g", bench->meas[meas_idx][run_idx]);
+            // Leave cell empty if measurement was not collected in this run
+            if (run_idx < sb_len(bench->meas[meas_idx]))
+                fprintf(f, "%g", bench->meas[meas_idx][run_idx]);
             if (meas_idx != al->meas_count - 1)
                 fprintf(f, ",");
         }
@@ -800,11 +871,103 @@ static bool export_csvs(const struct analysis *al)
     return true;
 }
 
+// Differential flame graphs compare each benchmark to the one that is used as
+// reference when comparing the first measurement
+size_t profile_ref_idx(const struct analysis *al)
+{
+    if (al->bench_count == 1)
+        return SIZE_MAX;
+    size_t ref_idx = al->meas_analyses[0].bench_cmp.ref;
+    if (al->benches[ref_idx].profile == NULL)
+        return SIZE_MAX;
+    return ref_idx;
+}
+
+static bool write_flamegraph_file(const struct profile_stack *profile,
+                                  const struct profile_stack *base, const char *title,
+                                  const char *units, const char *name)
+{
+    FILE *f = open_file_fmt("w", "%s/%s", g_out_dir, name);
+    if (f == NULL) {
+        csfmtperror("failed to open file '%s/%s' for writing", g_out_dir, name);
+        return false;
+    }
+    bool success = write_flamegraph(profile, base, title, units, f);
+    fclose(f);
+    return success;
+}
+
+static bool write_folded_file(const struct profile_stack *profile, const char *name)
+{
+    FILE *f = open_file_fmt("w", "%s/%s", g_out_dir, name);
+    if (f == NULL) {
+        csfmtperror("failed to open file '%s/%s' for writing", g_out_dir, name);
+        return false;
+    }
+    for (size_t i = 0; i < sb_len(profile); ++i)
+        fprintf(f, "%s %zu\n", profile[i].stack, profile[i].count);
+    fclose(f);
+    return true;
+}
+
+// Off-CPU stacks are weighted by microseconds instead of samples
+static bool make_off_cpu_profiles(const struct analysis *al)
+{
+    for (size_t bench_idx = 0; bench_idx < al->bench_count; ++bench_idx) {
+        const struct profile_stack *profile = al->benches[bench_idx].off_cpu;
+        if (profile == NULL)
+            continue;
+        char name[256];
+        snprintf(name, sizeof(name), "offcpu_%zu.folded", bench_idx);
+        if (!write_folded_file(profile, name))
+            return false;
+        char title[4096];
+        snprintf(title, sizeof(title), "%s off-CPU time", bench_name(al, bench_idx));
+        snprintf(name, sizeof(name), "offcpu_flamegraph_%zu.svg", bench_idx);
+        if (!write_flamegraph_file(profile, NULL, title, "μs", name))
+            return false;
+    }
+    return true;
+}
+
+static bool make_profiles(const struct analysis *al)
+{
+    size_t ref_idx = profile_ref_idx(al);
+    for (size_t bench_idx = 0; bench_idx < al->bench_count; ++bench_idx) {
+        const struct profile_stack *profile = al->benches[bench_idx].profile;
+        if (profile == NULL)
+            continue;
+        char name[256];
+        snprintf(name, sizeof(name), "profile_%zu.folded", bench_idx);
+        if (!write_folded_file(profile, name))
+            return false;
+        snprintf(name, sizeof(name), "flamegraph_%zu.svg", bench_idx);
+        if (!write_flamegraph_file(profile, NULL, bench_name(al, bench_idx), "samples",
+                                   name))
+            return false;
+        if (ref_idx == SIZE_MAX || ref_idx == bench_idx)
+            continue;
+        char title[4096];
+        snprintf(title, sizeof(title), "%s vs %s", bench_name(al, bench_idx),
+                 bench_name(al, ref_idx));
+        snprintf(name, sizeof(name), "flamegraph_diff_%zu.svg", bench_idx);
+        if (!write_flamegraph_file(profile, al->benches[ref_idx].profile, title, "samples",
+                                   name))
+            return false;
+    }
+    return true;
+}
+
 static bool make_reports(const struct analysis *al)
 {
     if (g_json_export_filename != NULL && !export_json(al, g_json_export_filename))
         return false;
 
+    if (g_profile && !make_profiles(al))
+        return false;
+    if (!make_off_cpu_profiles(al))
+        return false;
+
     if (!g_plot && !g_html && !g_csv)
         return true;
 
@@ -849,6 +1012,36 @@ static void print_exit_code_info(const struct bench *bench)
     }
 }
 
+static void print_service_info(const struct bench *bench)
+{
+    if (!bench->has_service)
+        return;
+
+    const struct service_stats *stats = &bench->service;
+    char utime[256], stime[256], maxrss[256];
+    format_time(utime, sizeof(utime), stats->utime);
+    format_time(stime, sizeof(stime), stats->stime);
+    format_memory(maxrss, sizeof(maxrss), stats->maxrss);
+    printf("service usrtime %s systime %s maxrss %s\n", utime, stime, maxrss);
+    if (stats->has_pmc) {
+        const struct perf_cnt *pmc = &stats->pmc;
+        const char *builtin_names[] = {"cycles", "ins", "b", "bm"};
+        bool has_builtin = false;
+        for (size_t i = 0; i < PERF_CNT_BUILTIN_COUNT; ++i) {
+            if (!pmc->counted[i])
+                continue;
+            printf("%s %s %.3g", has_builtin ? "" : "service", builtin_names[i],
+                   pmc->values[i]);
+            has_builtin = true;
+        }
+        if (has_builtin)
+            printf("\n");
+        for (size_t i = 0; i < sb_len(g_perf_events); ++i)
+            printf("service %s %.3g\n", g_perf_events[i].name,
+                   pmc->values[PERF_CNT_BUILTIN_COUNT + i]);
+    }
+}
+
 static void print_outliers(const struct outliers *outliers, size_t run_count)
 {
     int outlier_count = outliers->low_mild + outliers->high_mild + outliers->low_severe +
@@ -904,6 +1097,33 @@ static void print_distr(const struct distr *dist, const struct units *units)
     print_estimate("st dev", &dist->st_dev, units, ANSI_BOLD_GREEN, ANSI_BRIGHT_GREEN);
 }
 
+static void print_request_info(const struct bench *bench)
+{
+    if (!bench->has_requests)
+        return;
+
+    const struct request_stats *stats = &bench->requests;
+    char p50[256], p99[256], p999[256];
+    format_time(p50, sizeof(p50), hdr_hist_quantile(&stats->latency, 0.5));
+    format_time(p99, sizeof(p99), hdr_hist_quantile(&stats->latency, 0.99));
+    format_time(p999, sizeof(p999), hdr_hist_quantile(&stats->latency, 0.999));
+    printf("%zu requests, %.1f req/s, p50 %s p99 %s p99.9 %s\n", stats->count,
+           stats->count / stats->time, p50, p99, p999);
+}
+
+static void print_iter_variance(const struct bench *bench, size_t meas_idx,
+                                const struct units *units)
+{
+    struct iter_variance variance;
+    if (!get_iter_variance(bench, meas_idx, &variance))
+        return;
+    char within_buf[256], between_buf[256];
+    format_meas(within_buf, sizeof(within_buf), variance.within_st_dev, units);
+    format_meas(between_buf, sizeof(between_buf), variance.between_st_dev, units);
+    printf("%zu iterations, st dev within runs %s, between runs %s (ICC %.2f)\n",
+           variance.count, within_buf, between_buf, variance.icc);
+}
+
 static void print_benchmark_info(const struct bench_analysis *cur, const struct analysis *al)
 {
     const struct bench *bench = cur->bench;
@@ -914,6 +1134,8 @@ static void print_benchmark_info(const struct bench_analysis *cur, const struct
     if (g_bench_stop.runs == 0)
         printf("%zu runs\n", bench->run_count);
     print_exit_code_info(bench);
+    print_service_info(bench);
+    print_request_info(bench);
     if (al->primary_meas_count != 0) {
         for (size_t meas_idx = 0; meas_idx < al->meas_count; ++meas_idx) {
             const struct meas *meas = al->meas + meas_idx;
@@ -931,7 +1153,8 @@ static void print_benchmark_info(const struct bench_analysis *cur, const struct
                     print_estimate(al->meas[j].name, &cur->meas[j].mean, &al->meas[j].units,
                                    ANSI_BOLD_BLUE, ANSI_BRIGHT_BLUE);
             }
-            print_outliers(&distr->outliers, bench->run_count);
+            print_outliers(&distr->outliers, distr->count);
+            print_iter_variance(bench, meas_idx, &meas->units);
         }
     } else {
         for (size_t i = 0; i < al->meas_count; ++i) {
@@ -940,6 +1163,11 @@ static void print_benchmark_info(const struct bench_analysis *cur, const struct
                            ANSI_BRIGHT_BLUE);
         }
     }
+    struct time_breakdown breakdown;
+    if (get_time_breakdown(al, cur - al->bench_analyses, &breakdown))
+        printf("time breakdown: on-CPU %.1f%%, runqueue %.1f%%, sleeping %.1f%%\n",
+               breakdown.on_cpu * 100.0, breakdown.runqueue * 100.0,
+               breakdown.sleeping * 100.0);
 }
 
 size_t ith_bench_idx(size_t i, const struct meas_analysis *al)
@@ -958,6 +1186,35 @@ size_t ith_bench_idx(size_t i, const struct meas_analysis *al)
     ASSERT_UNREACHABLE();
 }
 
+static void print_scaling(const struct group_analysis *grp, const struct bench_param *param)
+{
+    const struct scaling_fit *fit = &grp->scaling;
+    size_t best_idx = 0;
+    for (size_t i = 0; i < param->value_count; ++i) {
+        if (fit->speedup[i] > fit->speedup[best_idx])
+            best_idx = i;
+    }
+    printf("max speedup ");
+    printf_colored(ANSI_BOLD_GREEN, "%.3f", fit->speedup[best_idx]);
+    printf(" with %s=%s (efficiency %.1f%%)\n", param->name, param->values[best_idx],
+           fit->efficiency[best_idx] * 100.0);
+    printf("  amdahl serial fraction ");
+    printf_colored(ANSI_BOLD_GREEN, "%.4f", fit->serial.point);
+    printf_colored(ANSI_BRIGHT_GREEN, " [%.4f %.4f]", fit->serial.lower, fit->serial.upper);
+    printf(" (r2=%.2f)\n", fit->amdahl_r2);
+    printf("  usl contention ");
+    printf_colored(ANSI_BOLD_GREEN, "%.4f", fit->contention.point);
+    printf_colored(ANSI_BRIGHT_GREEN, " [%.4f %.4f]", fit->contention.lower,
+                   fit->contention.upper);
+    printf(" coherency ");
+    printf_colored(ANSI_BOLD_GREEN, "%.6f", fit->coherency.point);
+    printf_colored(ANSI_BRIGHT_GREEN, " [%.6f %.6f]", fit->coherency.lower,
+                   fit->coherency.upper);
+    printf(" (r2=%.2f)\n", fit->usl_r2);
+    if (isfinite(fit->usl_peak))
+        printf("  usl peak with %s=%.1f\n", param->name, fit->usl_peak);
+}
+
 static void print_bench_comparison(const struct meas_analysis *al)
 {
     const struct analysis *base = al->base;
@@ -1017,6 +1274,11 @@ static void print_bench_comparison(const struct meas_analysis *al)
             printf("%s complexity (r2=%.2f)\n", big_o_str(grp->regress.complexity),
                    grp->regress.r2);
     }
+    if (base->group_count == 1 && g_scaling) {
+        const struct group_analysis *grp = al->group_analyses;
+        if (grp->has_scaling)
+            print_scaling(grp, base->param);
+    }
 }
 
 static bool should_abbreviate_names(const struct meas_analysis *al)
@@ -1339,6 +1601,16 @@ static void print_group_comparison(const struct meas_analysis *al)
             }
         }
     }
+
+    if (g_scaling) {
+        for (size_t grp_idx = 0; grp_idx < base->group_count; ++grp_idx) {
+            const struct group_analysis *grp = al->group_analyses + grp_idx;
+            if (grp->has_scaling) {
+                printf_colored(ANSI_BOLD, "%s ", cli_group_name(al, grp_idx, abbr_names));
+                print_scaling(grp, base->param);
+            }
+        }
+    }
 }
 
 static void print_meas_analysis(const struct meas_analysis *al)
@@ -1362,6 +1634,11 @@ static void print_text_report(const struct analysis *al)
 {
     if (g_bench_stop.runs != 0)
         printf("%d runs\n", g_bench_stop.runs);
+    // Counters are inherited by all processes started by command. Events with
+    // ':u' and ':k' modifiers are restricted to user or kernel mode.
+    if (g_use_perf)
+        printf("perf scope: process tree%s\n",
+               g_perf_split ? ", user and kernel mode separately" : "");
     if (al->primary_meas_count == 1) {
         const struct meas *meas = NULL;
         for (size_t i = 0; i < al->meas_count && meas == NULL; ++i) {
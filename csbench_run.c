@@ -52,8 +52,10 @@
 //    See the License for the specific language governing permissions and
 //    limitations under the License.
 #include "csbench.h"
+#include "csbench_probe.h"
 
 #include <assert.h>
+#include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <math.h>
@@ -61,15 +63,61 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <netdb.h>
+#include <poll.h>
 #include <pthread.h>
 #include <regex.h>
+#include <sys/mman.h>
 #include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
+extern char **environ;
+
 #define PROGRESS_BAR_MAX_NAME_LEN 20
 // 4 is the number of lines we display, plus 1 for blank line where cursor will be
 #define PROGRESS_BAR_INFO_LINES (4 + 1)
+#define SERVICE_POLL_INTERVAL_US 10000
+// Time in seconds service has to exit after SIGTERM before it gets SIGKILL
+#define SERVICE_KILL_TIMEOUT 1.0
+#define PREPARE_SHELL_SENTINEL "csbench-prepare-done"
+// Used if size of last level cache can't be queried
+#define DEFAULT_LLC_SIZE (32 << 20)
+#define CACHE_LINE_SIZE 64
+// Maximum number of bytes drained from stdout of command at once in pipe I/O mode
+#define PIPE_DRAIN_CHUNK 65536
+// Number of records in shared memory of probes of one run
+#define CSBENCH_PROBE_CAPACITY 16384
+// Interval between connection attempts with --ready-connect
+#define READY_POLL_INTERVAL_MS 1
+// Maximum number of commands watched for readiness at the same time
+#define MAX_WATCHED_PIDS 256
+// Number of MEAS_LD_* measurements
+#define LD_STAT_COUNT 5
+
+// Command launched once per benchmark in --requests mode. It reads requests
+// from stdin and writes one line to stdout in response to each of them.
+struct request_server {
+    // 0 if command is not running
+    pid_t pid;
+    // Write end of stdin pipe and read end of stdout pipe of command
+    int in_fd;
+    int out_fd;
+    // Index of request line that is sent next
+    size_t next_request;
+    // Number of bytes of current request line that have been written
+    size_t written;
+    double write_start_time;
+    // Queue of send times of requests that have not been responded to yet
+    double *send_times; // sb
+    size_t send_head;
+    // Queue of latencies of responses that have not been reported yet
+    double *latencies; // sb
+    size_t latency_head;
+};
 
 struct bench_run_data {
     const struct bench_run_desc *desc;
@@ -77,8 +125,111 @@ struct bench_run_data {
     struct progress_bar_comm *comm;
     // This this is used when running custom measurements
     size_t *stdout_offsets;
+    // Values of probes in the last run, indexed by measurement
+    double *probe_values;
     // In case of suspension we save the state of running so it can be restored later
     double time_run;
+    // Set when setup command has been executed and teardown is pending
+    bool started;
+    // Background service process, or 0 if it is not running
+    pid_t service_pid;
+    struct perf_cnt_tracker *service_pmc;
+    struct request_server server;
+};
+
+// Benchmarks being run, used to stop services when interrupted by signal
+static struct bench_run_data *g_signal_rds;
+static size_t g_signal_rd_count;
+// Process groups of commands that are run in ready mode. They do not receive
+// signals sent to terminal, so they are killed when interrupted by signal.
+static pid_t g_watched_pids[MAX_WATCHED_PIDS];
+
+// Contents of --requests file and offsets of its lines
+static char *g_request_data;
+static size_t *g_request_offsets; // sb
+
+// Set if --ready-re or --ready-connect is used
+static bool g_ready_mode;
+// Set if "ttfb" is measured
+static bool g_use_ttfb;
+static regex_t g_ready_regex;
+static struct sockaddr_storage g_ready_addr;
+static socklen_t g_ready_addr_len;
+
+// Shell process that reads commands from pipe 'in' and reports their exit
+// status to pipe 'out'
+struct prepare_shell {
+    pid_t pid;
+    FILE *in;
+    FILE *out;
+};
+
+// Environment of command in one run. It is prepared before fork, so that
+// child only has to apply it.
+struct run_env {
+    // Null-terminated array of 'NAME=value' strings
+    char **envp;
+    // Strings from 'envp' owned by this structure
+    char **owned;
+    // Files that are inherited by command
+    int *fds;
+};
+
+// Shared memory that command writes probe records to
+struct probe_run {
+    int fd;
+    struct csbench_probe_shm *shm;
+    size_t size;
+};
+
+struct alloc_totals {
+    uint64_t allocs;
+    uint64_t bytes;
+    uint64_t peak_heap;
+};
+
+// Feeds input to command and drains its output in pipe I/O mode. Runs in
+// separate thread, because collecting performance counters blocks until
+// command finishes.
+struct pipe_pump {
+    const struct bench_run_desc *desc;
+    pthread_t thread;
+    // Write end of stdin pipe of command
+    int in_fd;
+    // Read end of stdout pipe of command
+    int out_fd;
+    bool success;
+};
+
+// Times of startup events of command as returned by 'get_time', zero if event
+// has not happened
+struct startup_times {
+    double first_byte;
+    double ready;
+};
+
+// Watches output of command to find time of its first byte and time when it
+// becomes ready, after which command is terminated. Runs in separate thread,
+// like 'pipe_pump'.
+struct startup_watch {
+    pthread_t thread;
+    pid_t pid;
+    // Read ends of stdout and stderr pipes of command, -1 if not watched
+    int out_fd;
+    int err_fd;
+    // Stdout is copied to this file for custom measurements, if not -1
+    int copy_fd;
+    // Written to by main thread when command has exited
+    int stop_pipe[2];
+    // Unfinished last lines of stdout and stderr
+    char *lines[2];
+    double start_time;
+    struct startup_times times;
+    // Time when command was sent SIGTERM, zero if it has not been
+    double term_time;
+    bool killed;
+    bool timed_out;
+    bool success;
 };
 
 struct bench_run_state {
@@ -232,6 +383,12 @@ get_custom_measurement_task(struct custom_measurement_task_queue *q)
 
 // Used by 'should_i_suspend'
 static __thread struct run_task_queue *g_q;
+// Buffer that is touched to flush CPU caches, allocated lazily
+static __thread unsigned char *g_llc_buffer;
+static __thread size_t g_llc_buffer_size;
+// Persistent shell used to execute prepare commands, one per thread. It is
+// launched lazily, closed when thread finishes running benchmarks.
+static __thread struct prepare_shell g_prepare_shell;
 
 #define lock_mutex(_mutex)                                                                  \
     do {                                                                                    \
@@ -387,13 +544,56 @@ static void apply_output_policy(enum output_kind policy, int err_pipe_end)
     }
 }
 
+static void apply_pipe_io(const int child_fds[2], int err_pipe_end)
+{
+    int fd = open("/dev/null", O_WRONLY);
+    if (fd == -1) {
+        csfdperror(err_pipe_end, "open(\"/dev/null\", O_WRONLY)");
+        _exit(-1);
+    }
+    if (dup2(child_fds[0], STDIN_FILENO) == -1 ||
+        dup2(child_fds[1], STDOUT_FILENO) == -1 || dup2(fd, STDERR_FILENO) == -1) {
+        csfdperror(err_pipe_end, "dup2");
+        _exit(-1);
+    }
+    close(fd);
+}
+
+// Connect stdout of command to pipe of startup watch, and stderr too if it is
+// watched
+static void apply_startup_watch(const int watch_fds[2], int err_pipe_end)
+{
+    int fd = open("/dev/null", O_WRONLY);
+    if (fd == -1) {
+        csfdperror(err_pipe_end, "open(\"/dev/null\", O_WRONLY)");
+        _exit(-1);
+    }
+    int err_fd = watch_fds[1] != -1 ? watch_fds[1] : fd;
+    if (dup2(watch_fds[0], STDOUT_FILENO) == -1 || dup2(err_fd, STDERR_FILENO) == -1) {
+        csfdperror(err_pipe_end, "dup2");
+        _exit(-1);
+    }
+    close(fd);
+}
+
 static void exec_cmd_child(const struct bench_run_desc *desc, bool use_pmc, bool is_warmup,
-                           int err_pipe_end)
+                           const struct run_env *env, const int pipe_fds[2],
+                           const int watch_fds[2], int err_pipe_end)
 {
-    apply_input_policy(desc->stdin_fd, err_pipe_end);
-    if (is_warmup) {
+    // Command is terminated together with all processes it spawns when it
+    // becomes ready
+    if (g_ready_mode)
+        setpgid(0, 0);
+    if (desc->pipe_io) {
+        apply_pipe_io(pipe_fds, err_pipe_end);
+    } else if (watch_fds[0] != -1) {
+        apply_input_policy(desc->stdin_fd, err_pipe_end);
+        apply_startup_watch(watch_fds, err_pipe_end);
+    } else if (is_warmup) {
+        apply_input_policy(desc->stdin_fd, err_pipe_end);
         apply_output_policy(OUTPUT_POLICY_NULL, err_pipe_end);
     } else if (desc->stdout_fd != -1) {
+        apply_input_policy(desc->stdin_fd, err_pipe_end);
         // special handling when stdout needs to be piped
         int fd = open("/dev/null", O_WRONLY);
         if (fd == -1) {
@@ -406,8 +606,11 @@ static void exec_cmd_child(const struct bench_run_desc *desc, bool use_pmc, bool
         }
         close(fd);
     } else {
+        apply_input_policy(desc->stdin_fd, err_pipe_end);
         apply_output_policy(desc->output, err_pipe_end);
     }
+#ifdef __APPLE__
+    // On Linux counters are enabled on execve, and no synchronization is needed
     if (use_pmc) {
         sigset_t set;
         sigemptyset(&set);
@@ -418,6 +621,19 @@ static void exec_cmd_child(const struct bench_run_desc *desc, bool use_pmc, bool
             _exit(-1);
         }
     }
+#else
+    (void)use_pmc;
+#endif
+    if (env != NULL) {
+        // Files of run environment are only inherited by this command
+        for (size_t i = 0; i < sb_len(env->fds); ++i) {
+            if (fcntl(env->fds[i], F_SETFD, 0) == -1) {
+                csfdperror(err_pipe_end, "fcntl");
+                _exit(-1);
+            }
+        }
+        environ = env->envp;
+    }
     if (execvp(desc->exec, (char **)desc->argv) == -1) {
         char argv_str[4096] = {0};
         struct string_writer writer = strwriter(argv_str, sizeof(argv_str));
@@ -433,172 +649,2330 @@ static void exec_cmd_child(const struct bench_run_desc *desc, bool use_pmc, bool
     __builtin_unreachable();
 }
 
-static bool exec_cmd_internal(const struct bench_run_desc *desc, struct rusage *rusage,
-                              struct perf_cnt *pmc, bool is_warmup, const int err_pipe[2],
-                              int *rc)
+static ssize_t pipe_feed(const struct bench_run_desc *desc, int fd, size_t written)
 {
-    bool success = true;
+#ifdef __linux__
+    struct iovec iov;
+    iov.iov_base = (void *)(desc->pipe_input + written);
+    iov.iov_len = desc->pipe_input_size - written;
+    return vmsplice(fd, &iov, 1, SPLICE_F_NONBLOCK);
+#else
+    return write(fd, desc->pipe_input + written, desc->pipe_input_size - written);
+#endif
+}
 
-    pid_t pid = fork();
-    if (pid == -1) {
-        csperror("fork");
+static ssize_t pipe_drain(int fd, int null_fd, size_t len)
+{
+#ifdef __linux__
+    ssize_t nr = splice(fd, NULL, null_fd, NULL, len, SPLICE_F_NONBLOCK);
+    if (nr != -1 || errno != EINVAL)
+        return nr;
+#else
+    (void)null_fd;
+#endif
+    char buf[PIPE_DRAIN_CHUNK];
+    return read(fd, buf, len);
+}
+
+static bool pipe_pump_internal(struct pipe_pump *pump, int null_fd)
+{
+    const struct bench_run_desc *desc = pump->desc;
+    size_t written = 0;
+    double drained = 0.0;
+    double start_time = get_time();
+    if (desc->pipe_input_size == 0) {
+        close(pump->in_fd);
+        pump->in_fd = -1;
+    }
+    while (pump->in_fd != -1 || pump->out_fd != -1) {
+        struct pollfd fds[2];
+        int nfds = 0, in_idx = -1, out_idx = -1, timeout = -1;
+        if (pump->in_fd != -1) {
+            in_idx = nfds++;
+            fds[in_idx].fd = pump->in_fd;
+            fds[in_idx].events = POLLOUT;
+        }
+        size_t chunk = PIPE_DRAIN_CHUNK;
+        if (pump->out_fd != -1 && g_drain_rate > 0.0) {
+            // Only drain as much output as has been allowed by now
+            double allowed = g_drain_rate * (get_time() - start_time) - drained;
+            if (allowed < 1.0)
+                timeout = (1.0 - allowed) / g_drain_rate * 1000.0 + 1;
+            else if (allowed < chunk)
+                chunk = allowed;
+        }
+        if (pump->out_fd != -1 && timeout == -1) {
+            out_idx = nfds++;
+            fds[out_idx].fd = pump->out_fd;
+            fds[out_idx].events = POLLIN;
+        }
+        if (poll(fds, nfds, timeout) == -1) {
+            if (errno == EINTR)
+                continue;
+            csperror("poll");
+            return false;
+        }
+        if (in_idx != -1 && fds[in_idx].revents) {
+            ssize_t nw = pipe_feed(desc, pump->in_fd, written);
+            if (nw == -1 && errno != EAGAIN && errno != EINTR) {
+                // Command is not required to read all of its input
+                if (errno != EPIPE) {
+                    csperror("vmsplice");
+                    return false;
+                }
+                written = desc->pipe_input_size;
+            } else if (nw > 0) {
+                written += nw;
+            }
+            if (written == desc->pipe_input_size) {
+                close(pump->in_fd);
+                pump->in_fd = -1;
+            }
+        }
+        if (out_idx != -1 && fds[out_idx].revents) {
+            ssize_t nr = pipe_drain(pump->out_fd, null_fd, chunk);
+            if (nr == -1 && errno != EAGAIN && errno != EINTR) {
+                csperror("splice");
+                return false;
+            } else if (nr == 0) {
+                close(pump->out_fd);
+                pump->out_fd = -1;
+            } else if (nr > 0) {
+                drained += nr;
+            }
+        }
+    }
+    return true;
+}
+
+static void *pipe_pump_worker(void *arg)
+{
+    struct pipe_pump *pump = arg;
+    // Get EPIPE instead of SIGPIPE if command exits without reading all input
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+    int null_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    if (null_fd == -1) {
+        csperror("open(\"/dev/null\", O_WRONLY)");
+        pump->success = false;
+    } else {
+        pump->success = pipe_pump_internal(pump, null_fd);
+        close(null_fd);
+    }
+    if (pump->in_fd != -1)
+        close(pump->in_fd);
+    if (pump->out_fd != -1)
+        close(pump->out_fd);
+    return NULL;
+}
+
+// Create pipes for stdin and stdout of command. 'child_fds' are ends that are
+// passed to command.
+static bool init_pipe_pump(const struct bench_run_desc *desc, struct pipe_pump *pump,
+                           int child_fds[2])
+{
+    int in_pipe[2], out_pipe[2];
+    if (!pipe_cloexec(in_pipe))
+        return false;
+    if (!pipe_cloexec(out_pipe)) {
+        close(in_pipe[0]);
+        close(in_pipe[1]);
+        return false;
+    }
+    if (fcntl(in_pipe[1], F_SETFL, O_NONBLOCK) == -1 ||
+        fcntl(out_pipe[0], F_SETFL, O_NONBLOCK) == -1) {
+        csperror("fcntl");
+        close(in_pipe[0]);
+        close(in_pipe[1]);
+        close(out_pipe[0]);
+        close(out_pipe[1]);
         return false;
     }
+    memset(pump, 0, sizeof(*pump));
+    pump->desc = desc;
+    pump->in_fd = in_pipe[1];
+    pump->out_fd = out_pipe[0];
+    child_fds[0] = in_pipe[0];
+    child_fds[1] = out_pipe[1];
+    return true;
+}
 
-    if (pid == 0)
-        exec_cmd_child(desc, pmc != NULL ? true : false, is_warmup, err_pipe[1]);
+static bool start_pipe_pump(struct pipe_pump *pump, int child_fds[2])
+{
+    // Command has its own copies of these descriptors now
+    close(child_fds[0]);
+    close(child_fds[1]);
+    if (pthread_create(&pump->thread, NULL, pipe_pump_worker, pump) != 0) {
+        error("failed to spawn thread");
+        close(pump->in_fd);
+        close(pump->out_fd);
+        return false;
+    }
+    return true;
+}
 
-    if (pmc != NULL && !perf_cnt_collect(pid, pmc)) {
-        success = false;
-        kill(pid, SIGKILL);
+static void register_watched_pid(pid_t pid)
+{
+    for (size_t i = 0; i < MAX_WATCHED_PIDS; ++i) {
+        pid_t expected = 0;
+        if (__atomic_compare_exchange_n(g_watched_pids + i, &expected, pid, false,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+            return;
     }
+}
 
-    int status = 0;
-    pid_t wpid;
-    for (;;) {
-        wpid = wait4(pid, &status, 0, rusage);
-        if (wpid == -1 && errno == EINTR)
+static void unregister_watched_pid(pid_t pid)
+{
+    for (size_t i = 0; i < MAX_WATCHED_PIDS; ++i) {
+        pid_t expected = pid;
+        if (__atomic_compare_exchange_n(g_watched_pids + i, &expected, 0, false,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+            return;
+    }
+}
+
+// Parse --ready-connect address, which is path to Unix socket if it contains a
+// slash, <HOST>:<PORT> pair, or port on loopback interface
+static bool resolve_ready_addr(const char *str)
+{
+    memset(&g_ready_addr, 0, sizeof(g_ready_addr));
+    if (strchr(str, '/') != NULL) {
+        struct sockaddr_un *addr = (struct sockaddr_un *)&g_ready_addr;
+        if (strlen(str) >= sizeof(addr->sun_path)) {
+            error("socket path '%s' is too long", str);
+            return false;
+        }
+        addr->sun_family = AF_UNIX;
+        strcpy(addr->sun_path, str);
+        g_ready_addr_len = sizeof(*addr);
+        return true;
+    }
+    char host[256] = "127.0.0.1";
+    const char *port = str;
+    const char *colon = strrchr(str, ':');
+    if (colon != NULL) {
+        size_t len = colon - str;
+        if (len >= sizeof(host)) {
+            error("host name in '%s' is too long", str);
+            return false;
+        }
+        memcpy(host, str, len);
+        host[len] = '\0';
+        port = colon + 1;
+    }
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_socktype = SOCK_STREAM;
+    int ret = getaddrinfo(host, port, &hints, &res);
+    if (ret != 0) {
+        error("failed to resolve address '%s': %s", str, gai_strerror(ret));
+        return false;
+    }
+    memcpy(&g_ready_addr, res->ai_addr, res->ai_addrlen);
+    g_ready_addr_len = res->ai_addrlen;
+    freeaddrinfo(res);
+    return true;
+}
+
+static bool init_ready_condition(void)
+{
+    if (g_ready_connect != NULL)
+        return resolve_ready_addr(g_ready_connect);
+    int ret = regcomp(&g_ready_regex, g_ready_re, REG_EXTENDED | REG_NOSUB);
+    if (ret != 0) {
+        char errbuf[4096];
+        regerror(ret, &g_ready_regex, errbuf, sizeof(errbuf));
+        error("error compiling regex '%s': %s", g_ready_re, errbuf);
+        return false;
+    }
+    return true;
+}
+
+static void deinit_ready_condition(void)
+{
+    if (g_ready_re != NULL)
+        regfree(&g_ready_regex);
+}
+
+static bool ready_addr_accepts(void)
+{
+#ifdef __linux__
+    int fd = socket(g_ready_addr.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+#else
+    int fd = socket(g_ready_addr.ss_family, SOCK_STREAM, 0);
+    if (fd != -1)
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+#endif
+    if (fd == -1)
+        return false;
+    bool accepted = connect(fd, (struct sockaddr *)&g_ready_addr, g_ready_addr_len) == 0;
+    close(fd);
+    return accepted;
+}
+
+// Append output of command to its unfinished line, matching each completed
+// line against --ready-re. Unfinished line is matched too, so that prompts
+// without trailing newline are recognized.
+static bool match_ready_lines(char **linep, const char *data, size_t size)
+{
+    for (size_t i = 0; i < size; ++i) {
+        if (data[i] != '\n' && sb_len(*linep) < PIPE_DRAIN_CHUNK) {
+            sb_push(*linep, data[i]);
             continue;
-        if (wpid != pid) {
-            csperror("wait4");
+        }
+        sb_push(*linep, '\0');
+        bool matched = regexec(&g_ready_regex, *linep, 0, NULL, 0) == 0;
+        sb_purge(*linep);
+        if (matched)
+            return true;
+    }
+    if (sb_len(*linep) == 0)
+        return false;
+    sb_push(*linep, '\0');
+    bool matched = regexec(&g_ready_regex, *linep, 0, NULL, 0) == 0;
+    (void)sb_pop(*linep);
+    return matched;
+}
+
+static bool startup_watch_read(struct startup_watch *watch, int stream, char *buf)
+{
+    int *fdp = stream == 0 ? &watch->out_fd : &watch->err_fd;
+    ssize_t nr = read(*fdp, buf, PIPE_DRAIN_CHUNK);
+    if (nr == -1) {
+        if (errno == EAGAIN || errno == EINTR)
+            return true;
+        csperror("read");
+        return false;
+    }
+    if (nr == 0) {
+        close(*fdp);
+        *fdp = -1;
+        return true;
+    }
+    double now = get_time();
+    if (stream == 0 && watch->times.first_byte == 0.0)
+        watch->times.first_byte = now;
+    if (stream == 0 && watch->copy_fd != -1 && write(watch->copy_fd, buf, nr) != nr) {
+        csperror("write");
+        return false;
+    }
+    if (g_ready_re != NULL && watch->times.ready == 0.0 &&
+        match_ready_lines(watch->lines + stream, buf, nr))
+        watch->times.ready = now;
+    return true;
+}
+
+static void startup_watch_check(struct startup_watch *watch)
+{
+    double now = get_time();
+    if (g_ready_mode && watch->times.ready == 0.0 && watch->term_time == 0.0) {
+        if (g_ready_connect != NULL && ready_addr_accepts()) {
+            watch->times.ready = get_time();
+        } else if (now - watch->start_time > g_ready_timeout) {
+            watch->timed_out = true;
+            watch->killed = true;
+            watch->term_time = now;
+            kill(-watch->pid, SIGKILL);
+        }
+    }
+    if (watch->times.ready != 0.0 && watch->term_time == 0.0) {
+        // Give command a chance to shut down gracefully, like service
+        watch->term_time = now;
+        kill(-watch->pid, SIGTERM);
+    } else if (watch->term_time != 0.0 && !watch->killed &&
+               now - watch->term_time > SERVICE_KILL_TIMEOUT) {
+        watch->killed = true;
+        kill(-watch->pid, SIGKILL);
+    }
+}
+
+static bool startup_watch_internal(struct startup_watch *watch)
+{
+    char buf[PIPE_DRAIN_CHUNK];
+    bool stopping = false;
+    for (;;) {
+        struct pollfd fds[3];
+        int nfds = 0, stream_idx[2] = {-1, -1}, timeout = -1;
+        int stream_fds[2] = {watch->out_fd, watch->err_fd};
+        for (int i = 0; i < 2; ++i) {
+            if (stream_fds[i] == -1)
+                continue;
+            stream_idx[i] = nfds;
+            fds[nfds].fd = stream_fds[i];
+            fds[nfds++].events = POLLIN;
+        }
+        if (stopping) {
+            // Only take output that is already written by command
+            if (nfds == 0)
+                break;
+            timeout = 0;
+        } else {
+            fds[nfds].fd = watch->stop_pipe[0];
+            fds[nfds++].events = POLLIN;
+            if (g_ready_mode && watch->times.ready == 0.0 && watch->term_time == 0.0)
+                timeout = g_ready_connect != NULL ? READY_POLL_INTERVAL_MS
+                                                  : SERVICE_POLL_INTERVAL_US / 1000;
+            else if (watch->term_time != 0.0 && !watch->killed)
+                timeout = SERVICE_POLL_INTERVAL_US / 1000;
+        }
+        int nready = poll(fds, nfds, timeout);
+        if (nready == -1) {
+            if (errno == EINTR)
+                continue;
+            csperror("poll");
             return false;
         }
-        break;
+        if (stopping && nready == 0)
+            break;
+        for (int i = 0; i < 2; ++i) {
+            if (stream_idx[i] != -1 && fds[stream_idx[i]].revents &&
+                !startup_watch_read(watch, i, buf))
+                return false;
+        }
+        if (stopping)
+            continue;
+        if (fds[nfds - 1].revents)
+            stopping = true;
+        else
+            startup_watch_check(watch);
     }
+    return true;
+}
 
-    if (!success)
+static void *startup_watch_worker(void *arg)
+{
+    struct startup_watch *watch = arg;
+    watch->success = startup_watch_internal(watch);
+    if (watch->out_fd != -1)
+        close(watch->out_fd);
+    if (watch->err_fd != -1)
+        close(watch->err_fd);
+    sb_free(watch->lines[0]);
+    sb_free(watch->lines[1]);
+    return NULL;
+}
+
+// Create pipes for stdout and stderr of command if they are watched.
+// 'child_fds' are ends that are passed to command.
+static bool init_startup_watch(const struct bench_run_desc *desc, bool is_warmup,
+                               struct startup_watch *watch, int child_fds[2])
+{
+    memset(watch, 0, sizeof(*watch));
+    watch->out_fd = watch->err_fd = watch->copy_fd = -1;
+    child_fds[0] = child_fds[1] = -1;
+    if (!pipe_cloexec(watch->stop_pipe))
         return false;
+    int out_pipe[2] = {-1, -1}, err_pipe[2] = {-1, -1};
+    bool watch_stdout = (g_use_ttfb && !is_warmup) || g_ready_re != NULL;
+    bool watch_stderr = g_ready_re != NULL;
+    if ((watch_stdout && !pipe_cloexec(out_pipe)) ||
+        (watch_stderr && !pipe_cloexec(err_pipe)))
+        goto err;
+    for (int i = 0; i < 2; ++i) {
+        int fd = i == 0 ? out_pipe[0] : err_pipe[0];
+        if (fd != -1 && fcntl(fd, F_SETFL, O_NONBLOCK) == -1) {
+            csperror("fcntl");
+            goto err;
+        }
+    }
+    watch->out_fd = out_pipe[0];
+    watch->err_fd = err_pipe[0];
+    if (!is_warmup)
+        watch->copy_fd = desc->stdout_fd;
+    child_fds[0] = out_pipe[1];
+    child_fds[1] = err_pipe[1];
+    return true;
+err:
+    for (int i = 0; i < 2; ++i) {
+        if (out_pipe[i] != -1)
+            close(out_pipe[i]);
+        if (err_pipe[i] != -1)
+            close(err_pipe[i]);
+    }
+    close(watch->stop_pipe[0]);
+    close(watch->stop_pipe[1]);
+    return false;
+}
 
-    if (!check_and_handle_err_pipe(err_pipe[0], 0))
+static void free_startup_watch(struct startup_watch *watch, int child_fds[2])
+{
+    for (int i = 0; i < 2; ++i) {
+        if (child_fds[i] != -1)
+            close(child_fds[i]);
+    }
+    if (watch->out_fd != -1)
+        close(watch->out_fd);
+    if (watch->err_fd != -1)
+        close(watch->err_fd);
+    close(watch->stop_pipe[0]);
+    close(watch->stop_pipe[1]);
+}
+
+static bool start_startup_watch(struct startup_watch *watch, pid_t pid, double start_time,
+                                int child_fds[2])
+{
+    for (int i = 0; i < 2; ++i) {
+        if (child_fds[i] != -1)
+            close(child_fds[i]);
+        child_fds[i] = -1;
+    }
+    watch->pid = pid;
+    watch->start_time = start_time;
+    if (g_ready_mode) {
+        // Set process group in parent too to avoid race with the child
+        setpgid(pid, pid);
+        register_watched_pid(pid);
+    }
+    if (pthread_create(&watch->thread, NULL, startup_watch_worker, watch) != 0) {
+        error("failed to spawn thread");
+        if (g_ready_mode)
+            unregister_watched_pid(pid);
+        free_startup_watch(watch, child_fds);
+        return false;
+    }
+    return true;
+}
+
+// Stop watching command after it has exited, but before it is reaped, so that
+// its process group can not be reused while watch can still send signals to it
+static void stop_startup_watch(struct startup_watch *watch)
+{
+    siginfo_t info;
+    while (waitid(P_PID, watch->pid, &info, WEXITED | WNOWAIT) == -1 && errno == EINTR)
+        ;
+    if (write(watch->stop_pipe[1], "", 1) != 1)
+        csperror("write");
+    pthread_join(watch->thread, NULL);
+    close(watch->stop_pipe[0]);
+    close(watch->stop_pipe[1]);
+    if (g_ready_mode) {
+        // Do not leave behind processes that ignored SIGTERM
+        if (watch->term_time != 0.0)
+            kill(-watch->pid, SIGKILL);
+        unregister_watched_pid(watch->pid);
+    }
+}
+
+// Statistics of command process that are read from procfs after it exits
+// and before it is reaped.
+struct proc_stats {
+    // I/O accounting from /proc/<pid>/io. When a child is reaped, its counters
+    // are added to the parent, so these cover the whole process tree.
+    uint64_t rchar;
+    uint64_t wchar;
+    uint64_t syscr;
+    uint64_t syscw;
+    uint64_t read_bytes;
+    uint64_t write_bytes;
+    // Scheduler statistics from /proc/<pid>/schedstat, which are only
+    // collected for the command process itself. Time spent waiting on a
+    // runqueue is in nanoseconds.
+    uint64_t run_delay;
+    uint64_t timeslices;
+};
+
+static bool g_use_proc_io;
+static bool g_use_schedstat;
+// Set if any off-CPU measurement is used, in which case each run is traced
+// with off-CPU tracer
+static bool g_use_off_cpu;
+// Set if any probe measurement is used, in which case each run gets shared
+// memory for probe values
+static bool g_use_probes;
+// Set if any of runtime linker statistics is measured
+static bool g_use_ld_stats;
+
+static bool read_proc_file(pid_t pid, const char *name, char *buf, size_t buf_size)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/%s", (int)pid, name);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        csfmtperror("failed to open '%s'", path);
+        return false;
+    }
+    ssize_t nread = read(fd, buf, buf_size - 1);
+    close(fd);
+    if (nread <= 0) {
+        csfmtperror("failed to read '%s'", path);
+        return false;
+    }
+    buf[nread] = '\0';
+    return true;
+}
+
+static bool read_proc_io(pid_t pid, struct proc_stats *stats)
+{
+    char buf[512];
+    if (!read_proc_file(pid, "io", buf, sizeof(buf)))
         return false;
+    const char *cursor = buf;
+    while (*cursor) {
+        const char *colon = strchr(cursor, ':');
+        if (colon == NULL)
+            break;
+        uint64_t value = strtoull(colon + 1, NULL, 10);
+        size_t len = colon - cursor;
+        if (len == 5 && memcmp(cursor, "rchar", 5) == 0)
+            stats->rchar = value;
+        else if (len == 5 && memcmp(cursor, "wchar", 5) == 0)
+            stats->wchar = value;
+        else if (len == 5 && memcmp(cursor, "syscr", 5) == 0)
+            stats->syscr = value;
+        else if (len == 5 && memcmp(cursor, "syscw", 5) == 0)
+            stats->syscw = value;
+        else if (len == 10 && memcmp(cursor, "read_bytes", 10) == 0)
+            stats->read_bytes = value;
+        else if (len == 11 && memcmp(cursor, "write_bytes", 11) == 0)
+            stats->write_bytes = value;
+        const char *newline = strchr(colon, '\n');
+        if (newline == NULL)
+            break;
+        cursor = newline + 1;
+    }
+    return true;
+}
 
-    // shell-like exit codes
-    if (WIFEXITED(status)) {
-        if (rc)
-            *rc = WEXITSTATUS(status);
-    } else if (WIFSIGNALED(status)) {
-        if (rc)
-            *rc = 128 + WTERMSIG(status);
-    } else {
-        error("process finished with unexpected status (%d)", status);
+static bool read_proc_schedstat(pid_t pid, struct proc_stats *stats)
+{
+    char buf[256];
+    if (!read_proc_file(pid, "schedstat", buf, sizeof(buf)))
+        return false;
+    // Fields are time spent on CPU, time spent waiting on a runqueue and
+    // number of timeslices run on CPU
+    unsigned long long cpu_time, run_delay, timeslices;
+    if (sscanf(buf, "%llu %llu %llu", &cpu_time, &run_delay, &timeslices) != 3) {
+        error("invalid format of /proc/%d/schedstat", (int)pid);
+        return false;
+    }
+    stats->run_delay = run_delay;
+    stats->timeslices = timeslices;
+    return true;
+}
+
+static bool read_proc_stats(pid_t pid, struct proc_stats *stats)
+{
+    // Statistics are only available before process is reaped
+    siginfo_t siginfo;
+    if (waitid(P_PID, pid, &siginfo, WEXITED | WNOWAIT) == -1) {
+        csperror("waitid");
+        return false;
+    }
+    memset(stats, 0, sizeof(*stats));
+    if (g_use_proc_io && !read_proc_io(pid, stats))
+        return false;
+    if (g_use_schedstat && !read_proc_schedstat(pid, stats))
+        return false;
+    return true;
+}
+
+// Absolute path to allocation shim, empty if allocation measurements are not
+// used
+static char g_alloc_shim_path[4096];
+
+static bool find_alloc_shim(void)
+{
+    if (g_alloc_shim != NULL) {
+        if (realpath(g_alloc_shim, g_alloc_shim_path) == NULL) {
+            csfmtperror("failed to find allocation shim '%s'", g_alloc_shim);
+            return false;
+        }
+        return true;
+    }
+    char exe[4096];
+    ssize_t len = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+    if (len > 0) {
+        exe[len] = '\0';
+        char *slash = strrchr(exe, '/');
+        if (slash != NULL)
+            *slash = '\0';
+        const char *candidates[] = {"libcsbench_alloc.so", "../lib/libcsbench_alloc.so"};
+        for (size_t i = 0; i < sizeof(candidates) / sizeof(*candidates); ++i) {
+            char path[4096 + 32];
+            snprintf(path, sizeof(path), "%s/%s", exe, candidates[i]);
+            if (access(path, R_OK) == 0 && realpath(path, g_alloc_shim_path) != NULL)
+                return true;
+        }
+    }
+    error("failed to find allocation shim libcsbench_alloc.so, build it with 'make' or "
+          "specify its path with --alloc-shim");
+    return false;
+}
+
+static void init_run_env(struct run_env *env)
+{
+    memset(env, 0, sizeof(*env));
+    for (char **var = environ; *var != NULL; ++var)
+        sb_push(env->envp, *var);
+    sb_push(env->envp, NULL);
+}
+
+static void free_run_env(struct run_env *env)
+{
+    for (size_t i = 0; i < sb_len(env->owned); ++i)
+        free(env->owned[i]);
+    sb_free(env->owned);
+    sb_free(env->envp);
+    sb_free(env->fds);
+}
+
+// Returns index of variable 'name' in 'envp', or index of terminating null if
+// it is not set
+static size_t run_env_find(const struct run_env *env, const char *name)
+{
+    size_t name_len = strlen(name);
+    size_t i = 0;
+    for (; env->envp[i] != NULL; ++i) {
+        if (strncmp(env->envp[i], name, name_len) == 0 && env->envp[i][name_len] == '=')
+            break;
+    }
+    return i;
+}
+
+static const char *run_env_get(const struct run_env *env, const char *name)
+{
+    const char *var = env->envp[run_env_find(env, name)];
+    return var != NULL ? var + strlen(name) + 1 : NULL;
+}
+
+static void run_env_set(struct run_env *env, const char *name, const char *value)
+{
+    size_t size = strlen(name) + strlen(value) + 2;
+    char *var = malloc(size);
+    snprintf(var, size, "%s=%s", name, value);
+    sb_push(env->owned, var);
+    size_t idx = run_env_find(env, name);
+    if (env->envp[idx] == NULL)
+        sb_push(env->envp, NULL);
+    env->envp[idx] = var;
+}
+
+static void run_env_inherit_fd(struct run_env *env, int fd)
+{
+    sb_push(env->fds, fd);
+}
+
+// Pass performance counters to command, so that it can enable them inside
+// region of interest
+static bool setup_perf_roi(struct run_env *env, size_t run_idx)
+{
+    const int *fds;
+    size_t count;
+    if (!perf_cnt_roi_fds(run_idx, &fds, &count))
+        return false;
+    assert(count <= CSBENCH_PROBE_MAX_PERF_FDS);
+    char list[CSBENCH_PROBE_MAX_PERF_FDS * 12] = {0};
+    struct string_writer writer = strwriter(list, sizeof(list));
+    for (size_t i = 0; i < count; ++i) {
+        strwriter_printf(&writer, i == 0 ? "%d" : ",%d", fds[i]);
+        run_env_inherit_fd(env, fds[i]);
+    }
+    run_env_set(env, CSBENCH_PROBE_PERF_ENV, list);
+    return true;
+}
+
+// Allocation shim is preloaded into command and appends totals of each
+// process to temporary file, which is returned.
+static int setup_alloc_shim(struct run_env *env)
+{
+    int fd = tmpfile_fd();
+    if (fd == -1)
+        return -1;
+    // Appends of different processes must not overwrite each other
+    if (fcntl(fd, F_SETFL, O_APPEND) == -1) {
+        csperror("fcntl");
+        close(fd);
+        return -1;
+    }
+    const char *old_preload = run_env_get(env, "LD_PRELOAD");
+    if (old_preload == NULL)
+        old_preload = "";
+    size_t preload_size = strlen(g_alloc_shim_path) + strlen(old_preload) + 2;
+    char *preload = malloc(preload_size);
+    snprintf(preload, preload_size, "%s%s%s", g_alloc_shim_path, *old_preload ? ":" : "",
+             old_preload);
+    run_env_set(env, "LD_PRELOAD", preload);
+    free(preload);
+    char fd_str[32];
+    snprintf(fd_str, sizeof(fd_str), "%d", fd);
+    run_env_set(env, "CSBENCH_ALLOC_FD", fd_str);
+    run_env_inherit_fd(env, fd);
+    return fd;
+}
+
+// Make dynamic linker of each process of command write its statistics to a
+// file in private temporary directory 'dir'. glibc appends process id to
+// LD_DEBUG_OUTPUT, so statistics can not be sent to a single descriptor.
+static bool setup_ld_stats(struct run_env *env, char *dir, size_t dir_size)
+{
+    snprintf(dir, dir_size, "/tmp/csbench_ld_XXXXXX");
+    if (mkdtemp(dir) == NULL) {
+        csperror("mkdtemp");
+        dir[0] = '\0';
+        return false;
+    }
+    char prefix[4096];
+    snprintf(prefix, sizeof(prefix), "%s/ld", dir);
+    run_env_set(env, "LD_DEBUG", "statistics");
+    run_env_set(env, "LD_DEBUG_OUTPUT", prefix);
+    return true;
+}
+
+static void parse_ld_stats(FILE *f, double *values)
+{
+    // Order matches MEAS_LD_* measurements
+    const char *prefixes[LD_STAT_COUNT] = {
+        "total startup time in dynamic loader:", "time needed for relocation:",
+        "time needed to load objects:", "number of relocations:",
+        "number of relative relocations:"};
+    char line[4096];
+    while (fgets(line, sizeof(line), f)) {
+        // Lines are prefixed with process id followed by tab
+        const char *text = strchr(line, '\t');
+        if (text == NULL)
+            continue;
+        ++text;
+        while (*text == ' ')
+            ++text;
+        for (size_t i = 0; i < LD_STAT_COUNT; ++i) {
+            size_t len = strlen(prefixes[i]);
+            if (strncmp(text, prefixes[i], len) == 0)
+                values[i] += strtod(text + len, NULL);
+        }
+    }
+}
+
+// Sum statistics of all processes and remove directory created by
+// 'setup_ld_stats'. If 'require' is set, it is an error if no process has
+// reported statistics.
+static bool read_ld_stats(const char *dir, bool require, double *values)
+{
+    memset(values, 0, LD_STAT_COUNT * sizeof(*values));
+    DIR *d = opendir(dir);
+    if (d == NULL) {
+        csfmtperror("failed to open directory '%s'", dir);
+        return false;
+    }
+    bool success = true, found = false;
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+        if (strncmp(entry->d_name, "ld.", 3) != 0)
+            continue;
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+        FILE *f = fopen(path, "r");
+        if (f == NULL) {
+            csfmtperror("failed to open file '%s'", path);
+            success = false;
+        } else {
+            parse_ld_stats(f, values);
+            fclose(f);
+            found = true;
+        }
+        unlink(path);
+    }
+    closedir(d);
+    if (rmdir(dir) == -1) {
+        csfmtperror("failed to remove directory '%s'", dir);
+        success = false;
+    }
+    if (success && require && !found) {
+        error("dynamic linker did not report statistics, command has to be dynamically "
+              "linked with glibc");
+        success = false;
+    }
+    return success;
+}
+
+static void free_probe_run(struct probe_run *probe)
+{
+    if (probe->shm != NULL)
+        munmap(probe->shm, probe->size);
+    if (probe->fd != -1)
+        close(probe->fd);
+}
+
+static bool setup_probes(struct run_env *env, struct probe_run *probe)
+{
+    memset(probe, 0, sizeof(*probe));
+    probe->fd = tmpfile_fd();
+    if (probe->fd == -1)
+        return false;
+    probe->size = sizeof(struct csbench_probe_shm) +
+                  CSBENCH_PROBE_CAPACITY * sizeof(struct csbench_probe_record);
+    if (ftruncate(probe->fd, probe->size) == -1) {
+        csperror("ftruncate");
+        goto err;
+    }
+    void *map = mmap(NULL, probe->size, PROT_READ | PROT_WRITE, MAP_SHARED, probe->fd, 0);
+    if (map == MAP_FAILED) {
+        csperror("mmap");
+        goto err;
+    }
+    probe->shm = map;
+    probe->shm->magic = CSBENCH_PROBE_MAGIC;
+    probe->shm->record_size = sizeof(struct csbench_probe_record);
+    probe->shm->capacity = CSBENCH_PROBE_CAPACITY;
+    char var[64];
+    snprintf(var, sizeof(var), "%d:%zu", probe->fd, probe->size);
+    run_env_set(env, CSBENCH_PROBE_ENV, var);
+    run_env_inherit_fd(env, probe->fd);
+    return true;
+err:
+    free_probe_run(probe);
+    probe->fd = -1;
+    probe->shm = NULL;
+    return false;
+}
+
+// Value of probe 'name' is the sum of its added values, or last set value if
+// it was set.
+static bool read_probe(const struct probe_run *probe, const char *name, double *value)
+{
+    uint64_t count = probe->shm->count;
+    if (count > probe->shm->capacity)
+        count = probe->shm->capacity;
+    const struct csbench_probe_record *records =
+        (const struct csbench_probe_record *)(probe->shm + 1);
+    bool found = false;
+    double sum = 0.0, set = 0.0;
+    bool is_set = false;
+    for (uint64_t i = 0; i < count; ++i) {
+        const struct csbench_probe_record *record = records + i;
+        if (!record->ready ||
+            strncmp(record->name, name, sizeof(record->name)) != 0)
+            continue;
+        found = true;
+        if (record->op == CSBENCH_PROBE_SET) {
+            set = record->value;
+            is_set = true;
+        } else {
+            sum += record->value;
+        }
+    }
+    if (!found) {
+        error("command did not report probe '%s'", name);
+        return false;
+    }
+    *value = is_set ? set : sum;
+    return true;
+}
+
+static bool read_probes(struct bench_run_data *rd, const struct probe_run *probe)
+{
+    if (probe->shm->count > probe->shm->capacity && rd->bench->run_count == 0)
+        warning("command reported more than %d probe values in one run, extra values are "
+                "ignored",
+                CSBENCH_PROBE_CAPACITY);
+    sb_resize(rd->probe_values, rd->desc->meas_count);
+    for (size_t i = 0; i < rd->desc->meas_count; ++i) {
+        const struct meas *meas = rd->desc->meas + i;
+        if (meas->kind == MEAS_PROBE && !read_probe(probe, meas->name, rd->probe_values + i))
+            return false;
+    }
+    return true;
+}
+
+// Each process of command that exits normally reports its own totals. Peak
+// heap is the largest peak among processes.
+static bool read_alloc_totals(int shim_fd, struct alloc_totals *totals)
+{
+    memset(totals, 0, sizeof(*totals));
+    int fd = dup(shim_fd);
+    if (fd == -1) {
+        csperror("dup");
+        return false;
+    }
+    FILE *f = fdopen(fd, "r");
+    if (f == NULL) {
+        csperror("fdopen");
+        close(fd);
+        return false;
+    }
+    rewind(f);
+    char line[256];
+    while (fgets(line, sizeof(line), f)) {
+        unsigned long long allocs, bytes;
+        long long peak;
+        if (sscanf(line, "csbench-alloc %llu %llu %lld", &allocs, &bytes, &peak) != 3)
+            continue;
+        totals->allocs += allocs;
+        totals->bytes += bytes;
+        if (peak > 0 && (uint64_t)peak > totals->peak_heap)
+            totals->peak_heap = peak;
+    }
+    fclose(f);
+    return true;
+}
+
+// Thread that samples resident set size of process tree while command is
+// running
+struct rss_sampler {
+    pid_t pid;
+    // Read end of pipe whose write end is closed on execve(2) of command
+    int exec_fd;
+    double start_time;
+    double end_time;
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    bool stop;
+    struct rss_sample *samples; // sb
+};
+
+static double proc_rss(pid_t pid, size_t page_size)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/statm", (int)pid);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    // Process could have already exited
+    if (fd == -1)
+        return 0.0;
+    char buf[256];
+    ssize_t nread = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (nread <= 0)
+        return 0.0;
+    buf[nread] = '\0';
+    unsigned long size = 0, resident = 0;
+    if (sscanf(buf, "%lu %lu", &size, &resident) != 2)
+        return 0.0;
+    return (double)resident * page_size;
+}
+
+// Sum RSS of process and all of its descendants, which are found using
+// /proc/<pid>/task/<tid>/children
+static double proc_tree_rss(pid_t root)
+{
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    double rss = 0.0;
+    pid_t *stack = NULL;
+    sb_push(stack, root);
+    while (sb_len(stack) != 0) {
+        pid_t pid = sb_pop(stack);
+        rss += proc_rss(pid, page_size);
+        char path[64];
+        snprintf(path, sizeof(path), "/proc/%d/task", (int)pid);
+        DIR *dir = opendir(path);
+        if (dir == NULL)
+            continue;
+        struct dirent *ent;
+        while ((ent = readdir(dir)) != NULL) {
+            if (ent->d_name[0] == '.')
+                continue;
+            char children_path[320];
+            snprintf(children_path, sizeof(children_path), "/proc/%d/task/%s/children",
+                     (int)pid, ent->d_name);
+            FILE *f = fopen(children_path, "r");
+            if (f == NULL)
+                continue;
+            int child;
+            while (fscanf(f, "%d", &child) == 1)
+                sb_push(stack, child);
+            fclose(f);
+        }
+        closedir(dir);
+    }
+    sb_free(stack);
+    return rss;
+}
+
+static void *rss_sampler_worker(void *arg)
+{
+    struct rss_sampler *sampler = arg;
+    // Forked process shares memory of csbench until it executes command, so
+    // sampling starts only after execve(2)
+    struct pollfd pfd = {sampler->exec_fd, POLLIN, 0};
+    while (poll(&pfd, 1, -1) == -1 && errno == EINTR)
+        ;
+    pthread_mutex_lock(&sampler->mutex);
+    for (;;) {
+        pthread_mutex_unlock(&sampler->mutex);
+        struct rss_sample sample;
+        sample.rss = proc_tree_rss(sampler->pid);
+        sample.time = get_time() - sampler->start_time;
+        // Zero means that command has already exited
+        if (sample.rss != 0.0)
+            sb_push(sampler->samples, sample);
+
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        double next = deadline.tv_sec + deadline.tv_nsec * 1e-9 + g_rss_interval;
+        deadline.tv_sec = (time_t)next;
+        deadline.tv_nsec = (long)((next - (double)deadline.tv_sec) * 1e9);
+        pthread_mutex_lock(&sampler->mutex);
+        while (!sampler->stop) {
+            if (pthread_cond_timedwait(&sampler->cond, &sampler->mutex, &deadline) ==
+                ETIMEDOUT)
+                break;
+        }
+        if (sampler->stop)
+            break;
+    }
+    pthread_mutex_unlock(&sampler->mutex);
+    return NULL;
+}
+
+static bool start_rss_sampler(struct rss_sampler *sampler, pid_t pid, int exec_fd)
+{
+    sampler->pid = pid;
+    sampler->exec_fd = exec_fd;
+    sampler->start_time = get_time();
+    sampler->stop = false;
+    sampler->samples = NULL;
+    pthread_mutex_init(&sampler->mutex, NULL);
+    pthread_cond_init(&sampler->cond, NULL);
+    if (pthread_create(&sampler->thread, NULL, rss_sampler_worker, sampler) != 0) {
+        csperror("pthread_create");
+        pthread_cond_destroy(&sampler->cond);
+        pthread_mutex_destroy(&sampler->mutex);
+        return false;
+    }
+    return true;
+}
+
+static void stop_rss_sampler(struct rss_sampler *sampler)
+{
+    sampler->end_time = get_time() - sampler->start_time;
+    pthread_mutex_lock(&sampler->mutex);
+    sampler->stop = true;
+    pthread_cond_signal(&sampler->cond);
+    pthread_mutex_unlock(&sampler->mutex);
+    pthread_join(sampler->thread, NULL);
+    pthread_cond_destroy(&sampler->cond);
+    pthread_mutex_destroy(&sampler->mutex);
+}
+
+// Compute integral of RSS over time in byte-seconds and time-weighted mean
+// RSS, treating each sample as the value until the next one
+static void rss_timeline_stats(const struct rss_sample *samples, double end_time,
+                               double *integral, double *mean)
+{
+    *integral = *mean = 0.0;
+    size_t count = sb_len(samples);
+    if (count == 0)
+        return;
+    for (size_t i = 0; i < count; ++i) {
+        double next = i + 1 < count ? samples[i + 1].time : end_time;
+        if (next > samples[i].time)
+            *integral += samples[i].rss * (next - samples[i].time);
+    }
+    double duration = end_time - samples[0].time;
+    *mean = duration > 0.0 ? *integral / duration : samples[0].rss;
+}
+
+static bool exec_cmd_internal(const struct bench_run_desc *desc, struct rusage *rusage,
+                              struct proc_stats *stats, struct rss_sampler *rss,
+                              struct perf_cnt *pmc, struct profiler *profiler,
+                              const struct run_env *env, size_t run_idx,
+                              bool is_warmup, struct startup_times *startup,
+                              int err_pipe[2], int *rc)
+{
+    bool success = true;
+
+    struct pipe_pump pump;
+    int pipe_fds[2] = {-1, -1};
+    struct startup_watch watch;
+    int watch_fds[2] = {-1, -1};
+    bool use_watch = g_ready_mode || startup != NULL;
+    if (pmc != NULL && !perf_cnt_prepare(run_idx))
+        return false;
+
+    if (desc->pipe_io && !init_pipe_pump(desc, &pump, pipe_fds))
+        return false;
+    if (use_watch && !init_startup_watch(desc, is_warmup, &watch, watch_fds))
+        return false;
+
+    double start_time = get_time();
+    pid_t pid = fork();
+    if (pid == -1) {
+        csperror("fork");
+        if (desc->pipe_io) {
+            close(pipe_fds[0]);
+            close(pipe_fds[1]);
+            close(pump.in_fd);
+            close(pump.out_fd);
+        }
+        if (use_watch)
+            free_startup_watch(&watch, watch_fds);
+        return false;
+    }
+
+    if (pid == 0)
+        exec_cmd_child(desc, pmc != NULL ? true : false, is_warmup, env, pipe_fds,
+                       watch_fds, err_pipe[1]);
+    // Error pipe reaches end of file when command is executed
+    close(err_pipe[1]);
+    err_pipe[1] = -1;
+
+    bool has_pump = false;
+    if (desc->pipe_io) {
+        has_pump = start_pipe_pump(&pump, pipe_fds);
+        if (!has_pump) {
+            success = false;
+            kill(pid, SIGKILL);
+        }
+    }
+
+    bool has_watch = false;
+    if (success && use_watch) {
+        has_watch = start_startup_watch(&watch, pid, start_time, watch_fds);
+        if (!has_watch) {
+            success = false;
+            kill(pid, SIGKILL);
+        }
+    } else if (use_watch) {
+        free_startup_watch(&watch, watch_fds);
+    }
+
+    bool has_rss_sampler = false;
+    if (success && rss != NULL) {
+        has_rss_sampler = start_rss_sampler(rss, pid, err_pipe[0]);
+        if (!has_rss_sampler) {
+            success = false;
+            kill(pid, SIGKILL);
+        }
+    }
+
+    // Profiler has to drain its ring buffers while command is running, so it
+    // goes before performance counters, which just wait for command to exit
+    if (success && profiler != NULL && !profiler_collect(profiler, pid)) {
+        success = false;
+        kill(pid, SIGKILL);
+    }
+
+    if (success && pmc != NULL && !perf_cnt_collect(pid, run_idx, pmc)) {
+        success = false;
+        kill(pid, SIGKILL);
+    }
+
+    if (success && stats != NULL && !read_proc_stats(pid, stats)) {
+        success = false;
+        kill(pid, SIGKILL);
+    }
+
+    if (has_watch) {
+        stop_startup_watch(&watch);
+        if (!watch.success)
+            success = false;
+        if (startup != NULL)
+            *startup = watch.times;
+    }
+
+    int status = 0;
+    pid_t wpid;
+    for (;;) {
+        wpid = wait4(pid, &status, 0, rusage);
+        if (wpid == -1 && errno == EINTR)
+            continue;
+        if (wpid != pid) {
+            csperror("wait4");
+            return false;
+        }
+        break;
+    }
+    if (has_rss_sampler)
+        stop_rss_sampler(rss);
+
+    if (has_pump) {
+        pthread_join(pump.thread, NULL);
+        if (!pump.success)
+            success = false;
+    }
+    if (!success)
+        return false;
+
+    if (!check_and_handle_err_pipe(err_pipe[0], 0))
+        return false;
+
+    if (has_watch && watch.timed_out) {
+        error("command '%s' did not become ready in time", desc->str);
+        return false;
+    }
+
+    // shell-like exit codes
+    if (has_watch && watch.term_time != 0.0) {
+        // Command has been terminated by us after becoming ready
+        if (rc)
+            *rc = 0;
+    } else if (WIFEXITED(status)) {
+        if (rc)
+            *rc = WEXITSTATUS(status);
+    } else if (WIFSIGNALED(status)) {
+        if (rc)
+            *rc = 128 + WTERMSIG(status);
+    } else {
+        error("process finished with unexpected status (%d)", status);
+        return false;
+    }
+
+    return true;
+}
+
+static bool exec_cmd(const struct bench_run_desc *desc, struct rusage *rusage,
+                     struct proc_stats *stats, struct rss_sampler *rss, struct perf_cnt *pmc,
+                     struct profiler *profiler, const struct run_env *env,
+                     size_t run_idx, bool is_warmup, struct startup_times *startup,
+                     int *rc)
+{
+    int err_pipe[2];
+    if (!pipe_cloexec(err_pipe))
+        return false;
+    bool success = exec_cmd_internal(desc, rusage, stats, rss, pmc, profiler, env,
+                                     run_idx, is_warmup, startup, err_pipe, rc);
+    close(err_pipe[0]);
+    if (err_pipe[1] != -1)
+        close(err_pipe[1]);
+    return success;
+}
+
+static void init_run_state(double time, const struct bench_stop_policy *policy, size_t run,
+                           double time_already_run, struct bench_run_state *state)
+{
+    memset(state, 0, sizeof(*state));
+    state->current_run = run;
+    state->start_time = time;
+    state->stop = policy;
+    state->time_run = time_already_run;
+    state->ignore_suspend = false;
+}
+
+static bool should_run(const struct bench_stop_policy *policy)
+{
+    if (policy->time_limit <= 0.0)
+        return false;
+
+    if (policy->runs == 0 && policy->min_runs == 0)
+        return false;
+
+    return true;
+}
+
+static bool should_finish_running(struct bench_run_state *state, int advance)
+{
+    state->current_run += advance;
+
+    if (state->stop->runs > 0) {
+        if (state->current_run >= state->stop->runs)
+            return true;
+    }
+
+    if (state->stop->min_runs > 0) {
+        if (state->current_run < state->stop->min_runs)
+            return false;
+    }
+
+    if (state->stop->max_runs > 0) {
+        if (state->current_run >= state->stop->max_runs)
+            return true;
+    }
+
+    double current = get_time();
+    double passed = current - state->start_time;
+    if (passed > state->stop->time_limit - state->time_run)
+        return true;
+
+    return false;
+}
+
+static bool should_suspend_round(struct bench_run_state *state)
+{
+    assert(state->stop == &g_round_stop);
+    if (state->ignore_suspend)
+        return false;
+
+    bool result = should_finish_running(state, 1);
+    if (result) {
+        if (!should_i_suspend()) {
+            state->ignore_suspend = true;
+            result = false;
+        }
+    }
+
+    return result;
+}
+
+static void close_prepare_shell(void)
+{
+    struct prepare_shell *sh = &g_prepare_shell;
+    if (sh->pid == 0)
+        return;
+    // Shell exits when it reaches end of input
+    fclose(sh->in);
+    fclose(sh->out);
+    for (;;) {
+        if (waitpid(sh->pid, NULL, 0) == -1 && errno == EINTR)
+            continue;
+        break;
+    }
+    memset(sh, 0, sizeof(*sh));
+}
+
+static bool launch_prepare_shell(void)
+{
+    struct prepare_shell *sh = &g_prepare_shell;
+    // Shell lives across runs and must not inherit counters of this thread
+    if (g_use_perf)
+        perf_cnt_release();
+    int in_pipe[2], out_pipe[2];
+    if (!pipe_cloexec(in_pipe))
+        return false;
+    if (!pipe_cloexec(out_pipe)) {
+        close(in_pipe[0]);
+        close(in_pipe[1]);
+        return false;
+    }
+    bool success = shell_launch("exec /bin/sh", in_pipe[0], out_pipe[1], -1, &sh->pid);
+    close(in_pipe[0]);
+    close(out_pipe[1]);
+    if (!success) {
+        close(in_pipe[1]);
+        close(out_pipe[0]);
+        sh->pid = 0;
+        return false;
+    }
+    sh->in = fdopen(in_pipe[1], "w");
+    sh->out = fdopen(out_pipe[0], "r");
+    if (sh->in == NULL || sh->out == NULL) {
+        csperror("fdopen");
+        if (sh->in != NULL)
+            fclose(sh->in);
+        else
+            close(in_pipe[1]);
+        if (sh->out != NULL)
+            fclose(sh->out);
+        else
+            close(out_pipe[0]);
+        kill(sh->pid, SIGKILL);
+        waitpid(sh->pid, NULL, 0);
+        memset(sh, 0, sizeof(*sh));
+        return false;
+    }
+    return true;
+}
+
+// Write command to input of persistent shell. Command is passed quoted as
+// argument to 'eval' in a subshell, so that shell parses it only when
+// executing it. This way syntax errors, such as unterminated quotes, only
+// cause subshell to exit with error and can't break the shell itself. Shell is
+// closed if writing has failed.
+static bool prepare_shell_write(struct prepare_shell *sh, const char *cmd)
+{
+    // Get EPIPE instead of SIGPIPE if shell has exited
+    sigset_t set, old_set, pending;
+    sigemptyset(&set);
+    sigaddset(&set, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &set, &old_set);
+    fputs("( eval '", sh->in);
+    for (const char *cursor = cmd; *cursor; ++cursor) {
+        if (*cursor == '\'')
+            fputs("'\\''", sh->in);
+        else
+            fputc(*cursor, sh->in);
+    }
+    fputs("' ) </dev/null >/dev/null 2>&1; echo \"" PREPARE_SHELL_SENTINEL " $?\"\n",
+          sh->in);
+    bool success = fflush(sh->in) != EOF && !ferror(sh->in);
+    if (!success) {
+        error("failed to write command to prepare shell");
+        // Closing may try to flush remaining buffered data
+        close_prepare_shell();
+    }
+    if (sigpending(&pending) == 0 && sigismember(&pending, SIGPIPE)) {
+        int sig;
+        sigwait(&set, &sig);
+    }
+    pthread_sigmask(SIG_SETMASK, &old_set, NULL);
+    return success;
+}
+
+// Execute command in persistent shell of current thread. Each command is run
+// in a subshell, so that it can't change state of the shell, which is cheaper
+// than starting new shell process. After command has finished shell writes
+// sentinel line with its exit status.
+static bool prepare_shell_execute(const char *cmd)
+{
+    struct prepare_shell *sh = &g_prepare_shell;
+    if (sh->pid == 0 && !launch_prepare_shell())
+        return false;
+    if (!prepare_shell_write(sh, cmd))
+        return false;
+    char buf[256];
+    for (;;) {
+        if (fgets(buf, sizeof(buf), sh->out) == NULL) {
+            error("prepare shell exited unexpectedly");
+            close_prepare_shell();
+            return false;
+        }
+        size_t len = strlen(PREPARE_SHELL_SENTINEL);
+        if (strncmp(buf, PREPARE_SHELL_SENTINEL, len) == 0)
+            return atoi(buf + len) == 0;
+    }
+}
+
+static bool evict_file(const char *file, int fd)
+{
+#ifdef __linux__
+    // Only clean pages can be dropped
+    fdatasync(fd);
+    int err = posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    if (err != 0) {
+        errno = err;
+        csfmtperror("failed to evict file '%s' from page cache", file);
+        return false;
+    }
+    return true;
+#else
+    (void)fd;
+    error("evicting file '%s' from page cache is not supported on this platform", file);
+    return false;
+#endif
+}
+
+static bool prewarm_file(const char *file, int fd)
+{
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        csfmtperror("failed to stat file '%s'", file);
+        return false;
+    }
+#ifdef __linux__
+    if (readahead(fd, 0, st.st_size) == 0)
+        return true;
+#endif
+    // Fall back to reading whole file
+    char buf[65536];
+    for (;;) {
+        ssize_t nr = read(fd, buf, sizeof(buf));
+        if (nr == 0)
+            break;
+        if (nr == -1) {
+            if (errno == EINTR)
+                continue;
+            csfmtperror("failed to read file '%s'", file);
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool apply_cache_state(const struct bench_run_desc *desc)
+{
+    for (size_t i = 0; i < sb_len(desc->cache_files); ++i) {
+        const char *file = desc->cache_files[i];
+        int fd = open(file, O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            csfmtperror("failed to open file '%s'", file);
+            return false;
+        }
+        bool success = true;
+        switch (desc->cache_state) {
+        case CACHE_STATE_NONE:
+            break;
+        case CACHE_STATE_COLD:
+            success = evict_file(file, fd);
+            break;
+        case CACHE_STATE_WARM:
+            success = prewarm_file(file, fd);
+            break;
+        case CACHE_STATE_BOTH:
+            ASSERT_UNREACHABLE();
+        }
+        close(fd);
+        if (!success)
+            return false;
+    }
+    return true;
+}
+
+static size_t get_llc_size(void)
+{
+    long size = -1;
+#ifdef _SC_LEVEL3_CACHE_SIZE
+    size = sysconf(_SC_LEVEL3_CACHE_SIZE);
+    if (size <= 0)
+        size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+#endif
+    if (size <= 0)
+        size = DEFAULT_LLC_SIZE;
+    return size;
+}
+
+// Evict data of previous run from CPU caches by writing to and reading from
+// buffer twice as big as last level cache. Buffer is excluded from fork, so
+// that command does not inherit its pages, which would make fork slower and
+// inflate maxrss of command.
+static bool flush_llc(void)
+{
+    if (g_llc_buffer == NULL) {
+        size_t size = 2 * get_llc_size();
+        void *buffer =
+            mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (buffer == MAP_FAILED) {
+            csperror("mmap");
+            return false;
+        }
+#ifdef MADV_DONTFORK
+        if (madvise(buffer, size, MADV_DONTFORK) == -1) {
+            csperror("madvise(MADV_DONTFORK)");
+            munmap(buffer, size);
+            return false;
+        }
+#endif
+        g_llc_buffer = buffer;
+        g_llc_buffer_size = size;
+    }
+    volatile unsigned char *buffer = g_llc_buffer;
+    unsigned char sum = 0;
+    for (size_t i = 0; i < g_llc_buffer_size; i += CACHE_LINE_SIZE)
+        buffer[i] = i;
+    for (size_t i = 0; i < g_llc_buffer_size; i += CACHE_LINE_SIZE)
+        sum += buffer[i];
+    (void)sum;
+    return true;
+}
+
+// Returns percentage of pages of cache files that are in page cache
+static bool get_cache_residency(const struct bench_run_desc *desc, double *residency)
+{
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    size_t total_pages = 0, resident_pages = 0;
+    for (size_t i = 0; i < sb_len(desc->cache_files); ++i) {
+        const char *file = desc->cache_files[i];
+        int fd = open(file, O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            csfmtperror("failed to open file '%s'", file);
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) == -1) {
+            csfmtperror("failed to stat file '%s'", file);
+            close(fd);
+            return false;
+        }
+        if (st.st_size == 0) {
+            close(fd);
+            continue;
+        }
+        void *addr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (addr == MAP_FAILED) {
+            csfmtperror("failed to map file '%s'", file);
+            return false;
+        }
+        size_t page_count = (st.st_size + page_size - 1) / page_size;
+#ifdef __APPLE__
+        char *vec = malloc(page_count);
+#else
+        unsigned char *vec = malloc(page_count);
+#endif
+        if (vec == NULL || mincore(addr, st.st_size, vec) == -1) {
+            csperror("mincore");
+            free(vec);
+            munmap(addr, st.st_size);
+            return false;
+        }
+        for (size_t j = 0; j < page_count; ++j)
+            resident_pages += vec[j] & 1;
+        total_pages += page_count;
+        free(vec);
+        munmap(addr, st.st_size);
+    }
+    *residency = total_pages ? resident_pages * 100.0 / total_pages : 0.0;
+    return true;
+}
+
+// RAPL energy counter exposed through powercap sysfs
+struct rapl_domain {
+    const char *path;
+    int fd;
+    bool is_dram;
+    // Counter wraps to zero after reaching this value
+    uint64_t max_energy;
+};
+
+static struct rapl_domain *g_rapl_domains;
+
+static bool read_sysfs_u64(int fd, const char *path, uint64_t *value)
+{
+    char buf[64];
+    ssize_t nread = pread(fd, buf, sizeof(buf) - 1, 0);
+    if (nread <= 0) {
+        csfmtperror("failed to read '%s'", path);
+        return false;
+    }
+    buf[nread] = '\0';
+    char *end;
+    *value = strtoull(buf, &end, 10);
+    if (end == buf) {
+        error("invalid value in '%s'", path);
+        return false;
+    }
+    return true;
+}
+
+static bool read_sysfs_file(const char *path, char *buf, size_t buf_size)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        csfmtperror("failed to open '%s'", path);
+        return false;
+    }
+    ssize_t nread = read(fd, buf, buf_size - 1);
+    close(fd);
+    if (nread < 0) {
+        csfmtperror("failed to read '%s'", path);
+        return false;
+    }
+    buf[nread] = '\0';
+    char *newline = strchr(buf, '\n');
+    if (newline)
+        *newline = '\0';
+    return true;
+}
+
+static void deinit_rapl(void)
+{
+    for (size_t i = 0; i < sb_len(g_rapl_domains); ++i)
+        close(g_rapl_domains[i].fd);
+    sb_free(g_rapl_domains);
+}
+
+// Find package and DRAM domains of 'intel-rapl' control type. Each of them
+// has its own directory in powercap class, subzones included.
+static bool init_rapl(bool need_dram)
+{
+    DIR *dir = opendir(g_powercap_root);
+    if (dir == NULL) {
+        csfmtperror("failed to open powercap directory '%s'", g_powercap_root);
+        return false;
+    }
+    bool has_pkg = false, has_dram = false;
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL) {
+        if (strncmp(ent->d_name, "intel-rapl:", 11) != 0)
+            continue;
+        char name[64];
+        if (!read_sysfs_file(csfmt("%s/%s/name", g_powercap_root, ent->d_name), name,
+                             sizeof(name)))
+            goto err;
+        struct rapl_domain domain;
+        memset(&domain, 0, sizeof(domain));
+        if (strncmp(name, "package", 7) == 0)
+            has_pkg = true;
+        else if (strcmp(name, "dram") == 0)
+            has_dram = domain.is_dram = true;
+        else
+            continue;
+        const char *range_path =
+            csfmt("%s/%s/max_energy_range_uj", g_powercap_root, ent->d_name);
+        char range[64];
+        if (!read_sysfs_file(range_path, range, sizeof(range)))
+            goto err;
+        domain.max_energy = strtoull(range, NULL, 10);
+        domain.path = csfmt("%s/%s/energy_uj", g_powercap_root, ent->d_name);
+        domain.fd = open(domain.path, O_RDONLY | O_CLOEXEC);
+        if (domain.fd == -1) {
+            csfmtperror("failed to open '%s'", domain.path);
+            goto err;
+        }
+        sb_push(g_rapl_domains, domain);
+    }
+    closedir(dir);
+    if (!has_pkg || (need_dram && !has_dram)) {
+        error("no RAPL %s energy domain found in '%s'", has_pkg ? "dram" : "package",
+              g_powercap_root);
+        deinit_rapl();
+        return false;
+    }
+    return true;
+err:
+    closedir(dir);
+    deinit_rapl();
+    return false;
+}
+
+static bool read_rapl(uint64_t *values)
+{
+    for (size_t i = 0; i < sb_len(g_rapl_domains); ++i) {
+        const struct rapl_domain *domain = g_rapl_domains + i;
+        if (!read_sysfs_u64(domain->fd, domain->path, values + i))
+            return false;
+    }
+    return true;
+}
+
+// Compute consumed energy in joules from two counter readings
+static void rapl_energy(const uint64_t *start, const uint64_t *end, double *pkg,
+                        double *dram)
+{
+    *pkg = *dram = 0.0;
+    for (size_t i = 0; i < sb_len(g_rapl_domains); ++i) {
+        const struct rapl_domain *domain = g_rapl_domains + i;
+        uint64_t delta = end[i] - start[i];
+        if (end[i] < start[i])
+            delta = domain->max_energy - start[i] + end[i] + 1;
+        if (domain->is_dram)
+            *dram += delta * 1e-6;
+        else
+            *pkg += delta * 1e-6;
+    }
+}
+
+static bool run_prepare_if_needed(const struct bench_run_desc *desc)
+{
+    if (desc->prepare && !prepare_shell_execute(desc->prepare)) {
+        error("failed to execute prepare command");
+        return false;
+    }
+    if (desc->cache_state != CACHE_STATE_NONE && !apply_cache_state(desc))
+        return false;
+    if ((g_flush_llc || desc->cache_state == CACHE_STATE_COLD) && !flush_llc())
+        return false;
+    return true;
+}
+
+static bool run_round_prepare_if_needed(const char *prepare)
+{
+    if (prepare && !shell_execute(prepare, -1, -1, -1, true)) {
+        error("failed to execute round prepare command");
+        return false;
+    }
+    return true;
+}
+
+// Check if service has exited without reaping it, so that its resource usage
+// can still be collected by 'stop_service'.
+static bool service_has_exited(pid_t pid, bool *exited)
+{
+    siginfo_t info;
+    memset(&info, 0, sizeof(info));
+    for (;;) {
+        if (waitid(P_PID, pid, &info, WEXITED | WNOHANG | WNOWAIT) == -1) {
+            if (errno == EINTR)
+                continue;
+            csperror("waitid");
+            return false;
+        }
+        break;
+    }
+    *exited = info.si_pid == pid;
+    return true;
+}
+
+static bool wait_service_ready(const struct bench_run_data *rd)
+{
+    const struct bench_run_desc *desc = rd->desc;
+    if (desc->service_ready == NULL)
+        return true;
+
+    double start_time = get_time();
+    for (;;) {
+        bool exited;
+        if (!service_has_exited(rd->service_pid, &exited))
+            return false;
+        if (exited) {
+            error("service '%s' exited before becoming ready", desc->service);
+            return false;
+        }
+        if (shell_execute(desc->service_ready, -1, -1, -1, true))
+            break;
+        if (get_time() - start_time > g_service_timeout) {
+            error("service '%s' did not become ready in time", desc->service);
+            return false;
+        }
+        usleep(SERVICE_POLL_INTERVAL_US);
+    }
+    return true;
+}
+
+// Launch service command in background. The child is held on a pipe until
+// performance counters are attached to it, so that counters cover whole
+// lifetime of service including all threads and processes it spawns.
+static bool launch_service(struct bench_run_data *rd)
+{
+    char *argv[] = {"sh", "-c", (char *)rd->desc->service, NULL};
+    int sync_pipe[2];
+    if (!pipe_cloexec(sync_pipe))
+        return false;
+    // Service runs concurrently with benchmark and must not inherit counters
+    // used to measure it
+    if (g_use_perf)
+        perf_cnt_release();
+
+    pid_t pid = fork();
+    if (pid == -1) {
+        csperror("fork");
+        close(sync_pipe[0]);
+        close(sync_pipe[1]);
+        return false;
+    }
+    if (pid == 0) {
+        close(sync_pipe[1]);
+        // Put service in its own process group so that all processes it
+        // spawns can be stopped together
+        setpgid(0, 0);
+        int fd = open("/dev/null", O_RDWR);
+        if (fd == -1 || dup2(fd, STDIN_FILENO) == -1 || dup2(fd, STDOUT_FILENO) == -1 ||
+            dup2(fd, STDERR_FILENO) == -1)
+            _exit(-1);
+        close(fd);
+        char c;
+        if (read(sync_pipe[0], &c, 1) != 1)
+            _exit(-1);
+        execv("/bin/sh", argv);
+        _exit(-1);
+    }
+    close(sync_pipe[0]);
+    // Set process group in parent too to avoid race with the child
+    setpgid(pid, pid);
+    rd->service_pid = pid;
+    if (g_use_perf) {
+        rd->service_pmc = perf_cnt_attach(pid);
+        if (rd->service_pmc == NULL) {
+            // Closing the pipe makes child exit, it is reaped in 'stop_service'
+            close(sync_pipe[1]);
+            return false;
+        }
+    }
+    bool success = write(sync_pipe[1], "", 1) == 1;
+    if (!success)
+        csperror("write");
+    close(sync_pipe[1]);
+    return success && wait_service_ready(rd);
+}
+
+// Stop background process running in its own process group and reap it
+static bool stop_process_group(pid_t pid, struct rusage *rusage)
+{
+    // Give process a chance to shut down gracefully before killing it
+    if (kill(-pid, SIGTERM) == -1 && errno != ESRCH) {
+        csperror("kill");
+        return false;
+    }
+    double start_time = get_time();
+    bool killed = false;
+    int status;
+    for (;;) {
+        int options = killed ? 0 : WNOHANG;
+        pid_t wpid = wait4(pid, &status, options, rusage);
+        if (wpid == pid)
+            break;
+        if (wpid == -1) {
+            if (errno == EINTR)
+                continue;
+            csperror("wait4");
+            return false;
+        }
+        if (get_time() - start_time > SERVICE_KILL_TIMEOUT) {
+            kill(-pid, SIGKILL);
+            killed = true;
+            continue;
+        }
+        usleep(SERVICE_POLL_INTERVAL_US);
+    }
+    // Do not leave behind processes that ignored SIGTERM
+    kill(-pid, SIGKILL);
+    return true;
+}
+
+static bool stop_service(struct bench_run_data *rd, struct service_stats *stats)
+{
+    pid_t pid = rd->service_pid;
+    rd->service_pid = 0;
+    struct rusage rusage;
+    if (!stop_process_group(pid, &rusage))
         return false;
+
+    memset(stats, 0, sizeof(*stats));
+    stats->utime = rusage.ru_utime.tv_sec + (double)rusage.ru_utime.tv_usec / 1e6;
+    stats->stime = rusage.ru_stime.tv_sec + (double)rusage.ru_stime.tv_usec / 1e6;
+#ifdef __APPLE__
+    stats->maxrss = rusage.ru_maxrss;
+#else
+    // Linux reports maxrss in kilobytes
+    stats->maxrss = rusage.ru_maxrss * 1024.0;
+#endif
+    if (rd->service_pmc) {
+        struct perf_cnt_tracker *tracker = rd->service_pmc;
+        rd->service_pmc = NULL;
+        if (!perf_cnt_detach(tracker, &stats->pmc))
+            return false;
+        stats->has_pmc = true;
     }
+    return true;
+}
 
+static bool load_requests(void)
+{
+    FILE *f = fopen(g_requests, "r");
+    if (f == NULL) {
+        csfmtperror("failed to open file '%s'", g_requests);
+        return false;
+    }
+    char *line = NULL;
+    size_t line_cap = 0;
+    ssize_t len;
+    while ((len = getline(&line, &line_cap, f)) != -1) {
+        size_t offset = sb_len(g_request_data);
+        sb_push(g_request_offsets, offset);
+        sb_resize(g_request_data, offset + len);
+        memcpy(g_request_data + offset, line, len);
+        // Each request has to be terminated by newline for command to see it
+        if (line[len - 1] != '\n')
+            sb_push(g_request_data, '\n');
+    }
+    free(line);
+    fclose(f);
+    if (sb_len(g_request_offsets) == 0) {
+        error("request file '%s' is empty", g_requests);
+        return false;
+    }
+    sb_push(g_request_offsets, sb_len(g_request_data));
     return true;
 }
 
-static bool exec_cmd(const struct bench_run_desc *desc, struct rusage *rusage,
-                     struct perf_cnt *pmc, bool is_warmup, int *rc)
+static bool launch_request_server(struct bench_run_data *rd)
 {
-    int err_pipe[2];
-    if (!pipe_cloexec(err_pipe))
+    const struct bench_run_desc *desc = rd->desc;
+    int in_pipe[2], out_pipe[2], err_pipe[2];
+    if (!pipe_cloexec(in_pipe))
         return false;
-    bool success = exec_cmd_internal(desc, rusage, pmc, is_warmup, err_pipe, rc);
-    close(err_pipe[0]);
+    if (!pipe_cloexec(out_pipe))
+        goto close_in;
+    if (!pipe_cloexec(err_pipe))
+        goto close_out;
+    if (fcntl(in_pipe[1], F_SETFL, O_NONBLOCK) == -1 ||
+        fcntl(out_pipe[0], F_SETFL, O_NONBLOCK) == -1) {
+        csperror("fcntl");
+        goto close_err;
+    }
+    pid_t pid = fork();
+    if (pid == -1) {
+        csperror("fork");
+        goto close_err;
+    }
+    if (pid == 0) {
+        // Put command in its own process group like service
+        setpgid(0, 0);
+        if (dup2(in_pipe[0], STDIN_FILENO) == -1 || dup2(out_pipe[1], STDOUT_FILENO) == -1) {
+            csfdperror(err_pipe[1], "dup2");
+            _exit(-1);
+        }
+        if (desc->output == OUTPUT_POLICY_NULL) {
+            int fd = open("/dev/null", O_WRONLY);
+            if (fd == -1 || dup2(fd, STDERR_FILENO) == -1) {
+                csfdperror(err_pipe[1], "dup2");
+                _exit(-1);
+            }
+            close(fd);
+        }
+        execvp(desc->exec, (char **)desc->argv);
+        csfdfmtperror(err_pipe[1], "execvp(\"%s\")", desc->exec);
+        _exit(-1);
+    }
+    // Set process group in parent too to avoid race with the child
+    setpgid(pid, pid);
+    struct request_server *server = &rd->server;
+    memset(server, 0, sizeof(*server));
+    server->pid = pid;
+    server->in_fd = in_pipe[1];
+    server->out_fd = out_pipe[0];
+    close(in_pipe[0]);
+    close(out_pipe[1]);
     close(err_pipe[1]);
+    // Wait until command is executed, err_pipe is closed on exec
+    bool success = check_and_handle_err_pipe(err_pipe[0], -1);
+    close(err_pipe[0]);
     return success;
+close_err:
+    close(err_pipe[0]);
+    close(err_pipe[1]);
+close_out:
+    close(out_pipe[0]);
+    close(out_pipe[1]);
+close_in:
+    close(in_pipe[0]);
+    close(in_pipe[1]);
+    return false;
 }
 
-static void init_run_state(double time, const struct bench_stop_policy *policy, size_t run,
-                           double time_already_run, struct bench_run_state *state)
+static bool stop_request_server(struct bench_run_data *rd)
 {
-    memset(state, 0, sizeof(*state));
-    state->current_run = run;
-    state->start_time = time;
-    state->stop = policy;
-    state->time_run = time_already_run;
-    state->ignore_suspend = false;
+    struct request_server *server = &rd->server;
+    pid_t pid = server->pid;
+    server->pid = 0;
+    close(server->in_fd);
+    close(server->out_fd);
+    sb_free(server->send_times);
+    sb_free(server->latencies);
+    struct rusage rusage;
+    return stop_process_group(pid, &rusage);
 }
 
-static bool should_run(const struct bench_stop_policy *policy)
+static bool write_request(struct request_server *server)
 {
-    if (policy->time_limit <= 0.0)
-        return false;
-
-    if (policy->runs == 0 && policy->min_runs == 0)
+    size_t request_count = sb_len(g_request_offsets) - 1;
+    size_t start = g_request_offsets[server->next_request];
+    size_t len = g_request_offsets[server->next_request + 1] - start;
+    if (server->written == 0)
+        server->write_start_time = get_time();
+    ssize_t nw = write(server->in_fd, g_request_data + start + server->written,
+                       len - server->written);
+    if (nw == -1) {
+        if (errno == EAGAIN || errno == EINTR)
+            return true;
+        if (errno == EPIPE)
+            error("command exited before reading all requests");
+        else
+            csperror("write");
         return false;
-
+    }
+    server->written += nw;
+    if (server->written == len) {
+        sb_push(server->send_times, server->write_start_time);
+        server->written = 0;
+        // Requests are sent in a loop if there are more runs than requests
+        server->next_request = (server->next_request + 1) % request_count;
+    }
     return true;
 }
 
-static bool should_finish_running(struct bench_run_state *state, int advance)
+static bool read_responses(struct request_server *server)
 {
-    state->current_run += advance;
-
-    if (state->stop->runs > 0) {
-        if (state->current_run >= state->stop->runs)
+    char buf[PIPE_DRAIN_CHUNK];
+    ssize_t nr = read(server->out_fd, buf, sizeof(buf));
+    if (nr == -1) {
+        if (errno == EAGAIN || errno == EINTR)
             return true;
+        csperror("read");
+        return false;
     }
-
-    if (state->stop->min_runs > 0) {
-        if (state->current_run < state->stop->min_runs)
+    if (nr == 0) {
+        error("command exited before responding to all requests");
+        return false;
+    }
+    double now = get_time();
+    for (ssize_t i = 0; i < nr; ++i) {
+        if (buf[i] != '\n')
+            continue;
+        if (server->send_head == sb_len(server->send_times)) {
+            error("command wrote more lines than it has been sent requests");
             return false;
+        }
+        sb_push(server->latencies, now - server->send_times[server->send_head++]);
+    }
+    if (server->send_head == sb_len(server->send_times)) {
+        sb_purge(server->send_times);
+        server->send_head = 0;
     }
+    return true;
+}
 
-    if (state->stop->max_runs > 0) {
-        if (state->current_run >= state->stop->max_runs)
+// Send requests and read responses until latency of at least one response is
+// available. If 'drain' is set, no new requests are sent, and responses to all
+// outstanding requests are read and discarded instead.
+static bool exchange_requests_internal(struct request_server *server, bool drain)
+{
+    for (;;) {
+        size_t in_flight = sb_len(server->send_times) - server->send_head;
+        if (drain && in_flight == 0 && server->written == 0) {
+            sb_purge(server->latencies);
+            server->latency_head = 0;
+            return true;
+        }
+        if (!drain && server->latency_head != sb_len(server->latencies))
             return true;
+        bool can_write =
+            server->written != 0 || (!drain && in_flight < (size_t)g_pipeline_depth);
+        struct pollfd fds[2];
+        fds[0].fd = server->out_fd;
+        fds[0].events = POLLIN;
+        fds[1].fd = server->in_fd;
+        fds[1].events = POLLOUT;
+        int ret = poll(fds, can_write ? 2 : 1, (int)(g_request_timeout * 1000));
+        if (ret == -1) {
+            if (errno == EINTR)
+                continue;
+            csperror("poll");
+            return false;
+        }
+        // Commands that block-buffer stdout never respond
+        if (ret == 0) {
+            char buf[256];
+            format_time(buf, sizeof(buf), g_request_timeout);
+            error("no response within %s (is stdout of command line-buffered?)", buf);
+            return false;
+        }
+        if (can_write && fds[1].revents && !write_request(server))
+            return false;
+        if (fds[0].revents && !read_responses(server))
+            return false;
     }
+}
 
-    double current = get_time();
-    double passed = current - state->start_time;
-    if (passed > state->stop->time_limit - state->time_run)
-        return true;
+static bool exchange_requests(struct request_server *server, bool drain)
+{
+    // Get EPIPE instead of SIGPIPE if command exits without reading requests
+    sigset_t set, old_set, pending;
+    sigemptyset(&set);
+    sigaddset(&set, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &set, &old_set);
+    bool success = exchange_requests_internal(server, drain);
+    if (sigpending(&pending) == 0 && sigismember(&pending, SIGPIPE)) {
+        int sig;
+        sigwait(&set, &sig);
+    }
+    pthread_sigmask(SIG_SETMASK, &old_set, NULL);
+    return success;
+}
 
-    return false;
+static double pop_request_latency(struct request_server *server)
+{
+    double latency = server->latencies[server->latency_head++];
+    if (server->latency_head == sb_len(server->latencies)) {
+        sb_purge(server->latencies);
+        server->latency_head = 0;
+    }
+    return latency;
 }
 
-static bool should_suspend_round(struct bench_run_state *state)
+// Counterpart of 'exec_and_measure' in --requests mode, where each run is a
+// single request
+static bool exec_request_and_measure(struct bench_run_data *rd)
 {
-    assert(state->stop == &g_round_stop);
-    if (state->ignore_suspend)
+    double start_time = get_time();
+    if (!exchange_requests(&rd->server, false))
         return false;
-
-    bool result = should_finish_running(state, 1);
-    if (result) {
-        if (!should_i_suspend()) {
-            state->ignore_suspend = true;
-            result = false;
-        }
+    double latency = pop_request_latency(&rd->server);
+    struct bench *bench = rd->bench;
+    bench->has_requests = true;
+    bench->requests.time += get_time() - start_time;
+    ++bench->requests.count;
+    hdr_hist_record(&bench->requests.latency, latency);
+    ++bench->run_count;
+    sb_push(bench->exit_codes, 0);
+    for (size_t meas_idx = 0; meas_idx < rd->desc->meas_count; ++meas_idx) {
+        if (rd->desc->meas[meas_idx].kind == MEAS_REQ_LATENCY)
+            sb_push(bench->meas[meas_idx], latency);
     }
-
-    return result;
+    return true;
 }
 
-static bool run_prepare_if_needed(const char *prepare)
+static bool start_bench(struct bench_run_data *rd)
 {
-    if (prepare && !shell_execute(prepare, -1, -1, -1, true)) {
-        error("failed to execute prepare command");
+    const struct bench_run_desc *desc = rd->desc;
+    rd->started = true;
+    if (desc->setup && !shell_execute(desc->setup, -1, -1, -1, true)) {
+        error("failed to execute setup command");
         return false;
     }
+    if (desc->service && !launch_service(rd))
+        return false;
+    if (g_requests != NULL && !launch_request_server(rd))
+        return false;
     return true;
 }
 
-static bool run_round_prepare_if_needed(const char *prepare)
+static bool finish_bench(struct bench_run_data *rd)
 {
-    if (prepare && !shell_execute(prepare, -1, -1, -1, true)) {
-        error("failed to execute round prepare command");
+    const struct bench_run_desc *desc = rd->desc;
+    rd->started = false;
+    if (rd->server.pid != 0 && !stop_request_server(rd))
+        return false;
+    if (rd->service_pid != 0) {
+        rd->bench->has_service = true;
+        if (!stop_service(rd, &rd->bench->service))
+            return false;
+    }
+    if (desc->teardown && !shell_execute(desc->teardown, -1, -1, -1, true)) {
+        error("failed to execute teardown command");
         return false;
     }
     return true;
 }
 
-static bool warmup(const struct bench_run_desc *desc)
+// Called when benchmarking has been aborted to not leave services running
+static void abort_bench(struct bench_run_data *rd)
+{
+    if (!rd->started)
+        return;
+    rd->started = false;
+    if (rd->server.pid != 0)
+        stop_request_server(rd);
+    if (rd->service_pid != 0) {
+        struct service_stats stats;
+        stop_service(rd, &stats);
+    }
+    if (rd->desc->teardown)
+        shell_execute(rd->desc->teardown, -1, -1, -1, true);
+}
+
+void run_signal_cleanup(void)
+{
+    struct bench_run_data *rds = g_signal_rds;
+    for (size_t i = 0; rds && i < g_signal_rd_count; ++i) {
+        pid_t pid = rds[i].service_pid;
+        if (pid != 0)
+            kill(-pid, SIGKILL);
+        pid = rds[i].server.pid;
+        if (pid != 0)
+            kill(-pid, SIGKILL);
+    }
+    for (size_t i = 0; i < MAX_WATCHED_PIDS; ++i) {
+        pid_t pid = atomic_load(g_watched_pids + i);
+        if (pid != 0)
+            kill(-pid, SIGKILL);
+    }
+}
+
+static bool warmup(struct bench_run_data *rd)
 {
+    const struct bench_run_desc *desc = rd->desc;
     if (!should_run(&g_warmup_stop))
         return true;
 
     struct bench_run_state state;
     init_run_state(get_time(), &g_warmup_stop, 0, 0, &state);
     for (;;) {
-        if (!run_prepare_if_needed(desc->prepare))
+        if (!run_prepare_if_needed(desc))
             return false;
-        if (!exec_cmd(desc, NULL, NULL, true, NULL)) {
+        if (g_requests != NULL) {
+            if (!exchange_requests(&rd->server, false))
+                return false;
+            (void)pop_request_latency(&rd->server);
+        } else if (!exec_cmd(desc, NULL, NULL, NULL, NULL, NULL, NULL, 0, true, NULL,
+                             NULL)) {
             return false;
         }
         if (should_finish_running(&state, 1))
             break;
     }
+    // Responses to warmup requests should not be counted as measured
+    if (g_requests != NULL && !exchange_requests(&rd->server, true))
+        return false;
+    return true;
+}
+
+// Execute additional runs of benchmark under sampling profiler. These runs are
+// not measured, because sampling slows command down. Like warmup runs, their
+// output is discarded.
+static bool profile_bench(struct bench_run_data *rd)
+{
+    struct profiler *profiler = profiler_open();
+    if (profiler == NULL)
+        return false;
+    for (int i = 0; i < g_profile_runs; ++i) {
+        if (!run_prepare_if_needed(rd->desc) ||
+            !exec_cmd(rd->desc, NULL, NULL, NULL, NULL, profiler, NULL, 0, true, NULL,
+                      NULL)) {
+            profiler_close(profiler, NULL);
+            return false;
+        }
+    }
+    profiler_close(profiler, &rd->bench->profile);
     return true;
 }
 
@@ -617,26 +2991,156 @@ static bool warmup(const struct bench_run_desc *desc)
 // 5. Collect all stdout outputs to a single file if custom measurements are
 //      used and store indexes to be able to identify each run
 // 6. Collect all measurements specified
+static size_t perf_cnt_idx(const struct meas *meas)
+{
+    switch (meas->kind) {
+    case MEAS_PERF_CYCLES:
+        return PERF_CNT_CYCLES;
+    case MEAS_PERF_INS:
+        return PERF_CNT_INSTRUCTIONS;
+    case MEAS_PERF_BRANCH:
+        return PERF_CNT_BRANCHES;
+    case MEAS_PERF_BRANCHM:
+        return PERF_CNT_BRANCH_MISSES;
+    case MEAS_PERF_EVENT:
+        return PERF_CNT_BUILTIN_COUNT + meas->event_idx;
+    default:
+        break;
+    }
+    ASSERT_UNREACHABLE();
+}
+
 static bool exec_and_measure(struct bench_run_data *rd)
 {
+    if (g_requests != NULL)
+        return exec_request_and_measure(rd);
     struct rusage rusage;
     memset(&rusage, 0, sizeof(rusage));
     struct perf_cnt pmc_ = {0};
     struct perf_cnt *pmc = NULL;
     if (g_use_perf)
         pmc = &pmc_;
+    double residency = 0.0;
+    if (sb_len(rd->desc->cache_files) != 0 && !get_cache_residency(rd->desc, &residency))
+        return false;
+    size_t rapl_count = sb_len(g_rapl_domains);
+    uint64_t *rapl_start = NULL, *rapl_end = NULL;
+    if (rapl_count != 0) {
+        rapl_start = calloc(2 * rapl_count, sizeof(*rapl_start));
+        rapl_end = rapl_start + rapl_count;
+        if (!read_rapl(rapl_start)) {
+            free(rapl_start);
+            return false;
+        }
+    }
+    // Tracer is opened for each run, because suspended benchmark can be
+    // resumed on another thread
+    struct profiler *off_cpu = NULL;
+    if (g_use_off_cpu) {
+        off_cpu = off_cpu_profiler_open();
+        if (off_cpu == NULL) {
+            free(rapl_start);
+            return false;
+        }
+    }
+    struct run_env env;
+    bool use_run_env =
+        g_alloc_shim_path[0] != '\0' || g_use_probes || g_perf_roi || g_use_ld_stats;
+    int alloc_fd = -1;
+    struct probe_run probe = {-1, NULL, 0};
+    char ld_dir[64] = {0};
+    if (use_run_env) {
+        init_run_env(&env);
+        if ((g_alloc_shim_path[0] != '\0' && (alloc_fd = setup_alloc_shim(&env)) == -1) ||
+            (g_use_probes && !setup_probes(&env, &probe)) ||
+            (g_perf_roi && !setup_perf_roi(&env, rd->bench->run_count)) ||
+            (g_use_ld_stats && !setup_ld_stats(&env, ld_dir, sizeof(ld_dir)))) {
+            free_probe_run(&probe);
+            if (alloc_fd != -1)
+                close(alloc_fd);
+            free_run_env(&env);
+            if (off_cpu != NULL)
+                profiler_close(off_cpu, NULL);
+            free(rapl_start);
+            return false;
+        }
+    }
     double wall_clock_start = get_time();
     __asm__ volatile("" ::: "memory");
     int rc = -1;
-    if (!exec_cmd(rd->desc, &rusage, pmc, false, &rc))
-        return false;
+    struct proc_stats stats = {0};
+    struct rss_sampler rss;
+    memset(&rss, 0, sizeof(rss));
+    bool use_proc_stats = g_use_proc_io || g_use_schedstat;
+    struct startup_times startup = {0.0, 0.0};
+    bool use_startup = g_use_ttfb || g_ready_mode;
+    bool success = exec_cmd(rd->desc, &rusage, use_proc_stats ? &stats : NULL,
+                            g_rss_interval != 0.0 ? &rss : NULL, pmc, off_cpu,
+                            use_run_env ? &env : NULL, rd->bench->run_count, false,
+                            use_startup ? &startup : NULL, &rc);
     __asm__ volatile("" ::: "memory");
     double wall_clock_end = get_time();
+    // Energy counters are read before any post-processing, so that energy
+    // covers the same interval as wall clock time
+    double energy_pkg = 0.0, energy_dram = 0.0;
+    if (rapl_count != 0) {
+        success = success && read_rapl(rapl_end);
+        rapl_energy(rapl_start, rapl_end, &energy_pkg, &energy_dram);
+        free(rapl_start);
+    }
+    double off_cpu_times[OFF_CPU_REASON_COUNT] = {0};
+    if (off_cpu != NULL) {
+        profiler_off_cpu_times(off_cpu, off_cpu_times);
+        profiler_close(off_cpu, success ? &rd->bench->off_cpu : NULL);
+    }
+    struct alloc_totals alloc_totals = {0};
+    if (alloc_fd != -1) {
+        success = success && read_alloc_totals(alloc_fd, &alloc_totals);
+        close(alloc_fd);
+    }
+    if (probe.shm != NULL) {
+        success = success && read_probes(rd, &probe);
+        free_probe_run(&probe);
+    }
+    double ld_stats[LD_STAT_COUNT] = {0};
+    if (ld_dir[0] != '\0') {
+        // Directory has to be removed even if command has failed
+        bool read_ld = read_ld_stats(ld_dir, success && rc == 0, ld_stats);
+        success = success && read_ld;
+    }
+    if (use_run_env)
+        free_run_env(&env);
+    double rss_integral = 0.0, rss_mean = 0.0;
+    if (g_rss_interval != 0.0) {
+        if (!success) {
+            sb_free(rss.samples);
+            return false;
+        }
+        if (sb_len(rss.samples) < 2) {
+            error("command '%s' has finished before two RSS samples could be taken, "
+                  "decrease --rss-timeline interval",
+                  rd->desc->str);
+            sb_free(rss.samples);
+            return false;
+        }
+        rss_timeline_stats(rss.samples, rss.end_time, &rss_integral, &rss_mean);
+        sb_push(rd->bench->rss_timelines, rss.samples);
+    }
+    if (!success)
+        return false;
 
     if (!g_ignore_failure && rc != 0) {
         error("command '%s' finished with non-zero exit code (%d)", rd->desc->str, rc);
         return false;
     }
+    if (g_use_ttfb && startup.first_byte == 0.0) {
+        error("command '%s' did not write anything to stdout", rd->desc->str);
+        return false;
+    }
+    if (g_ready_mode && startup.ready == 0.0) {
+        error("command '%s' exited before becoming ready", rd->desc->str);
+        return false;
+    }
 
     ++rd->bench->run_count;
     sb_push(rd->bench->exit_codes, rc);
@@ -653,7 +3157,8 @@ static bool exec_and_measure(struct bench_run_data *rd)
     for (size_t meas_idx = 0; meas_idx < rd->desc->meas_count; ++meas_idx) {
         const struct meas *meas = rd->desc->meas + meas_idx;
         // Handled separately
-        if (meas->kind == MEAS_CUSTOM || meas->kind == MEAS_CUSTOM_RE)
+        if (meas->kind == MEAS_CUSTOM || meas->kind == MEAS_CUSTOM_RE ||
+            meas->kind == MEAS_CUSTOM_RE_ITER || meas->kind == MEAS_EXPR)
             continue;
         double val = 0.0;
         switch (meas->kind) {
@@ -681,28 +3186,120 @@ static bool exec_and_measure(struct bench_run_data *rd)
         case MEAS_RUSAGE_NIVCSW:
             val = rusage.ru_nivcsw;
             break;
-        case MEAS_PERF_CYCLES:
-            assert(pmc);
-            assert(g_use_perf);
-            val = pmc->cycles;
+        case MEAS_RUSAGE_CPUTIME:
+            val = rusage.ru_utime.tv_sec + (double)rusage.ru_utime.tv_usec / 1e6 +
+                  rusage.ru_stime.tv_sec + (double)rusage.ru_stime.tv_usec / 1e6;
             break;
-        case MEAS_PERF_INS:
-            assert(pmc);
-            assert(g_use_perf);
-            val = pmc->instructions;
+        case MEAS_RUSAGE_FLT:
+            val = rusage.ru_minflt + rusage.ru_majflt;
+            break;
+        case MEAS_RUSAGE_CSW:
+            val = rusage.ru_nvcsw + rusage.ru_nivcsw;
             break;
+        case MEAS_PERF_CYCLES:
+        case MEAS_PERF_INS:
         case MEAS_PERF_BRANCH:
+        case MEAS_PERF_BRANCHM:
+        case MEAS_PERF_EVENT: {
             assert(pmc);
             assert(g_use_perf);
-            val = pmc->branches;
+            size_t idx = perf_cnt_idx(meas);
+            // Event has not been counted in this run with --perf-rotate
+            if (!pmc->counted[idx])
+                continue;
+            val = pmc->values[idx];
             break;
-        case MEAS_PERF_BRANCHM:
+        }
+        case MEAS_TMA:
             assert(pmc);
-            assert(g_use_perf);
-            val = pmc->missed_branches;
+            if (!perf_tma_metric(pmc, meas->event_idx, &val))
+                continue;
+            break;
+        case MEAS_PIPE_BYTES_RATE:
+            val = rd->desc->pipe_input_size / (wall_clock_end - wall_clock_start);
+            break;
+        case MEAS_PIPE_RECORDS_RATE:
+            val = rd->desc->pipe_record_count / (wall_clock_end - wall_clock_start);
+            break;
+        case MEAS_CACHE_RESIDENCY:
+            val = residency;
+            break;
+        case MEAS_ENERGY_PKG:
+            val = energy_pkg;
+            break;
+        case MEAS_ENERGY_DRAM:
+            val = energy_dram;
+            break;
+        case MEAS_AVG_POWER:
+            val = energy_pkg / (wall_clock_end - wall_clock_start);
+            break;
+        case MEAS_IO_RCHAR:
+            val = stats.rchar;
+            break;
+        case MEAS_IO_WCHAR:
+            val = stats.wchar;
+            break;
+        case MEAS_IO_SYSCR:
+            val = stats.syscr;
+            break;
+        case MEAS_IO_SYSCW:
+            val = stats.syscw;
+            break;
+        case MEAS_IO_READ_BYTES:
+            val = stats.read_bytes;
+            break;
+        case MEAS_IO_WRITE_BYTES:
+            val = stats.write_bytes;
+            break;
+        case MEAS_SCHED_RUN_DELAY:
+            val = stats.run_delay * 1e-9;
+            break;
+        case MEAS_SCHED_TIMESLICES:
+            val = stats.timeslices;
+            break;
+        case MEAS_OFF_CPU_IO:
+        case MEAS_OFF_CPU_FUTEX:
+        case MEAS_OFF_CPU_SLEEP:
+        case MEAS_OFF_CPU_PREEMPT:
+        case MEAS_OFF_CPU_OTHER:
+            val = off_cpu_times[meas->kind - MEAS_OFF_CPU_IO];
+            break;
+        case MEAS_ALLOCS:
+            val = alloc_totals.allocs;
+            break;
+        case MEAS_ALLOC_BYTES:
+            val = alloc_totals.bytes;
+            break;
+        case MEAS_PEAK_HEAP:
+            val = alloc_totals.peak_heap;
+            break;
+        case MEAS_PROBE:
+            val = rd->probe_values[meas_idx];
+            break;
+        case MEAS_TTFB:
+            val = startup.first_byte - wall_clock_start;
+            break;
+        case MEAS_LD_STARTUP:
+        case MEAS_LD_RELOC_TIME:
+        case MEAS_LD_LOAD_TIME:
+        case MEAS_LD_RELOCS:
+        case MEAS_LD_RELATIVE_RELOCS:
+            val = ld_stats[meas->kind - MEAS_LD_STARTUP];
+            break;
+        case MEAS_TIME_TO_READY:
+            val = startup.ready - wall_clock_start;
+            break;
+        case MEAS_RSS_MEAN:
+            val = rss_mean;
+            break;
+        case MEAS_RSS_SECONDS:
+            val = rss_integral / (1 << 20);
             break;
         case MEAS_CUSTOM:
         case MEAS_CUSTOM_RE:
+        case MEAS_CUSTOM_RE_ITER:
+        case MEAS_EXPR:
+        case MEAS_REQ_LATENCY:
             ASSERT_UNREACHABLE();
         }
         sb_push(rd->bench->meas[meas_idx], val);
@@ -793,7 +3390,7 @@ static enum bench_run_result run_benchmark_exact_runs(struct bench_run_data *rd)
     struct bench_run_state round_state;
     init_run_state(get_time(), &g_round_stop, 0, 0, &round_state);
     for (int run_idx = rd->bench->run_count; run_idx < g_bench_stop.runs; ++run_idx) {
-        if (!run_prepare_if_needed(rd->desc->prepare))
+        if (!run_prepare_if_needed(rd->desc))
             return BENCH_RUN_ERROR;
         if (!exec_and_measure(rd))
             return BENCH_RUN_ERROR;
@@ -819,7 +3416,7 @@ static enum bench_run_result run_benchmark_adaptive_runs(struct bench_run_data *
     init_run_state(start_time, &g_bench_stop, rd->bench->run_count, rd->time_run, &state);
     init_run_state(start_time, &g_round_stop, 0, 0, &round_state);
     for (;;) {
-        if (!run_prepare_if_needed(rd->desc->prepare))
+        if (!run_prepare_if_needed(rd->desc))
             return BENCH_RUN_ERROR;
         if (!exec_and_measure(rd))
             return BENCH_RUN_ERROR;
@@ -863,12 +3460,17 @@ static enum bench_run_result run_bench(struct bench_run_data *rd)
 {
     progress_bar_at_warmup(rd->comm);
 
+    if (!rd->started && rd->bench->run_count == 0 && !start_bench(rd)) {
+        progress_bar_abort(rd->comm);
+        return BENCH_RUN_ERROR;
+    }
+
     if (!run_round_prepare_if_needed(rd->desc->round_prepare)) {
         progress_bar_abort(rd->comm);
         return BENCH_RUN_ERROR;
     }
 
-    if (!warmup(rd->desc)) {
+    if (!warmup(rd)) {
         progress_bar_abort(rd->comm);
         return BENCH_RUN_ERROR;
     }
@@ -883,6 +3485,16 @@ static enum bench_run_result run_bench(struct bench_run_data *rd)
     else
         result = run_benchmark_adaptive_runs(rd);
 
+    // Requests that are in flight when benchmark is suspended would otherwise
+    // include time of other benchmarks in their latency
+    if (result == BENCH_RUN_SUSPENDED && rd->server.pid != 0 &&
+        !exchange_requests(&rd->server, true))
+        result = BENCH_RUN_ERROR;
+    if (result == BENCH_RUN_FINISHED && g_profile && !profile_bench(rd))
+        result = BENCH_RUN_ERROR;
+    if (result == BENCH_RUN_FINISHED && !finish_bench(rd))
+        result = BENCH_RUN_ERROR;
+
     switch (result) {
     case BENCH_RUN_FINISHED:
         progress_bar_finished(rd->comm);
@@ -926,11 +3538,23 @@ static bool run_benches_single_threaded(struct run_task_queue *q)
     return true;
 }
 
+static bool run_benches_worker_internal(struct run_task_queue *q)
+{
+    bool success = run_benches_single_threaded(q);
+    close_prepare_shell();
+    if (g_use_perf)
+        perf_cnt_release();
+    if (g_llc_buffer != NULL)
+        munmap(g_llc_buffer, g_llc_buffer_size);
+    g_llc_buffer = NULL;
+    return success;
+}
+
 static void *run_bench_worker(void *raw)
 {
     struct run_task_queue *q = raw;
     init_rng_state();
-    if (!run_benches_single_threaded(q))
+    if (!run_benches_worker_internal(q))
         return (void *)-1;
     return NULL;
 }
@@ -1389,7 +4013,7 @@ static bool execute_run_tasks(struct bench_run_data *rds, size_t count, size_t t
 
     bool success;
     if (thread_count == 1) {
-        success = run_benches_single_threaded(&q);
+        success = run_benches_worker_internal(&q);
     } else {
         success = run_benches_multi_threaded(&q, thread_count);
     }
@@ -1562,7 +4186,7 @@ static char **file_to_line_list(const char *start)
 }
 
 static bool run_re_on_file(const struct bench_run_desc *desc, struct bench *bench,
-                           char *file_buffer, const struct meas **meas_list,
+                           size_t run_idx, char *file_buffer, const struct meas **meas_list,
                            regex_t *regexes)
 {
     bool success = false;
@@ -1573,6 +4197,8 @@ static bool run_re_on_file(const struct bench_run_desc *desc, struct bench *benc
         regex_t *re = regexes + meas_idx;
 
         bool had_match = false;
+        size_t match_count = 0;
+        double sum = 0.0;
         for (size_t line_idx = 0; line_idx < sb_len(lines); ++line_idx) {
             const char *line = lines[line_idx];
 
@@ -1598,16 +4224,24 @@ static bool run_re_on_file(const struct bench_run_desc *desc, struct bench *benc
                 error("invalid custom measurement output '%s'", file_buffer);
                 goto err;
             }
-            sb_push(bench->meas[meas - desc->meas], value);
-
             had_match = true;
-            break;
+            if (meas->kind != MEAS_CUSTOM_RE_ITER) {
+                sb_push(bench->meas[meas - desc->meas], value);
+                break;
+            }
+            struct iter_samples *iters = bench->iters + (meas - desc->meas);
+            sb_push(iters->values, value);
+            sb_push(iters->runs, run_idx);
+            sum += value;
+            ++match_count;
         }
 
         if (!had_match) {
             error("measurement '%s' failed to match regex '%s'", meas->name, meas->re);
             goto err;
         }
+        if (meas->kind == MEAS_CUSTOM_RE_ITER)
+            sb_push(bench->meas[meas - desc->meas], sum / match_count);
     }
     success = true;
 err:
@@ -1665,7 +4299,8 @@ static bool run_custom_measurements_re(struct bench_run_data *rd, void *copy_buf
         // sizes
         ((char *)copy_buffer)[nr] = '\0';
 
-        if (!run_re_on_file(rd->desc, rd->bench, copy_buffer, meas_list, regexes))
+        if (!run_re_on_file(rd->desc, rd->bench, run_idx, copy_buffer, meas_list,
+                            regexes))
             goto err;
     }
 
@@ -1703,7 +4338,7 @@ static bool run_custom_measurements(struct bench_run_data *rd)
         const struct meas *meas = rd->desc->meas + meas_idx;
         if (meas->kind == MEAS_CUSTOM)
             sb_push(custom_meas_list, meas);
-        else if (meas->kind == MEAS_CUSTOM_RE)
+        else if (meas->kind == MEAS_CUSTOM_RE || meas->kind == MEAS_CUSTOM_RE_ITER)
             sb_push(custom_re_meas_list, meas);
     }
 
@@ -1841,6 +4476,41 @@ out:
     return success;
 }
 
+// Measurements specified with --meas-expr are computed after all other
+// measurements, including custom ones, are collected
+static bool compute_meas_exprs(struct bench_data *data)
+{
+    for (size_t bench_idx = 0; bench_idx < data->bench_count; ++bench_idx) {
+        struct bench *bench = data->benches + bench_idx;
+        for (size_t meas_idx = 0; meas_idx < data->meas_count; ++meas_idx) {
+            const struct meas *meas = data->meas + meas_idx;
+            if (meas->kind != MEAS_EXPR)
+                continue;
+            const struct meas_expr *expr = g_meas_exprs + meas->event_idx;
+            for (size_t i = 0; i < sb_len(expr->ops); ++i) {
+                const struct meas_expr_op *op = expr->ops + i;
+                if (op->kind == MEAS_EXPR_MEAS &&
+                    sb_len(bench->meas[op->meas_idx]) != bench->run_count) {
+                    error("measurement '%s' used in expression '%s' is not collected in "
+                          "every run",
+                          data->meas[op->meas_idx].name, meas->name);
+                    return false;
+                }
+            }
+            for (size_t run_idx = 0; run_idx < bench->run_count; ++run_idx) {
+                double value = eval_meas_expr(expr, bench->meas, run_idx);
+                if (!isfinite(value)) {
+                    error("expression '%s' of benchmark '%s' is not finite in run %zu",
+                          meas->name, bench->name, run_idx + 1);
+                    return false;
+                }
+                sb_push(bench->meas[meas_idx], value);
+            }
+        }
+    }
+    return true;
+}
+
 bool run_benches(struct bench_data *data)
 {
     bool success = false;
@@ -1856,18 +4526,96 @@ bool run_benches(struct bench_data *data)
         thread_count = data->bench_count;
     assert(thread_count > 0);
 
+    bool use_rapl = false, use_rapl_dram = false, use_alloc_shim = false;
+    bool has_ready_condition = false;
+    for (size_t i = 0; i < data->meas_count; ++i) {
+        enum meas_kind kind = data->meas[i].kind;
+        if (kind == MEAS_ENERGY_PKG || kind == MEAS_ENERGY_DRAM || kind == MEAS_AVG_POWER)
+            use_rapl = true;
+        if (kind == MEAS_ENERGY_DRAM)
+            use_rapl_dram = true;
+        if (kind >= MEAS_IO_RCHAR && kind <= MEAS_IO_WRITE_BYTES)
+            g_use_proc_io = true;
+        if (kind == MEAS_SCHED_RUN_DELAY || kind == MEAS_SCHED_TIMESLICES)
+            g_use_schedstat = true;
+        if (kind >= MEAS_OFF_CPU_IO && kind <= MEAS_OFF_CPU_OTHER)
+            g_use_off_cpu = true;
+        if (kind == MEAS_ALLOCS || kind == MEAS_ALLOC_BYTES || kind == MEAS_PEAK_HEAP)
+            use_alloc_shim = true;
+        if (kind == MEAS_TTFB)
+            g_use_ttfb = true;
+        if (kind >= MEAS_LD_STARTUP && kind <= MEAS_LD_RELATIVE_RELOCS)
+            g_use_ld_stats = true;
+        if (kind == MEAS_PROBE)
+            g_use_probes = true;
+    }
+#ifndef __linux__
+    if (g_use_proc_io) {
+        error("I/O accounting measurements are only supported on Linux");
+        goto err;
+    }
+    if (g_use_schedstat) {
+        error("scheduler measurements are only supported on Linux");
+        goto err;
+    }
+    if (g_rss_interval != 0.0) {
+        error("--rss-timeline is only supported on Linux");
+        goto err;
+    }
+    if (use_alloc_shim) {
+        error("allocation measurements are only supported on Linux");
+        goto err;
+    }
+    if (g_perf_roi) {
+        error("--perf-roi is only supported on Linux");
+        goto err;
+    }
+    if (g_use_ld_stats) {
+        error("dynamic linker measurements are only supported on Linux");
+        goto err;
+    }
+#endif
+    if (use_rapl && !init_rapl(use_rapl_dram))
+        goto err;
+    if (g_use_off_cpu && !off_cpu_init())
+        goto err;
+    if (use_alloc_shim && !find_alloc_shim())
+        goto err;
+    if (g_requests != NULL && !load_requests())
+        goto err;
+    g_ready_mode = g_ready_re != NULL || g_ready_connect != NULL;
+    if (g_ready_mode) {
+        if (!init_ready_condition())
+            goto err;
+        has_ready_condition = true;
+    }
     if (g_use_perf && !init_perf())
         goto err;
 
+    g_signal_rds = rds;
+    g_signal_rd_count = data->bench_count;
     success = run_benches_internal(data, rds, thread_count);
     success =
         success && execute_custom_measurement_tasks(rds, data->bench_count, thread_count);
+    success = success && compute_meas_exprs(data);
 
     if (g_use_perf)
         deinit_perf();
 err:
-    for (size_t i = 0; i < data->bench_count; ++i)
+    if (has_ready_condition)
+        deinit_ready_condition();
+    sb_free(g_request_data);
+    sb_free(g_request_offsets);
+    deinit_rapl();
+    if (g_use_off_cpu)
+        off_cpu_deinit();
+    g_signal_rds = NULL;
+    g_signal_rd_count = 0;
+    for (size_t i = 0; i < data->bench_count; ++i) {
+        abort_bench(rds + i);
         sb_free(rds[i].stdout_offsets);
+        sb_free(rds[i].probe_values);
+    }
     free(rds);
     return success;
 }
@@ -61,6 +61,10 @@
 
 #include <regex.h>
 
+// Version 2 stores sample count of each measurement separately, because
+// measurements can be collected only in some runs.
+#define CSBENCH_BINARY_VERSION 2
+
 struct csbench_binary_header {
     uint32_t magic;
     uint32_t version;
@@ -130,7 +134,7 @@ bool save_bench_data_binary(const struct bench_data *data, FILE *f)
 {
     struct csbench_binary_header header = {0};
     header.magic = CSBENCH_MAGIC;
-    header.version = 1;
+    header.version = CSBENCH_BINARY_VERSION;
     header.meas_count = data->meas_count;
     header.bench_count = data->bench_count;
     header.group_count = data->group_count;
@@ -224,8 +228,10 @@ bool save_bench_data_binary(const struct bench_data *data, FILE *f)
             write_str__(bench->name, f);
             write_u64__(bench->run_count, f);
             write_raw__(bench->exit_codes, sizeof(int), bench->run_count, f);
-            for (size_t j = 0; j < data->meas_count; ++j)
-                write_raw__(bench->meas[j], sizeof(double), bench->run_count, f);
+            for (size_t j = 0; j < data->meas_count; ++j) {
+                write_u64__(sb_len(bench->meas[j]), f);
+                write_raw__(bench->meas[j], sizeof(double), sb_len(bench->meas[j]), f);
+            }
         }
 
         int at = ftell(f);
@@ -290,7 +296,7 @@ static bool load_bench_data_binary_file_internal(FILE *f, const char *filename,
         error("invalid magic number in csbench data file '%s'", filename);
         return false;
     }
-    if (header.version != 1) {
+    if (header.version != 1 && header.version != CSBENCH_BINARY_VERSION) {
         error("invalid version in csbench data file '%s'", filename);
         return false;
     }
@@ -385,8 +391,13 @@ static bool load_bench_data_binary_file_internal(FILE *f, const char *filename,
             sb_resize(bench->exit_codes, bench->run_count);
             read_raw__(bench->exit_codes, sizeof(int), bench->run_count, f);
             for (size_t j = 0; j < data->meas_count; ++j) {
-                sb_resize(bench->meas[j], bench->run_count);
-                read_raw__(bench->meas[j], sizeof(double), bench->run_count, f);
+                size_t count = bench->run_count;
+                if (header.version >= 2)
+                    read_u64__(count, f);
+                if (count > bench->run_count)
+                    goto corrupted;
+                sb_resize(bench->meas[j], count);
+                read_raw__(bench->meas[j], sizeof(double), count, f);
             }
         }
 
@@ -884,7 +895,7 @@ static void init_parsed_text_meas(const struct parsed_text_file *parsed, struct
             return;
         }
     }
-    struct meas meas = {"meas", NULL, NULL, {MU_NONE, NULL}, MEAS_CUSTOM, false, 0};
+    struct meas meas = {"meas", NULL, NULL, {MU_NONE, NULL}, MEAS_CUSTOM, false, 0, 0};
     if (parsed->meas_units) {
         parse_units_str(parsed->meas_units, &meas.units);
         if (meas.units.str != NULL) {
@@ -54,6 +54,7 @@
 #include "csbench.h"
 
 #include <assert.h>
+#include <ctype.h>
 #include <errno.h>
 #include <math.h>
 #include <signal.h>
@@ -117,6 +118,29 @@ bool units_is_time(const struct units *units)
     return false;
 }
 
+// Multiplier converting value in 'units' to base units, seconds for time and
+// bytes for memory. Other units are left as is.
+double units_base_multiplier(const struct units *units)
+{
+    switch (units->kind) {
+    case MU_MS:
+        return 1e-3;
+    case MU_US:
+        return 1e-6;
+    case MU_NS:
+        return 1e-9;
+    case MU_KB:
+        return 1 << 10;
+    case MU_MB:
+        return 1 << 20;
+    case MU_GB:
+        return 1 << 30;
+    default:
+        break;
+    }
+    return 1.0;
+}
+
 int format_time(char *dst, size_t sz, double t)
 {
     int count = 0;
@@ -191,6 +215,43 @@ int format_memory(char *dst, size_t sz, double t)
     return count;
 }
 
+// Format value with metric prefix, used for units that are not time or memory
+int format_si(char *dst, size_t sz, double t, const char *units)
+{
+    int count = 0;
+    if (t < 0) {
+        t = -t;
+        count = snprintf(dst, sz, "-");
+        dst += count;
+        sz -= count;
+    }
+
+    const char *prefix = "";
+    if (t >= 1e6) {
+        prefix = "M";
+        t *= 1e-6;
+    } else if (t >= 1e3) {
+        prefix = "k";
+        t *= 1e-3;
+    } else if (t >= 1) {
+    } else if (t >= 1e-3) {
+        prefix = "m";
+        t *= 1e3;
+    } else if (t >= 1e-6) {
+        prefix = "μ";
+        t *= 1e6;
+    }
+
+    if (t >= 1e2)
+        count += snprintf(dst, sz, "%.1f %s%s", t, prefix, units);
+    else if (t >= 1e1)
+        count += snprintf(dst, sz, "%.2f %s%s", t, prefix, units);
+    else
+        count += snprintf(dst, sz, "%.3f %s%s", t, prefix, units);
+
+    return count;
+}
+
 void format_meas(char *buf, size_t buf_size, double value, const struct units *units)
 {
     switch (units->kind) {
@@ -224,6 +285,12 @@ void format_meas(char *buf, size_t buf_size, double value, const struct units *u
     case MU_NONE:
         snprintf(buf, buf_size, "%.3g", value);
         break;
+    case MU_J:
+        format_si(buf, buf_size, value, "J");
+        break;
+    case MU_W:
+        format_si(buf, buf_size, value, "W");
+        break;
     }
 }
 
@@ -261,6 +328,10 @@ const char *units_str(const struct units *units)
         return units->str;
     case MU_NONE:
         return "";
+    case MU_J:
+        return "J";
+    case MU_W:
+        return "W";
     }
     return NULL;
 }
@@ -455,6 +526,65 @@ double get_time(void)
 }
 #endif
 
+// Values below 2^(HDR_SUB_BUCKET_BITS + 1) nanoseconds are recorded exactly,
+// larger ones are rounded to HDR_SUB_BUCKET_BITS significant bits
+#define HDR_SUB_BUCKET_BITS 10
+#define HDR_EXACT_COUNT (UINT64_C(2) << HDR_SUB_BUCKET_BITS)
+#define HDR_SUB_BUCKET_COUNT (UINT64_C(1) << HDR_SUB_BUCKET_BITS)
+
+static size_t hdr_hist_index(uint64_t value)
+{
+    if (value < HDR_EXACT_COUNT)
+        return value;
+    int shift = 63 - __builtin_clzll(value) - HDR_SUB_BUCKET_BITS;
+    uint64_t sub_bucket = (value >> shift) - HDR_SUB_BUCKET_COUNT;
+    return HDR_EXACT_COUNT + (shift - 1) * HDR_SUB_BUCKET_COUNT + sub_bucket;
+}
+
+static uint64_t hdr_hist_value(size_t idx)
+{
+    if (idx < HDR_EXACT_COUNT)
+        return idx;
+    idx -= HDR_EXACT_COUNT;
+    int shift = idx / HDR_SUB_BUCKET_COUNT + 1;
+    uint64_t sub_bucket = idx % HDR_SUB_BUCKET_COUNT + HDR_SUB_BUCKET_COUNT;
+    return (sub_bucket << shift) + (UINT64_C(1) << (shift - 1));
+}
+
+void hdr_hist_record(struct hdr_hist *hist, double value)
+{
+    uint64_t ns = value > 0.0 ? (uint64_t)(value * 1e9 + 0.5) : 0;
+    size_t idx = hdr_hist_index(ns);
+    size_t old_len = sb_len(hist->counts);
+    if (idx >= old_len) {
+        sb_resize(hist->counts, idx + 1);
+        memset(hist->counts + old_len, 0, (idx + 1 - old_len) * sizeof(*hist->counts));
+    }
+    ++hist->counts[idx];
+    ++hist->total;
+}
+
+double hdr_hist_quantile(const struct hdr_hist *hist, double q)
+{
+    if (hist->total == 0)
+        return 0.0;
+    uint64_t rank = (uint64_t)ceil(q * hist->total);
+    if (rank == 0)
+        rank = 1;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < sb_len(hist->counts); ++i) {
+        seen += hist->counts[i];
+        if (seen >= rank)
+            return hdr_hist_value(i) / 1e9;
+    }
+    return hdr_hist_value(sb_len(hist->counts) - 1) / 1e9;
+}
+
+void free_hdr_hist(struct hdr_hist *hist)
+{
+    sb_free(hist->counts);
+}
+
 __attribute__((format(printf, 2, 3))) FILE *open_file_fmt(const char *mode, const char *fmt,
                                                           ...)
 {
@@ -670,6 +800,16 @@ void error(const char *fmt, ...)
     va_end(args);
 }
 
+void warning(const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    fprintf_colored(stderr, ANSI_YELLOW, "warning: ");
+    vfprintf(stderr, fmt, args);
+    putc('\n', stderr);
+    va_end(args);
+}
+
 char *csstrerror(char *buf, size_t buf_size, int err)
 {
     char *err_msg;
@@ -864,6 +1004,10 @@ void parse_units_str(const char *str, struct units *units)
         units->kind = MU_MB;
     } else if (strcmp(str, "gb") == 0) {
         units->kind = MU_GB;
+    } else if (strcmp(str, "j") == 0) {
+        units->kind = MU_J;
+    } else if (strcmp(str, "w") == 0) {
+        units->kind = MU_W;
     } else if (strcmp(str, "none") == 0) {
         units->kind = MU_NONE;
     } else {
@@ -898,12 +1042,373 @@ bool parse_meas_str(const char *str, enum meas_kind *kind)
         *kind = MEAS_PERF_BRANCH;
     } else if (strcmp(str, "branch-misses") == 0) {
         *kind = MEAS_PERF_BRANCHM;
+    } else if (strcmp(str, "energy-pkg") == 0) {
+        *kind = MEAS_ENERGY_PKG;
+    } else if (strcmp(str, "energy-dram") == 0) {
+        *kind = MEAS_ENERGY_DRAM;
+    } else if (strcmp(str, "avg-power") == 0) {
+        *kind = MEAS_AVG_POWER;
+    } else if (strcmp(str, "rchar") == 0) {
+        *kind = MEAS_IO_RCHAR;
+    } else if (strcmp(str, "wchar") == 0) {
+        *kind = MEAS_IO_WCHAR;
+    } else if (strcmp(str, "syscr") == 0) {
+        *kind = MEAS_IO_SYSCR;
+    } else if (strcmp(str, "syscw") == 0) {
+        *kind = MEAS_IO_SYSCW;
+    } else if (strcmp(str, "read_bytes") == 0) {
+        *kind = MEAS_IO_READ_BYTES;
+    } else if (strcmp(str, "write_bytes") == 0) {
+        *kind = MEAS_IO_WRITE_BYTES;
+    } else if (strcmp(str, "run-delay") == 0) {
+        *kind = MEAS_SCHED_RUN_DELAY;
+    } else if (strcmp(str, "timeslices") == 0) {
+        *kind = MEAS_SCHED_TIMESLICES;
+    } else if (strcmp(str, "offcpu-io") == 0) {
+        *kind = MEAS_OFF_CPU_IO;
+    } else if (strcmp(str, "offcpu-futex") == 0) {
+        *kind = MEAS_OFF_CPU_FUTEX;
+    } else if (strcmp(str, "offcpu-sleep") == 0) {
+        *kind = MEAS_OFF_CPU_SLEEP;
+    } else if (strcmp(str, "offcpu-preempt") == 0) {
+        *kind = MEAS_OFF_CPU_PREEMPT;
+    } else if (strcmp(str, "offcpu-other") == 0) {
+        *kind = MEAS_OFF_CPU_OTHER;
+    } else if (strcmp(str, "allocs") == 0) {
+        *kind = MEAS_ALLOCS;
+    } else if (strcmp(str, "alloc-bytes") == 0) {
+        *kind = MEAS_ALLOC_BYTES;
+    } else if (strcmp(str, "peak-heap") == 0) {
+        *kind = MEAS_PEAK_HEAP;
+    } else if (strcmp(str, "ttfb") == 0) {
+        *kind = MEAS_TTFB;
+    } else if (strcmp(str, "time-to-ready") == 0) {
+        *kind = MEAS_TIME_TO_READY;
+    } else if (strcmp(str, "ld-startup") == 0) {
+        *kind = MEAS_LD_STARTUP;
+    } else if (strcmp(str, "ld-reloc-time") == 0) {
+        *kind = MEAS_LD_RELOC_TIME;
+    } else if (strcmp(str, "ld-load-time") == 0) {
+        *kind = MEAS_LD_LOAD_TIME;
+    } else if (strcmp(str, "ld-relocs") == 0) {
+        *kind = MEAS_LD_RELOCS;
+    } else if (strcmp(str, "ld-relative-relocs") == 0) {
+        *kind = MEAS_LD_RELATIVE_RELOCS;
     } else {
         return false;
     }
     return true;
 }
 
+struct meas_expr_parser {
+    const char *str;
+    const char *cursor;
+    const struct meas *meas;
+    size_t meas_count;
+    struct meas_expr *expr;
+    // Depth of evaluation stack at current point
+    size_t depth;
+    // Base units of values on evaluation stack, and whether they are constants
+    struct units units[MEAS_EXPR_MAX_STACK + 1];
+    bool is_const[MEAS_EXPR_MAX_STACK + 1];
+};
+
+static bool meas_expr_parse_sum(struct meas_expr_parser *p);
+
+static void meas_expr_skip_spaces(struct meas_expr_parser *p)
+{
+    while (isspace((unsigned char)*p->cursor))
+        ++p->cursor;
+}
+
+static bool meas_expr_is_ident_char(char c)
+{
+    return isalnum((unsigned char)c) || c == '_' || c == '-' || c == '.' || c == ':';
+}
+
+static bool units_equal(const struct units *a, const struct units *b)
+{
+    if (a->kind != b->kind)
+        return false;
+    return a->kind != MU_CUSTOM || strcmp(a->str, b->str) == 0;
+}
+
+// Units of result of binary operation on values at the top of the stack.
+// Constants take units of other operand. Product and quotient of two
+// measurements have no units, because they can't be represented.
+static bool meas_expr_binary_units(struct meas_expr_parser *p, enum meas_expr_op_kind kind)
+{
+    struct units *lhs = p->units + p->depth - 2, *rhs = p->units + p->depth - 1;
+    bool *lhs_const = p->is_const + p->depth - 2, rhs_const = p->is_const[p->depth - 1];
+    if (rhs_const)
+        return true;
+    if (*lhs_const) {
+        *lhs = *rhs;
+        *lhs_const = false;
+        return true;
+    }
+    switch (kind) {
+    case MEAS_EXPR_ADD:
+    case MEAS_EXPR_SUB:
+        if (!units_equal(lhs, rhs)) {
+            error("can't add or subtract measurements in %s and %s in expression '%s'",
+                  units_str(lhs), units_str(rhs), p->str);
+            return false;
+        }
+        break;
+    default:
+        lhs->kind = MU_NONE;
+        break;
+    }
+    return true;
+}
+
+static bool meas_expr_emit(struct meas_expr_parser *p, struct meas_expr_op op)
+{
+    switch (op.kind) {
+    case MEAS_EXPR_CONST:
+        p->units[p->depth].kind = MU_NONE;
+        p->is_const[p->depth] = true;
+        ++p->depth;
+        break;
+    case MEAS_EXPR_MEAS: {
+        const struct units *units = &p->meas[op.meas_idx].units;
+        op.value = units_base_multiplier(units);
+        if (units_is_time(units))
+            p->units[p->depth].kind = MU_S;
+        else if (units->kind == MU_KB || units->kind == MU_MB || units->kind == MU_GB)
+            p->units[p->depth].kind = MU_B;
+        else
+            p->units[p->depth] = *units;
+        p->is_const[p->depth] = false;
+        ++p->depth;
+        break;
+    }
+    case MEAS_EXPR_ADD:
+    case MEAS_EXPR_SUB:
+    case MEAS_EXPR_MUL:
+    case MEAS_EXPR_DIV:
+        if (!meas_expr_binary_units(p, op.kind))
+            return false;
+        --p->depth;
+        break;
+    case MEAS_EXPR_NEG:
+        break;
+    }
+    sb_push(p->expr->ops, op);
+    return true;
+}
+
+static bool meas_expr_resolve(struct meas_expr_parser *p, const char *name, size_t *idx)
+{
+    for (size_t i = 0; i < p->meas_count; ++i) {
+        if (strcmp(p->meas[i].name, name) == 0) {
+            *idx = i;
+            return true;
+        }
+    }
+    // Builtin measurements can also be referred to by the name used in --meas
+    enum meas_kind kind;
+    if (parse_meas_str(name, &kind)) {
+        for (size_t i = 0; i < p->meas_count; ++i) {
+            if (p->meas[i].kind == kind) {
+                *idx = i;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+static bool meas_expr_parse_primary(struct meas_expr_parser *p)
+{
+    meas_expr_skip_spaces(p);
+    const char *start = p->cursor;
+    struct meas_expr_op op;
+    memset(&op, 0, sizeof(op));
+    if (*start == '(') {
+        ++p->cursor;
+        if (!meas_expr_parse_sum(p))
+            return false;
+        meas_expr_skip_spaces(p);
+        if (*p->cursor != ')') {
+            error("expected ')' at position %zu in expression '%s'",
+                  (size_t)(p->cursor - p->str) + 1, p->str);
+            return false;
+        }
+        ++p->cursor;
+        return true;
+    }
+    if (isdigit((unsigned char)*start) || *start == '.') {
+        char *end;
+        op.kind = MEAS_EXPR_CONST;
+        op.value = strtod(start, &end);
+        if (end == start) {
+            error("invalid number at position %zu in expression '%s'",
+                  (size_t)(start - p->str) + 1, p->str);
+            return false;
+        }
+        p->cursor = end;
+    } else if (meas_expr_is_ident_char(*start) && *start != '-') {
+        while (meas_expr_is_ident_char(*p->cursor))
+            ++p->cursor;
+        size_t len = p->cursor - start;
+        char name[256];
+        if (len >= sizeof(name))
+            len = sizeof(name) - 1;
+        memcpy(name, start, len);
+        name[len] = '\0';
+        op.kind = MEAS_EXPR_MEAS;
+        if (!meas_expr_resolve(p, name, &op.meas_idx)) {
+            if (strchr(name, '-') != NULL)
+                error("unknown measurement '%s' in expression '%s' (subtraction requires "
+                      "spaces around '-')",
+                      name, p->str);
+            else
+                error("unknown measurement '%s' in expression '%s'", name, p->str);
+            return false;
+        }
+    } else {
+        if (*start == '\0')
+            error("unexpected end of expression '%s'", p->str);
+        else
+            error("unexpected character '%c' at position %zu in expression '%s'", *start,
+                  (size_t)(start - p->str) + 1, p->str);
+        return false;
+    }
+    if (!meas_expr_emit(p, op))
+        return false;
+    if (p->depth > MEAS_EXPR_MAX_STACK) {
+        error("expression '%s' is too complex", p->str);
+        return false;
+    }
+    return true;
+}
+
+static bool meas_expr_parse_unary(struct meas_expr_parser *p)
+{
+    meas_expr_skip_spaces(p);
+    if (*p->cursor == '-') {
+        ++p->cursor;
+        if (!meas_expr_parse_unary(p))
+            return false;
+        struct meas_expr_op op = {MEAS_EXPR_NEG, 0.0, 0};
+        return meas_expr_emit(p, op);
+    }
+    if (*p->cursor == '+')
+        ++p->cursor;
+    return meas_expr_parse_primary(p);
+}
+
+static bool meas_expr_parse_product(struct meas_expr_parser *p)
+{
+    if (!meas_expr_parse_unary(p))
+        return false;
+    for (;;) {
+        meas_expr_skip_spaces(p);
+        struct meas_expr_op op = {MEAS_EXPR_MUL, 0.0, 0};
+        if (*p->cursor == '*')
+            op.kind = MEAS_EXPR_MUL;
+        else if (*p->cursor == '/')
+            op.kind = MEAS_EXPR_DIV;
+        else
+            break;
+        ++p->cursor;
+        if (!meas_expr_parse_unary(p))
+            return false;
+        if (!meas_expr_emit(p, op))
+            return false;
+    }
+    return true;
+}
+
+static bool meas_expr_parse_sum(struct meas_expr_parser *p)
+{
+    if (!meas_expr_parse_product(p))
+        return false;
+    for (;;) {
+        meas_expr_skip_spaces(p);
+        struct meas_expr_op op = {MEAS_EXPR_ADD, 0.0, 0};
+        if (*p->cursor == '+')
+            op.kind = MEAS_EXPR_ADD;
+        else if (*p->cursor == '-')
+            op.kind = MEAS_EXPR_SUB;
+        else
+            break;
+        ++p->cursor;
+        if (!meas_expr_parse_product(p))
+            return false;
+        if (!meas_expr_emit(p, op))
+            return false;
+    }
+    return true;
+}
+
+bool compile_meas_expr(const char *str, const struct meas *meas, size_t meas_count,
+                       struct meas_expr *expr)
+{
+    memset(expr, 0, sizeof(*expr));
+    expr->str = str;
+    struct meas_expr_parser p;
+    memset(&p, 0, sizeof(p));
+    p.str = p.cursor = str;
+    p.meas = meas;
+    p.meas_count = meas_count;
+    p.expr = expr;
+    if (!meas_expr_parse_sum(&p))
+        goto err;
+    meas_expr_skip_spaces(&p);
+    if (*p.cursor != '\0') {
+        error("unexpected character '%c' at position %zu in expression '%s'", *p.cursor,
+              (size_t)(p.cursor - str) + 1, str);
+        goto err;
+    }
+    assert(p.depth == 1);
+    expr->units = p.units[0];
+    return true;
+err:
+    sb_free(expr->ops);
+    return false;
+}
+
+double eval_meas_expr(const struct meas_expr *expr, double *const *meas, size_t run_idx)
+{
+    double stack[MEAS_EXPR_MAX_STACK];
+    size_t top = 0;
+    for (size_t i = 0; i < sb_len(expr->ops); ++i) {
+        const struct meas_expr_op *op = expr->ops + i;
+        switch (op->kind) {
+        case MEAS_EXPR_CONST:
+            stack[top++] = op->value;
+            break;
+        case MEAS_EXPR_MEAS:
+            stack[top++] = meas[op->meas_idx][run_idx] * op->value;
+            break;
+        case MEAS_EXPR_ADD:
+            --top;
+            stack[top - 1] += stack[top];
+            break;
+        case MEAS_EXPR_SUB:
+            --top;
+            stack[top - 1] -= stack[top];
+            break;
+        case MEAS_EXPR_MUL:
+            --top;
+            stack[top - 1] *= stack[top];
+            break;
+        case MEAS_EXPR_DIV:
+            --top;
+            stack[top - 1] /= stack[top];
+            break;
+        case MEAS_EXPR_NEG:
+            stack[top - 1] = -stack[top - 1];
+            break;
+        }
+    }
+    assert(top == 1);
+    return stack[0];
+}
+
 bool get_term_win_size(size_t *rows, size_t *cols)
 {
     struct winsize ws;
@@ -5,7 +5,7 @@ import itertools
 file_names = ["csbench.h", "csbench.c", "csbench_plot.c", "csbench_perf.c",
               "csbench_utils.c", "csbench_run.c", "csbench_report.c",
               "csbench_analyze.c", "csbench_serialize.c", "csbench_cli.c",
-              "csbench_html.c"]
+              "csbench_html.c", "csbench_profile.c", "csbench_probe.h"]
 files = {}
 for name in file_names:
     with open(name, encoding="utf8") as f:
@@ -16,6 +16,7 @@ preample = list(itertools.takewhile(lambda it: it.startswith("//"), files["csben
 def make_core_contents(lines):
     lines = list(itertools.dropwhile(lambda it: it.startswith("//"), lines))
     lines = list(filter(lambda it: "#include \"csbench.h\"" not in it, lines))
+    lines = list(filter(lambda it: "#include \"csbench_probe.h\"" not in it, lines))
     lines = list(filter(lambda it: "#ifndef CSBENCH_H" not in it, lines))
     lines = list(filter(lambda it: "#define CSBENCH_H" not in it, lines))
     lines = list(filter(lambda it: "#endif // CSBENCH_H" not in it, lines))
@@ -28,6 +29,8 @@ def make_core_contents(lines):
 amalgamated_source = preample \
         + make_core_contents(files["csbench.h"]) \
         + ["\n"] \
+        + make_core_contents(files["csbench_probe.h"]) \
+        + ["\n"] \
         + make_core_contents(files["csbench_cli.c"]) \
         + ["\n"] \
         + make_core_contents(files["csbench_run.c"]) \
@@ -46,6 +49,8 @@ amalgamated_source = preample \
         + ["\n"] \
         + make_core_contents(files["csbench_perf.c"]) \
         + ["\n"] \
+        + make_core_contents(files["csbench_profile.c"]) \
+        + ["\n"] \
         + make_core_contents(files["csbench.c"])
 
 with open("csbench_amalgamated.c", "w", encoding="utf8") as f:
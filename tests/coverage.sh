@@ -35,6 +35,7 @@ good $csbench ls --shell=none
 good $csbench ls -N
 good $csbench 'echo 0.5' --custom t --no-default-meas
 good $csbench 'echo "Time: 123 ms"' --custom-re time ms 'Time: ([0-9]+) ms' --no-default-meas
+good $csbench 'printf "t 1\nt 2\nt 4\n"' --custom-re-iter t ms 't ([0-9]+)' --no-default-meas --html
 good $csbench 'echo 0.5' --custom-t t 'cat' --no-default-meas
 good $csbench 'echo 1024' --custom-x size b 'cat' --no-default-meas
 good $csbench 'sleep {n}' --param n/0.1,0.2,0.5 
@@ -75,15 +76,45 @@ good $csbench 'sleep 0.1' --simple
 good $csbench 'sleep 0.1' --html
 good $csbench 'sleep {n}' --param-range n/1/5 --plot --plot-src
 good $csbench 'sleep {n}' --param-range n/1/10 --regr
+good $csbench 'sleep 0.{n}' --param-range n/1/4 --scaling
+good $csbench 'sleep 0.1' --setup true --teardown true --service 'sleep 10' --service-ready true
 bad $csbench 'cmd1' 'cmd2' --rename-all first,second
 good $csbench 'echo $0' --shell /bin/bash
 good $csbench 'echo $SHELL' --shell inherit
 good $csbench 'cat' --input /etc/hosts --inputs 'hello'
+good $csbench 'cat' 'head -c 1' --input /etc/hosts --pipe-io --drain-rate 1000000
+good $csbench 'cat' --input /etc/hosts --cache both --cache-file /etc/passwd --flush-llc
+# --flush-llc must not make fork slower or inflate maxrss of command
+llc_stats() {
+    rm -rf "$dist_dir/llc"
+    $inner 'true' -R 20 -W 1 --meas wall,maxrss --csv -o "$dist_dir/llc" "$@" > /dev/null &&
+        awk -F, 'NR > 1 { w += $1; if ($NF > m) m = $NF } END { print w / (NR - 1), m }' \
+            "$dist_dir/llc/bench_raw_0.csv"
+}
+read -r wall rss <<< "$(llc_stats)"
+read -r llc_wall llc_rss <<< "$(llc_stats --flush-llc)"
+good awk -v w="$wall" -v r="$rss" -v lw="$llc_wall" -v lr="$llc_rss" \
+    'BEGIN { exit !(w > 0 && lw < 2 * w + 0.002 && lr < r + 1024) }'
+good $csbench 'sh -c "echo hi; sleep 0.01"' --meas=ttfb
+good $csbench 'sh -c "echo ready >&2; sleep 10"' --ready-re '^ready$'
+good $csbench 'cat' 'sed -u s/a/b/' --requests /etc/hosts --pipeline 4 -R 200 --html
+good $csbench 'ls' --meas ld-startup,ld-reloc-time,ld-relocs --shell none
 bad $csbench 'echo no number' --custom-re time ms '([0-9]+)' --no-default-meas
 bad $csbench 'echo 0.5' --custom-t t 'false' --no-default-meas
 bad $csbench 'echo abc' --custom t --no-default-meas
 bad $csbench 'true' --prepare 'false' --ignore-failure
+bad $csbench 'true' --prepare 'if'
+bad $csbench 'true' --prepare "echo 'abc"
 bad $csbench 'true' --round-prepare 'false' --round-runs 2
+bad $csbench 'true' --service 'true' --service-ready 'false' --service-timeout 0.1
+bad $csbench 'cat' --pipe-io
+bad $csbench 'true' --meas=ttfb
+bad $csbench 'sleep 10' --ready-connect 1 --ready-timeout 0.1
+bad $csbench 'true' --meas=time-to-ready
+bad $csbench 'true' --requests /etc/hosts
+bad $csbench 'head -n 3' --requests /etc/hosts --request-timeout 0.1
+bad $csbench 'true' --meas=not-an-event
+bad $csbench 'true' --cache cold --cache-file /nonexistent
 good $csbench 'sleep 0.1' 'sleep 0.2' --jobs 10
 bad $csbench 'sleep 0.1' --jobs 0
 bad $csbench 'sleep 0.1' --runs 0
@@ -98,6 +129,55 @@ bad $csbench 'sleep {a} && sleep {b}' --param a/0.1,0.2 --param b/0.3,0.4
 good $csbench 'sleep 2' --time-limit 0.1
 good $csbench 'sleep 0.5' --warmup 10 --runs 1
 # good $csbench 'sleep 0.1' --meas=wall,stime,utime,maxrss,minflt,majflt,nvcsw,nivcsw,cycles,branches,branch-misses
+# good $csbench 'sleep 0.1' --meas=cache-misses,LLC-load-misses,dTLB-load-misses,r01c2,4:0x3c
+# good $csbench 'sleep 0.1' --meas=cycles,cache-misses,LLC-load-misses --perf-rotate --perf-slots 2
+# good $csbench 'ls | wc -l' --meas=cycles:u,instructions:k --perf-split --meas=branches
+bad $csbench 'true' --meas=cycles:x
+good $csbench 'ls' --meas=task-clock,context-switches,page-faults
+good $csbench 'cat /etc/passwd' --meas=rchar,wchar,syscr,syscw,read_bytes,write_bytes
+good $csbench 'sleep 0.01' 'ls' --meas=run-delay,timeslices --shell=none
+good $csbench 'ls' 'ls -la' --meas=allocs,alloc-bytes,peak-heap --shell=none
+bad $csbench 'ls' --meas=allocs --alloc-shim /nonexistent/libcsbench_alloc.so
+good $csbench 'sleep 0.1' 'sleep 0.05 | sort' --rss-timeline 10ms --plot
+bad $csbench 'true' --rss-timeline 100ms
+probe=$(mktemp -d)
+cat > "$probe/probe.c" << EOF
+#define _POSIX_C_SOURCE 200809L
+#include "csbench_probe.h"
+int main(void) {
+    double start = csbench_probe_now();
+    csbench_probe_roi_begin();
+    csbench_probe_add("items", 10);
+    csbench_probe_roi_end();
+    csbench_probe_end("region", start);
+    return 0;
+}
+EOF
+good cc -std=c99 -I. -o "$probe/probe" "$probe/probe.c"
+good $csbench "$probe/probe" --probe region --probe-x items none --shell=none
+bad $csbench 'ls' --probe region
+bad $csbench 'ls' --probe-x $(printf '%048d' 0) none
+good $csbench "$probe/probe" --meas=task-clock --perf-roi --shell=none
+bad $csbench "$probe/probe" --meas=task-clock --perf-roi --rss-timeline 1ms --shell=none
+bad $csbench 'ls' --meas=task-clock --perf-roi
+bad $csbench 'ls' --perf-roi
+rm -rf "$probe"
+good $csbench 'ls' --meas-expr 'cpu=utime + stime' --meas-expr 'share=cpu / wall'
+bad $csbench 'ls' --meas-expr 'x=unknown * 2'
+bad $csbench 'ls' --meas-expr 'wall=wall * 2'
+bad $csbench 'ls' --meas maxrss --meas-expr 'x=wall + maxrss'
+powercap=$(mktemp -d)
+mkdir "$powercap/intel-rapl:0"
+echo package-0 > "$powercap/intel-rapl:0/name"
+echo 1000000 > "$powercap/intel-rapl:0/max_energy_range_uj"
+echo 500 > "$powercap/intel-rapl:0/energy_uj"
+good $csbench 'ls' --meas=energy-pkg,avg-power --powercap-root "$powercap"
+bad $csbench 'ls' --meas=energy-dram --powercap-root "$powercap"
+rm -rf "$powercap"
+# good $csbench 'sleep 0.1' 'ls' --tma
+bad $csbench 'true' --meas=cycles --perf-rotate --perf-slots 1 --runs 2
+# good $csbench 'ls' 'ls -la' --profile --profile-runs 2 --html
+# good $csbench 'sleep 0.01' 'cat /etc/passwd' --off-cpu --html
 good $csbench 'echo 250' --custom-x time ms 'cat' --no-default-meas
 good $csbench 'echo 1' --custom-x xyz invalid 'cat'
 bad $csbench 'echo 123' --custom-t t 'true' --no-default-meas